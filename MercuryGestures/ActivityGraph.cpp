@@ -20,10 +20,14 @@ void ActivityGraph::setVideoProperties(int frameWidth, int frameHeight) {
 void ActivityGraph::clearGraph() {
 	this->graph = cv::Mat::zeros(this->frameHeight, this->frameWidth, CV_8UC3);
 	this->graphMask = cv::Mat::zeros(this->frameHeight, this->frameWidth, CV_8UC3);
+	this->drawnArea = cv::Rect();
 	this->counter = 0;
 }
 
-void ActivityGraph::addChannel(std::string channelName, cv::Scalar color, double offset) {
+/*
+* Add a channel, returns the handle to set its value with.
+*/
+int ActivityGraph::addChannel(std::string channelName, cv::Scalar color, double offset) {
 	this->channelColors.push_back(color);
 	this->channelOffset.push_back(offset);
 	this->channelValues.push_back(0);
@@ -32,11 +36,33 @@ void ActivityGraph::addChannel(std::string channelName, cv::Scalar color, double
 	int index = this->channelColors.size() - 1;
 	
 	this->channelNames[channelName] = index;
+	return index;
 }
 
+/*
+* The handle of a channel by its name, -1 if there is no such channel.
+*/
+int ActivityGraph::getChannel(std::string channelName) {
+	auto iterator = this->channelNames.find(channelName);
+	return iterator == this->channelNames.end() ? -1 : iterator->second;
+}
+
+void ActivityGraph::setValue(int channel, double value) {
+	if (channel < 0 || channel >= this->channelValues.size())
+		return;
+	this->channelValues[channel] = value;
+}
+
+/*
+* Set a value by the name of the channel. Unknown names are ignored, use the handle where the value is set every frame.
+*/
 void ActivityGraph::setValue(std::string channelName, double value) {
-	int index = this->channelNames[channelName];
-	this->channelValues[index] = value;
+	this->setValue(this->getChannel(channelName), value);
+}
+
+void ActivityGraph::markDrawn(cv::Rect area) {
+	area &= cv::Rect(0, 0, this->frameWidth, this->frameHeight);
+	this->drawnArea = this->drawnArea.area() == 0 ? area : this->drawnArea | area;
 }
 
 void ActivityGraph::drawLegend() {
@@ -52,6 +78,9 @@ void ActivityGraph::drawLegend() {
 		cv::rectangle(this->graphMask, colorArea, CV_RGB(255, 255, 255), CV_FILLED);
 		cv::rectangle(this->graph, colorArea, this->channelColors[index], CV_FILLED);
 		cv::putText(this->graph, name, cv::Point(35, legendHeight + 0.75*boxSize), CV_FONT_HERSHEY_PLAIN, 1, CV_RGB(255, 255, 255));
+		int baseline = 0;
+		cv::Size textSize = cv::getTextSize(name, CV_FONT_HERSHEY_PLAIN, 1, 1, &baseline);
+		this->markDrawn(cv::Rect(10, legendHeight, 25 + textSize.width + 1, std::max(boxSize, textSize.height + baseline) + 1));
 
 		legendCounter++;
 	}
@@ -61,6 +90,14 @@ void ActivityGraph::drawLegend() {
 * Draw a graph repesenting the movement over time. This will be drawn on the RGB frame.
 */
 void ActivityGraph::draw(cv::Mat& canvas) {
+	this->update();
+	this->composite(canvas);
+}
+
+/*
+* Draw the values of this frame into the graph layer. Only the new segments are drawn.
+*/
+void ActivityGraph::update() {
 	// Reset the scrollling graph if the graphSeconds are over
 	int graphFrameCount = this->graphSeconds*this->fps;
 	if (this->counter % graphFrameCount == 0) {
@@ -74,8 +111,13 @@ void ActivityGraph::draw(cv::Mat& canvas) {
 
 	// drawing the time line indicators every 5 seconds
 	if (this->counter % (5 * this->fps) == 0) {
-		cv::putText(this->graph, joinString(this->ticks / this->fps, "s"), cv::Point(x, this->frameHeight), CV_FONT_HERSHEY_PLAIN, 0.9, CV_RGB(255, 255, 255));
+		std::string tick = joinString(this->ticks / this->fps, "s");
+		cv::putText(this->graph, tick, cv::Point(x, this->frameHeight), CV_FONT_HERSHEY_PLAIN, 0.9, CV_RGB(255, 255, 255));
 		cv::line(this->graph, (cv::Point(x, this->frameHeight)), (cv::Point(x, this->frameHeight - graphHeight)), CV_RGB(255,255,255));
+		int baseline = 0;
+		cv::Size textSize = cv::getTextSize(tick, CV_FONT_HERSHEY_PLAIN, 0.9, 1, &baseline);
+		int top = std::min(this->frameHeight - graphHeight, this->frameHeight - textSize.height);
+		this->markDrawn(cv::Rect(x, top, textSize.width + 1, this->frameHeight - top));
 	}
 
 	// draw all channels
@@ -96,17 +138,30 @@ void ActivityGraph::draw(cv::Mat& canvas) {
 			// draw the data lines
 			cv::line(this->graph, (cv::Point(prevX, prevY)), (cv::Point(x, y)), this->channelColors[i], 1, CV_AA);
 			cv::line(this->graphMask, (cv::Point(prevX, prevY)), (cv::Point(x, y)), CV_RGB(255,255,255), 1, CV_AA);
+
+			// the anti aliased line reaches a pixel past its ends
+			int top = std::min(channelOffsetY, std::min(prevY, y));
+			int bottom = std::max(channelOffsetY, std::max(prevY, y));
+			this->markDrawn(cv::Rect(0, top - 1, x + 2, bottom - top + 3));
 		}
 
 		// store the previous value.
 		this->channelPreviousValues[i] = value;
 	}
 
-	// merge to frame
-	cv::subtract(canvas, this->graphMask, canvas);
-	cv::add(canvas, this->graph, canvas);
-
 	this->counter++;
 	this->ticks++;
 }
 
+/*
+* Merge the graph layer onto the canvas, only where something was drawn.
+*/
+void ActivityGraph::composite(cv::Mat& canvas) {
+	cv::Rect area = this->drawnArea & cv::Rect(0, 0, canvas.cols, canvas.rows);
+	if (area.area() == 0 || this->graph.size() != canvas.size())
+		return;
+	cv::Mat target = canvas(area);
+	cv::subtract(target, this->graphMask(area), target);
+	cv::add(target, this->graph(area), target);
+}
+
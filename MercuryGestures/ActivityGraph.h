@@ -2,10 +2,16 @@
 
 #include "MercuryCore.h"
 
+/*
+* A scrolling graph of some channels over the frame. The graph is a layer of its own: update draws the new segment of
+* every channel into it, composite merges it onto a canvas. Only the part of the layer something was drawn in is merged.
+* draw does both, a viewer that shows the frame later can update once per frame and composite at display time.
+*/
 class ActivityGraph {
 public: 
 	cv::Mat graph;
 	cv::Mat graphMask;
+	cv::Rect drawnArea;   // the part of the layer with something in it
 	int fps = 25;
 	int frameWidth = 0;
 	int frameHeight = 0;
@@ -31,10 +37,16 @@ public:
 	
 	// Draw a graph on the frame based on the output	
 	void draw(cv::Mat& canvas);
+	void update();
+	void composite(cv::Mat& canvas);
 
 	void clearGraph();
 	void drawLegend();
-	void addChannel(std::string channelName, cv::Scalar color = CV_RGB(255, 0, 0), double offset = 0.0);
+	int addChannel(std::string channelName, cv::Scalar color = CV_RGB(255, 0, 0), double offset = 0.0);
+	int getChannel(std::string channelName);
+	void setValue(int channel, double value);
 	void setValue(std::string channelName, double value);
 
-};
\ No newline at end of file
+private:
+	void markDrawn(cv::Rect area);
+};
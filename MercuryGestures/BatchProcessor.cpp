@@ -0,0 +1,146 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "BatchProcessor.h"
+#include <fstream>
+#include <thread>
+
+BatchProcessor::BatchProcessor(int workers) {
+	this->workers = std::max(1, workers);
+}
+
+BatchProcessor::~BatchProcessor() {}
+
+/*
+* The manifest is a text file with one video path per line. Empty lines and lines starting with # are skipped.
+*/
+bool BatchProcessor::loadManifest(std::string manifestPath) {
+	return readList(manifestPath, this->videos);
+}
+
+/*
+* Parse the cascade xml once, all pipelines are set up from the cascade cache.
+*/
+bool BatchProcessor::loadCascade() {
+	return CascadeCache::instance().load(this->cascadeName);
+}
+
+/*
+* Get the output path for a video: the name of the video without extension in the output directory, with .csv or .mgr
+* for the binary files. The output directory has to exist.
+*/
+std::string BatchProcessor::getOutputPath(std::string videoPath) {
+	size_t slash = videoPath.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? videoPath : videoPath.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+	if (dot != std::string::npos && dot > 0)
+		name = name.substr(0, dot);
+	return this->outputDirectory + "/" + name + (this->binaryOutput ? ".mgr" : ".csv");
+}
+
+/*
+* Process all videos in the manifest with the worker pool. Blocks until all videos are done.
+*/
+BatchSummary BatchProcessor::run() {
+	BatchSummary summary;
+	summary.videos = this->videos.size();
+	if (this->loadCascade() == false) {
+		summary.failed = summary.videos;
+		return summary;
+	}
+
+	this->nextVideo = 0;
+	this->totalFrames = 0;
+	this->failedVideos = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<std::thread> pool;
+	int threadCount = std::min(this->workers, std::max(1, summary.videos));
+	for (int i = 0; i < threadCount; i++)
+		pool.push_back(std::thread(&BatchProcessor::work, this));
+	for (auto& thread : pool)
+		thread.join();
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	summary.failed = this->failedVideos;
+	summary.frames = this->totalFrames;
+	summary.seconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 1000.0;
+	summary.fps = summary.seconds > 0 ? summary.frames / summary.seconds : 0;
+	return summary;
+}
+
+/*
+* A worker takes the next video from the list until none are left.
+*/
+void BatchProcessor::work() {
+	for (;;) {
+		int index = this->nextVideo++;
+		if (index >= int(this->videos.size()))
+			return;
+		if (this->processVideo(this->videos[index]) == false)
+			this->failedVideos++;
+	}
+}
+
+bool BatchProcessor::processVideo(std::string videoPath) {
+	FrameSource source;
+	if (source.open(videoPath) == false) {
+		std::lock_guard<std::mutex> lock(this->logMutex);
+		std::cerr << "Cannot open the video file: " << videoPath << std::endl;
+		return false;
+	}
+
+	std::string outputPath = this->getOutputPath(videoPath);
+	std::ofstream output;
+	ResultFileWriter binaryOutput;
+	bool opened = this->binaryOutput ? binaryOutput.open(outputPath, source.getFps()) : (output.open(outputPath), output.is_open());
+	if (opened == false) {
+		std::lock_guard<std::mutex> lock(this->logMutex);
+		std::cerr << "Cannot write the results: " << outputPath << std::endl;
+		return false;
+	}
+
+	// every worker already uses a core, so the pipeline does not start threads of its own.
+	Pipeline pipeline(source.getFps(), true);
+	pipeline.concurrentDetectors = false;
+	pipeline.incremental = this->incremental;
+	pipeline.bodyRegionOnly = this->bodyRegionOnly;
+	pipeline.setOpenCL(this->useOpenCL);
+	pipeline.setMaxSubjects(this->maxSubjects);
+	pipeline.faceDetector.face_cascade_name = this->cascadeName;
+	pipeline.faceDetector.setFastDetection(this->fastFaceDetection);
+	pipeline.faceDetector.setAsynchronous(this->asynchronousFaceDetection);
+	if (pipeline.setup() == false)
+		return false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	int frames = 0;
+	bool written = true;
+	if (this->binaryOutput) {
+		frames = pipeline.run(source, [&binaryOutput, &pipeline, &written](PipelineResult& result) {
+			if (result.frameIndex == 0)
+				binaryOutput.setFrameSize(pipeline.frameWidth, pipeline.frameHeight);
+			written = binaryOutput.write(result) && written;
+		});
+		written = binaryOutput.close() && written;
+	}
+	else {
+		writeResultHeader(output);
+		frames = pipeline.run(source, [&output](PipelineResult& result) {
+			writeResult(output, result);
+		});
+		output.close();
+		written = output.good();
+	}
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	this->totalFrames += frames;
+
+	double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 1000.0;
+	std::lock_guard<std::mutex> lock(this->logMutex);
+	if (written == false) {
+		std::cerr << "Cannot write the results: " << outputPath << std::endl;
+		return false;
+	}
+	std::cerr << videoPath << ": " << frames << " frames in " << seconds << "s -> " << outputPath << std::endl;
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Pipeline.h"
+#include "ResultFile.h"
+#include <atomic>
+#include <mutex>
+
+/*
+* Totals of a batch run.
+*/
+struct BatchSummary {
+	int videos = 0;
+	int failed = 0;
+	long long frames = 0;
+	double seconds = 0;
+	double fps = 0;         // aggregate processed frames per second over all workers
+};
+
+/*
+* Process a list of videos offline. Every worker thread runs its own pipeline (and so its own set of detectors) on
+* one video at a time. The per frame results of a video are written to the output directory, named after the video,
+* as csv or in the binary result file format (see ResultFile.h) with binaryOutput. The cascade xml is parsed once and
+* all pipelines are set up from that, see CascadeCache.
+*/
+class BatchProcessor {
+public:
+	std::vector<std::string> videos;
+	std::string outputDirectory = ".";
+	std::string cascadeName = "./dependencies/haarcascade_frontalface_alt.xml";
+	int workers = 4;
+	bool binaryOutput = false;
+	bool incremental = false;   // see Pipeline::incremental
+	bool bodyRegionOnly = false; // see Pipeline::bodyRegionOnly
+	bool useOpenCL = false;      // see Pipeline::setOpenCL
+	int maxSubjects = 1;         // see Pipeline::setMaxSubjects
+	bool fastFaceDetection = false; // see FaceDetector::setFastDetection
+	bool asynchronousFaceDetection = false; // see FaceDetector::setAsynchronous
+
+	BatchProcessor(int workers = 4);
+	~BatchProcessor();
+
+	bool loadManifest(std::string manifestPath);
+	bool loadCascade();
+	BatchSummary run();
+
+	std::string getOutputPath(std::string videoPath);
+
+private:
+	std::mutex logMutex;
+	std::atomic<int> nextVideo;
+	std::atomic<long long> totalFrames;
+	std::atomic<int> failedVideos;
+
+	void work();
+	bool processVideo(std::string videoPath);
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/*
+* A blocking FIFO queue with a maximum size, used to hand frames from one pipeline stage to the next.
+* push blocks while the queue is full, pop blocks while it is empty. After close() push fails and pop
+* drains the remaining items before failing.
+*/
+template <typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity) {
+		this->capacity = capacity > 0 ? capacity : 1;
+	}
+
+	bool push(T&& item) {
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->notFull.wait(lock, [this] { return this->closed || this->items.size() < this->capacity; });
+		if (this->closed)
+			return false;
+		this->items.push_back(std::move(item));
+		this->notEmpty.notify_one();
+		return true;
+	}
+
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->notEmpty.wait(lock, [this] { return this->closed || this->items.empty() == false; });
+		if (this->items.empty())
+			return false;
+		item = std::move(this->items.front());
+		this->items.pop_front();
+		this->notFull.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->closed = true;
+		this->notFull.notify_all();
+		this->notEmpty.notify_all();
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->items.size();
+	}
+
+private:
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	size_t capacity;
+	bool closed = false;
+};
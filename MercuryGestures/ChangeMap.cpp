@@ -0,0 +1,106 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "ChangeMap.h"
+
+ChangeMap::ChangeMap() {}
+ChangeMap::~ChangeMap() {}
+
+/*
+* Start over for frames of this size, everything is dirty until it is processed.
+*/
+void ChangeMap::reset(cv::Size frameSize) {
+	this->frameSize = frameSize;
+	this->columns = (frameSize.width + this->tileSize - 1) / this->tileSize;
+	this->rows = (frameSize.height + this->tileSize - 1) / this->tileSize;
+	this->changed.assign(this->columns * this->rows, 0);
+	this->dirty.assign(this->columns * this->rows, 1);
+	this->dirtyCount = this->columns * this->rows;
+	this->dirtyRects.clear();
+	this->dirtyRects.push_back(cv::Rect(cv::Point(0, 0), frameSize));
+	this->framesSinceRefresh = 0;
+	this->refreshDue = true;
+}
+
+/*
+* Add the changed pixels of this frame and find the dirty tiles.
+*/
+void ChangeMap::update(cv::Mat& movementMap) {
+	if (movementMap.size() != this->frameSize)
+		this->reset(movementMap.size());
+
+	this->framesSinceRefresh++;
+	if (this->framesSinceRefresh >= this->refreshInterval)
+		this->refreshDue = true;
+
+	this->dirtyCount = 0;
+	this->dirtyRects.clear();
+	for (int row = 0; row < this->rows; row++) {
+		cv::Rect run;
+		for (int column = 0; column < this->columns; column++) {
+			int index = row * this->columns + column;
+			cv::Rect tile = this->getTile(column, row);
+			this->changed[index] += cv::countNonZero(movementMap(tile));
+			this->dirty[index] = this->refreshDue || this->changed[index] > this->tileThreshold;
+			if (this->dirty[index] == 0)
+				continue;
+
+			this->dirtyCount++;
+			if (run.area() > 0 && run.x + run.width == tile.x)
+				run.width += tile.width;
+			else {
+				if (run.area() > 0)
+					this->dirtyRects.push_back(run);
+				run = tile;
+			}
+		}
+		if (run.area() > 0)
+			this->dirtyRects.push_back(run);
+	}
+}
+
+/*
+* The detectors have processed the dirty tiles (or the whole frame), their changes are accounted for.
+*/
+void ChangeMap::markProcessed(bool everything) {
+	for (int i = 0; i < this->changed.size(); i++) {
+		if (everything || this->dirty[i]) {
+			this->changed[i] = 0;
+			this->dirty[i] = 0;
+		}
+	}
+	if (everything || this->refreshDue) {
+		this->framesSinceRefresh = 0;
+		this->refreshDue = false;
+	}
+	this->dirtyCount = 0;
+	this->dirtyRects.clear();
+}
+
+/*
+* Nothing changed enough, the results of the last processed frame can be used.
+*/
+bool ChangeMap::isIdle() {
+	return this->dirtyCount == 0;
+}
+
+/*
+* Only a small part changed, it is cheaper to process just the dirty tiles.
+*/
+bool ChangeMap::isPartial() {
+	return this->dirtyCount > 0 && this->getDirtyFraction() <= this->maxPartialFraction;
+}
+
+double ChangeMap::getDirtyFraction() {
+	int tiles = this->columns * this->rows;
+	return tiles > 0 ? double(this->dirtyCount) / tiles : 1.0;
+}
+
+int ChangeMap::getDirtyTileCount() {
+	return this->dirtyCount;
+}
+
+cv::Rect ChangeMap::getTile(int column, int row) {
+	cv::Rect tile(column * this->tileSize, row * this->tileSize, this->tileSize, this->tileSize);
+	return tile & cv::Rect(cv::Point(0, 0), this->frameSize);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* Keeps track of which tiles of the frame changed since the detectors last processed them. The changed pixels come from
+* the movement map (the thresholded difference with the previous frame) so nothing extra is computed per pixel.
+* A tile is dirty when enough pixels changed in it since it was processed. Every refreshInterval frames all tiles are
+* dirty, this catches changes that are too slow to show up in the movement map.
+*/
+class ChangeMap {
+public:
+	int tileSize = 32;
+	int tileThreshold = 20;            // changed pixels since the tile was processed before it is dirty
+	int refreshInterval = 50;          // frames
+	double maxPartialFraction = 0.5;   // above this part of dirty tiles the whole frame is processed
+	std::vector<cv::Rect> dirtyRects;  // the dirty tiles, neighbours in a row are merged
+
+	ChangeMap();
+	~ChangeMap();
+
+	void reset(cv::Size frameSize);
+	void update(cv::Mat& movementMap);
+	void markProcessed(bool everything);
+	bool isIdle();
+	bool isPartial();
+	double getDirtyFraction();
+	int getDirtyTileCount();
+
+private:
+	cv::Size frameSize;
+	int columns = 0;
+	int rows = 0;
+	std::vector<int> changed;      // changed pixels per tile since it was processed
+	std::vector<uchar> dirty;
+	int dirtyCount = 0;
+	int framesSinceRefresh = 0;
+	bool refreshDue = true;
+
+	cv::Rect getTile(int column, int row);
+};
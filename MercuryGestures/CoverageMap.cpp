@@ -0,0 +1,101 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "CoverageMap.h"
+
+CoverageMap::CoverageMap() {}
+CoverageMap::~CoverageMap() {}
+
+/*
+* Build the row wise prefix sums for this mask. Any nonzero pixel counts as covered.
+*/
+void CoverageMap::build(cv::Mat& mask) {
+	this->mask = mask;
+	this->rowSums.create(mask.rows, mask.cols + 1, CV_32S);
+
+	for (int y = 0; y < mask.rows; y++) {
+		const uchar* maskRow = mask.ptr<uchar>(y);
+		int* sumRow = this->rowSums.ptr<int>(y);
+		int sum = 0;
+		sumRow[0] = 0;
+		for (int x = 0; x < mask.cols; x++) {
+			sum += maskRow[x] != 0;
+			sumRow[x + 1] = sum;
+		}
+	}
+}
+
+/*
+* Count the covered pixels in a filled circle. Only the pixels inside of the clip rect are counted, this is the equivalent
+* of drawing the circle in a search space. With a row step the rows are sampled symmetrically around the center and each
+* sample counts for rowStep rows.
+*/
+int CoverageMap::count(cv::Point& center, int radius, cv::Rect& clip, int rowStep) {
+	if (radius <= 0) {
+		return 0;
+	}
+
+	cv::Rect bounds = clip & cv::Rect(0, 0, this->mask.cols, this->mask.rows);
+	int minX = bounds.x;
+	int maxX = bounds.x + bounds.width - 1;
+	int minY = std::max(bounds.y, center.y - radius);
+	int maxY = std::min(bounds.y + bounds.height - 1, center.y + radius);
+	if (rowStep > 1) {
+		int firstRow = center.y - radius / rowStep * rowStep;
+		if (minY > firstRow)
+			firstRow += (minY - firstRow + rowStep - 1) / rowStep * rowStep;
+		minY = firstRow;
+	}
+	rowStep = std::max(1, rowStep);
+
+	std::vector<int>& halfWidths = this->getSpans(radius);
+	int total = 0;
+	for (int y = minY; y <= maxY; y += rowStep) {
+		int halfWidth = halfWidths[y - center.y + radius];
+		int x0 = std::max(minX, center.x - halfWidth);
+		int x1 = std::min(maxX, center.x + halfWidth);
+		if (x0 <= x1) {
+			const int* sumRow = this->rowSums.ptr<int>(y);
+			total += sumRow[x1 + 1] - sumRow[x0];
+		}
+	}
+	return total * rowStep;
+}
+
+/*
+* Returns value between 0 .. 1 (more or less). We keep the weighting of the original mask based implementation, there the
+* circle was drawn with value 155 and AND-ed with the 255 mask. The thresholds in the hand tracking are tuned on that.
+*/
+double CoverageMap::getCoverage(cv::Point& center, int radius, cv::Rect& clip, int rowStep) {
+	if (radius <= 0) {
+		return 0;
+	}
+	return this->count(center, radius, clip, rowStep) * 155.0 / (radius*radius*3.1415 * 255.0);
+}
+
+double CoverageMap::getCoverage(cv::Point& center, int radius) {
+	cv::Rect clip(0, 0, this->mask.cols, this->mask.rows);
+	return this->getCoverage(center, radius, clip);
+}
+
+
+//***************************************** PRIVATE  **********************************************//
+
+
+/*
+* Get the half width of the circle for every row offset. These are cached per radius since only a handful of radii are used.
+*/
+std::vector<int>& CoverageMap::getSpans(int radius) {
+	if (radius >= this->spans.size()) {
+		this->spans.resize(radius + 1);
+	}
+
+	std::vector<int>& halfWidths = this->spans[radius];
+	if (halfWidths.size() == 0) {
+		halfWidths.resize(2 * radius + 1);
+		for (int dy = -radius; dy <= radius; dy++) {
+			halfWidths[dy + radius] = int(std::sqrt(double(radius * radius - dy * dy)));
+		}
+	}
+	return halfWidths;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* The coverage map answers "how much of this circle is filled" queries on a binary mask. It is built once per mask per frame
+* and shared by both hands. Every row gets a prefix sum of the nonzero pixels so a circle can be counted span by span: a query
+* costs O(radius) and does not allocate. With a row step only every so many rows of the circle are counted, a cheaper
+* estimate for coarse searches.
+*/
+class CoverageMap {
+public:
+	cv::Mat mask;     // header of the mask this map was built from. Used for the search spaces, no copy is made.
+	cv::Mat rowSums;  // CV_32S, rows x (cols + 1). rowSums(y, x) is the amount of nonzero pixels in row y before column x.
+
+	CoverageMap();
+	~CoverageMap();
+
+	void build(cv::Mat& mask);
+	int count(cv::Point& center, int radius, cv::Rect& clip, int rowStep = 1);
+	double getCoverage(cv::Point& center, int radius, cv::Rect& clip, int rowStep = 1);
+	double getCoverage(cv::Point& center, int radius);
+
+private:
+	// half widths of the circle per row offset, one entry of 2 * radius + 1 values for each radius that has been used.
+	std::vector<std::vector<int>> spans;
+	std::vector<int>& getSpans(int radius);
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "CoverageSearch.h"
+#include <algorithm>
+
+/*
+* The search patterns by search mode. The left and right are those of the person, so SEARCH_RIGHT searches towards the
+* left of the screen.
+*/
+static const SearchPattern searchPatterns[] = {
+	// FREE_SEARCH
+	// x x x
+	// x o x
+	// x x x
+	{ 8, { { 1, 1 }, { 1, -1 }, { 1, 0 }, { -1, 1 }, { -1, -1 }, { -1, 0 }, { 0, 1 }, { 0, -1 } }, { 0, 0 }, false },
+	// SEARCH_DOWN
+	// . . .
+	// x o x
+	// x x x
+	{ 5, { { -1, 0 }, { 1, 0 }, { 1, 1 }, { -1, 1 }, { 0, 1 } }, { 0, 1 }, false },
+	// SEARCH_STRICT_LEFT
+	// . . .
+	// . o x
+	// . . .
+	{ 1, { { 1, 0 } }, { 1, 0 }, true },
+	// SEARCH_LEFT
+	// . x x
+	// . o x
+	// . x x
+	{ 5, { { 0, 1 }, { 0, -1 }, { 1, 1 }, { 1, -1 }, { 1, 0 } }, { 1, 0 }, false },
+	// SEARCH_STRICT_RIGHT
+	// . . .
+	// x o .
+	// . . .
+	{ 1, { { -1, 0 } }, { -1, 0 }, true },
+	// SEARCH_RIGHT
+	// x x .
+	// x o .
+	// x x .
+	{ 5, { { 0, 1 }, { 0, -1 }, { -1, 1 }, { -1, -1 }, { -1, 0 } }, { -1, 0 }, false },
+	// SEARCH_UP
+	// x x x
+	// x o x
+	// . . .
+	{ 5, { { -1, 0 }, { 1, 0 }, { 1, -1 }, { -1, -1 }, { 0, -1 } }, { 0, -1 }, false },
+};
+
+const SearchPattern& getSearchPattern(SearchMode searchMode) {
+	return searchPatterns[searchMode];
+}
+
+CoverageSearch::CoverageSearch() {}
+CoverageSearch::~CoverageSearch() {}
+
+/*
+* Search from the start, in frame coordinates. The radius is in pixels. Returns the best position in frame
+* coordinates. The iterations are shared by all levels, the last level always gets at least one.
+*/
+cv::Point CoverageSearch::search(cv::Point start, CoverageMap& coverage, SearchSpace& space, int maxIterations, int stepSize, int radius, SearchMode searchMode) {
+	const SearchPattern& pattern = getSearchPattern(searchMode);
+	this->path.clear();
+	this->iterations = 0;
+	this->queries = 0;
+
+	this->visited.clear();
+
+	// only use the levels that still fit the circle: a coarse step should not jump over it
+	int levels = 1;
+	while (levels < this->maxLevels && (stepSize << levels) <= radius / 2)
+		levels++;
+
+	cv::Point position = start;
+	this->setVisited(position, space);
+	for (int level = levels - 1; level >= 0; level--) {
+		int step = stepSize << level;
+		int rowStep = 1 << level;
+		bool finest = level == 0;
+
+		// the coverage is compared on the samples of this level
+		this->queries++;
+		double value = coverage.getCoverage(position, radius, space.area, rowStep);
+
+		int levelIterations = 0;
+		while (this->iterations < maxIterations || (finest && levelIterations == 0)) {
+			int count = 0;
+			for (int i = 0; i < pattern.count; i++) {
+				cv::Point candidate = position + pattern.steps[i] * step;
+				if (this->isVisited(candidate, space) == false)
+					this->candidates[count++] = candidate;
+			}
+			if (count == 0)
+				break;
+
+			for (int i = 0; i < count; i++)
+				this->values[i] = coverage.getCoverage(this->candidates[i], radius, space.area, rowStep);
+			this->queries += count;
+
+			int best = 0;
+			for (int i = 1; i < count; i++) {
+				if (this->values[best] < this->values[i])
+					best = i;
+			}
+			if (this->values[best] < value || (finest == false && this->values[best] == value))
+				break;
+
+			value = this->values[best];
+			position = this->candidates[best];
+			this->setVisited(position, space);
+			this->path.push_back(position);
+			this->iterations++;
+			levelIterations++;
+		}
+	}
+	return position;
+}
+
+
+//***************************************** PRIVATE  **********************************************//
+
+
+/*
+* Positions outside of the search space count as visited, the search never leaves it.
+*/
+bool CoverageSearch::isVisited(cv::Point& position, SearchSpace& space) {
+	if (space.area.contains(position) == false)
+		return true;
+	return std::find(this->visited.begin(), this->visited.end(), position) != this->visited.end();
+}
+
+void CoverageSearch::setVisited(cv::Point& position, SearchSpace& space) {
+	if (space.area.contains(position))
+		this->visited.push_back(position);
+}
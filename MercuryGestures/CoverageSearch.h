@@ -0,0 +1,57 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "CoverageMap.h"
+
+enum SearchMode {
+	FREE_SEARCH, 
+	SEARCH_DOWN, 
+	SEARCH_STRICT_LEFT, 
+	SEARCH_LEFT, 
+	SEARCH_STRICT_RIGHT,
+	SEARCH_RIGHT,
+	SEARCH_UP   
+};
+
+/*
+* The steps a search may take in a search mode, in units of the step size, and the direction it is pointed at. The
+* order of the steps decides between candidates with the same coverage.
+*/
+struct SearchPattern {
+	int count;
+	cv::Point steps[8];
+	cv::Point heading;  // (0, 0) for the free search
+	bool strict;        // only the heading itself is searched
+};
+
+const SearchPattern& getSearchPattern(SearchMode searchMode);
+
+/*
+* Walks a circle towards the most covered position in a search space. The walk is coarse to fine: it starts with steps
+* and radius samples a few times larger than the step size and halves them until the step size is reached. The coarse
+* levels only move on a real improvement, the last level also walks over plateaus like the single step search did.
+* The positions the search moved to are not evaluated again. There are at most maxIterations of them, so they are
+* kept in a short list instead of a map over the search space.
+*
+* The scratch buffers are kept, use one instance per hand.
+*/
+class CoverageSearch {
+public:
+	int maxLevels = 3;            // the amount of step sizes, the coarsest is stepSize << (maxLevels - 1)
+	std::vector<cv::Point> path;  // the positions the last search moved to, in frame coordinates
+	int iterations = 0;           // the steps taken by the last search
+	int queries = 0;              // the coverage queries of the last search
+
+	CoverageSearch();
+	~CoverageSearch();
+
+	cv::Point search(cv::Point start, CoverageMap& coverage, SearchSpace& space, int maxIterations, int stepSize, int radius, SearchMode searchMode);
+
+private:
+	std::vector<cv::Point> visited;  // the start and the path of the current search
+	cv::Point candidates[8];
+	double values[8];
+
+	bool isVisited(cv::Point& position, SearchSpace& space);
+	void setVisited(cv::Point& position, SearchSpace& space);
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "DebugSink.h"
+
+CanvasDebugSink::CanvasDebugSink() {}
+CanvasDebugSink::~CanvasDebugSink() {}
+
+void CanvasDebugSink::setActive(bool active) {
+	this->active = active;
+}
+
+bool CanvasDebugSink::isActive() {
+	return this->active;
+}
+
+/*
+* Start a new frame, the mask is copied to the rgb canvas.
+*/
+void CanvasDebugSink::begin(cv::Mat& mask) {
+	if (this->active == false) {
+		this->canvas.release();
+		return;
+	}
+	cv::cvtColor(mask, this->canvas, CV_GRAY2RGB);
+}
+
+void CanvasDebugSink::circle(cv::Point center, int radius, cv::Scalar color, int thickness) {
+	if (this->active && this->canvas.cols != 0)
+		cv::circle(this->canvas, center, radius, color, thickness);
+}
+
+void CanvasDebugSink::line(cv::Point p1, cv::Point p2, cv::Scalar color, int thickness) {
+	if (this->active && this->canvas.cols != 0)
+		cv::line(this->canvas, p1, p2, color, thickness);
+}
+
+/*
+* Draw a square around a point.
+*/
+void CanvasDebugSink::rect(cv::Point center, int radius, cv::Scalar color, int thickness) {
+	if (this->active && this->canvas.cols != 0)
+		cv::rectangle(this->canvas, cv::Rect(center.x - radius, center.y - radius, 2 * radius, 2 * radius), color, thickness);
+}
+
+void CanvasDebugSink::text(const char* label, cv::Point position, double scale, cv::Scalar color, int thickness) {
+	if (this->active && this->canvas.cols != 0)
+		cv::putText(this->canvas, label, position, 0, scale, color, thickness);
+}
+
+void CanvasDebugSink::text(const char* label, int value, cv::Point position, double scale, cv::Scalar color, int thickness) {
+	if (this->active && this->canvas.cols != 0)
+		cv::putText(this->canvas, joinString(label, value), position, 0, scale, color, thickness);
+}
+
+void CanvasDebugSink::contour(std::vector<std::vector<cv::Point>>& contours, int index, cv::Scalar color, int thickness) {
+	if (this->active && this->canvas.cols != 0)
+		cv::drawContours(this->canvas, contours, index, color, thickness, 8);
+}
+
+void CanvasDebugSink::show(std::string windowName) {
+	if (this->active && this->canvas.cols != 0)
+		cv::imshow(windowName, this->canvas);
+}
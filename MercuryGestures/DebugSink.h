@@ -0,0 +1,51 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* The hand tracking draws its debug information through a sink. Which sink is used is decided at compile time:
+* - CanvasDebugSink draws on an rgb copy of the skin mask. It is used when DEBUG is defined.
+* - NullDebugSink does nothing. All its methods are empty inlines so the calls compile to nothing in release builds.
+* Text is given as a label and an optional value so no strings have to be built for the null sink.
+*/
+class CanvasDebugSink {
+public:
+	cv::Mat canvas;
+	bool active = true; // runtime switch, headless pipelines turn this off
+
+	CanvasDebugSink();
+	~CanvasDebugSink();
+
+	void setActive(bool active);
+	bool isActive();
+	void begin(cv::Mat& mask);
+	void circle(cv::Point center, int radius, cv::Scalar color, int thickness = 1);
+	void line(cv::Point p1, cv::Point p2, cv::Scalar color, int thickness = 1);
+	void rect(cv::Point center, int radius, cv::Scalar color, int thickness = 1);
+	void text(const char* label, cv::Point position, double scale, cv::Scalar color, int thickness = 1);
+	void text(const char* label, int value, cv::Point position, double scale, cv::Scalar color, int thickness = 1);
+	void contour(std::vector<std::vector<cv::Point>>& contours, int index, cv::Scalar color, int thickness = 1);
+	void show(std::string windowName);
+};
+
+class NullDebugSink {
+public:
+	cv::Mat canvas;
+
+	inline void setActive(bool active) {}
+	inline bool isActive() { return false; }
+	inline void begin(cv::Mat& mask) {}
+	inline void circle(cv::Point center, int radius, cv::Scalar color, int thickness = 1) {}
+	inline void line(cv::Point p1, cv::Point p2, cv::Scalar color, int thickness = 1) {}
+	inline void rect(cv::Point center, int radius, cv::Scalar color, int thickness = 1) {}
+	inline void text(const char* label, cv::Point position, double scale, cv::Scalar color, int thickness = 1) {}
+	inline void text(const char* label, int value, cv::Point position, double scale, cv::Scalar color, int thickness = 1) {}
+	inline void contour(std::vector<std::vector<cv::Point>>& contours, int index, cv::Scalar color, int thickness = 1) {}
+	inline void show(std::string windowName) {}
+};
+
+#ifdef DEBUG
+typedef CanvasDebugSink DebugSink;
+#else
+typedef NullDebugSink DebugSink;
+#endif
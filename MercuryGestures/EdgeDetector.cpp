@@ -1,11 +1,26 @@
 #pragma once
 
 #include "EdgeDetector.h"
+#include "Profiler.h"
 
 EdgeDetector::EdgeDetector() {}
 EdgeDetector::~EdgeDetector() {}
 
-void EdgeDetector::detect(cv::Mat frame) {
+/*
+* With an area only that part of the frame is processed, the rest of the edges is 0.
+*/
+void EdgeDetector::detect(cv::Mat frame, cv::Rect area) {
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	if (area.area() != 0 && area != frameRect) {
+		PROFILE_SCOPE(PROFILE_EDGES);
+		area &= frameRect;
+		this->detectedEdges.create(frame.rows, frame.cols, CV_8U);
+		this->detectRegion(frame, area);
+		clearOutside(this->detectedEdges, area);
+		return;
+	}
+
+	PROFILE_SCOPE(PROFILE_EDGES);
 	// Reduce noise with a kernel 3x3
 	cv::blur(frame, this->blur, cv::Size(3, 3));
 
@@ -20,6 +35,56 @@ void EdgeDetector::detect(cv::Mat frame) {
 	cv::Canny(this->blur, this->detectedEdges, lowThreshold, lowThreshold*ratio, kernel_size);
 }
 
+/*
+* Find the edges on the OpenCL device and download them. Like detectRegion an area is processed with a margin.
+*/
+void EdgeDetector::detect(cv::UMat& frame, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_EDGES);
+	int lowThreshold = 20;
+	int ratio = 3;
+	int kernel_size = 3;
+	const int margin = 4;
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	area = area.area() == 0 ? frameRect : area & frameRect;
+	cv::Rect padded = (area - cv::Point(margin, margin) + cv::Size(2 * margin, 2 * margin)) & frameRect;
+	cv::blur(frame(padded), this->deviceBlur, cv::Size(3, 3));
+	cv::Canny(this->deviceBlur, this->deviceEdges, lowThreshold, lowThreshold*ratio, kernel_size);
+
+	this->detectedEdges.create(frame.rows, frame.cols, CV_8U);
+	cv::Mat target = this->detectedEdges(area);
+	this->deviceEdges(area - padded.tl()).copyTo(target);
+	if (area != frameRect)
+		clearOutside(this->detectedEdges, area);
+}
+
+/*
+* Only redo the edges in the regions, the rest of detectedEdges is kept. Every region is processed with a margin so the
+* blur and the gradients see the same neighbourhood as in the full frame. Only the hysteresis can differ at the borders
+* of a region, as edges are not followed across them.
+*/
+void EdgeDetector::detectRegions(cv::Mat frame, std::vector<cv::Rect>& regions) {
+	if (this->detectedEdges.size() != frame.size()) {
+		this->detect(frame);
+		return;
+	}
+
+	PROFILE_SCOPE(PROFILE_EDGES);
+	for (auto& region : regions)
+		this->detectRegion(frame, region);
+}
+
+void EdgeDetector::detectRegion(cv::Mat& frame, cv::Rect& region) {
+	int lowThreshold = 20;
+	int ratio = 3;
+	int kernel_size = 3;
+	const int margin = 4;
+	cv::Rect padded = (region - cv::Point(margin, margin) + cv::Size(2 * margin, 2 * margin)) & cv::Rect(cv::Point(0, 0), frame.size());
+	cv::blur(frame(padded), this->regionBlur, cv::Size(3, 3));
+	cv::Canny(this->regionBlur, this->regionEdges, lowThreshold, lowThreshold*ratio, kernel_size);
+	cv::Mat target = this->detectedEdges(region);
+	this->regionEdges(region - padded.tl()).copyTo(target);
+}
+
 void EdgeDetector::show(std::string windowName) {
 	cv::imshow(windowName, this->detectedEdges);
 }
@@ -5,11 +5,20 @@ class EdgeDetector {
 public:
 	cv::Mat detectedEdges;
 	cv::Mat blur;
+	cv::Mat regionBlur;  // scratch for detectRegions
+	cv::Mat regionEdges;
+	cv::UMat deviceBlur;  // see detect on the device
+	cv::UMat deviceEdges;
 
 	EdgeDetector();
 	~EdgeDetector();
 
-	void detect(cv::Mat frame);
+	void detect(cv::Mat frame, cv::Rect area = cv::Rect());
+	void detect(cv::UMat& frame, cv::Rect area = cv::Rect());
+	void detectRegions(cv::Mat frame, std::vector<cv::Rect>& regions);
 	void show(std::string windowName = "edges");
 	cv::Mat getEdges();
+
+private:
+	void detectRegion(cv::Mat& frame, cv::Rect& region);
 };
\ No newline at end of file
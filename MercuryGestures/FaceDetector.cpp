@@ -2,23 +2,96 @@
 
 #include "MercuryCore.h"
 #include "FaceDetector.h"
+#include "Profiler.h"
 
 FaceDetector::FaceDetector() {
 	this->reset();
 }
-FaceDetector::~FaceDetector() {}
+FaceDetector::~FaceDetector() {
+	this->worker.stop();
+}
 
 /**
  * Setting up the cascade classifier(s).
  */
 bool FaceDetector::setup() {
-	if (!this->face_cascade.load(this->face_cascade_name)) {
-		std::cerr << "--(!)Error loading face cascade" << std::endl;
-		return false; 
-	};
+	return CascadeCache::instance().setup(this->face_cascade_name, this->face_cascade);
+}
+
+/*
+* Parse a cascade xml so it can be shared between detectors, see CascadeCache. The haarcascade files shipped
+* with OpenCV are in the old format, which can only be read from a file by CascadeClassifier::load. In that case we
+* convert it to the new format first.
+*/
+bool loadCascadeStorage(std::string cascadeName, cv::FileStorage& storage) {
+	cv::CascadeClassifier probe;
+	if (storage.open(cascadeName, cv::FileStorage::READ) &&
+		probe.read(storage.getFirstTopLevelNode())) {
+		return true;
+	}
+	storage.release();
+
+	std::string converted = cv::tempfile(".xml");
+	if (cv::CascadeClassifier::convert(cascadeName, converted) &&
+		storage.open(converted, cv::FileStorage::READ)) {
+		std::remove(converted.c_str());
+		return true;
+	}
+	std::remove(converted.c_str());
+	std::cerr << "--(!)Error loading face cascade" << std::endl;
+	return false;
+}
+
+CascadeCache& CascadeCache::instance() {
+	static CascadeCache cache;
+	return cache;
+}
+
+/*
+* Parse the cascade if it is not in the cache yet, to move the cost out of the first frame.
+*/
+bool CascadeCache::load(std::string cascadeName) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->find(cascadeName) != nullptr;
+}
+
+/*
+* Read the cascade into the classifier, parsing the xml on first use. The FileStorage is only touched under the lock.
+*/
+bool CascadeCache::setup(std::string cascadeName, cv::CascadeClassifier& classifier) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	cv::FileStorage* storage = this->find(cascadeName);
+	if (storage == nullptr)
+		return false;
+	if (!classifier.read(storage->getFirstTopLevelNode())) {
+		std::cerr << "--(!)Error reading face cascade" << std::endl;
+		return false;
+	}
 	return true;
 }
 
+void CascadeCache::clear() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->storages.clear();
+}
+
+/*
+* The parsed cascade, loading it if needed. Null if it cannot be loaded, that is not cached so a later call can retry.
+* The lock has to be held.
+*/
+cv::FileStorage* CascadeCache::find(std::string& cascadeName) {
+	auto found = this->storages.find(cascadeName);
+	if (found != this->storages.end())
+		return found->second.get();
+
+	std::unique_ptr<cv::FileStorage> storage(new cv::FileStorage());
+	if (loadCascadeStorage(cascadeName, *storage) == false)
+		return nullptr;
+	cv::FileStorage* loaded = storage.get();
+	this->storages[cascadeName] = std::move(storage);
+	return loaded;
+}
+
 void FaceDetector::updateScale() {
 	double pixelSizeInCmTemp = averageFaceHeight / this->face.rect.height;
 
@@ -32,6 +105,23 @@ void FaceDetector::updateScale() {
 	}
 }
 
+/*
+* The part of the frame the hands can be in: the body model of getBodyRect, widened to bodyReach on both sides of the
+* face, from half a face above the face (hands to the face) down to the bottom of the frame.
+*/
+cv::Rect FaceDetector::getBodyRegion() {
+	BodyRects body;
+	getBodyRect(this->face.rect, body);
+	cv::Rect region = body.face | body.upperTorso | body.lowerTorso | body.lap |
+		body.armLeftUpper | body.armLeftLower | body.armRightUpper | body.armRightLower;
+
+	int centerX = this->face.rect.x + 0.5 * this->face.rect.width;
+	int reach = this->bodyReach / this->pixelSizeInCm;
+	int top = this->face.rect.y - 0.5 * this->face.rect.height;
+	region |= cv::Rect(centerX - reach, top, 2 * reach, this->frameHeight - top);
+	return region & cv::Rect(0, 0, this->frameWidth, this->frameHeight);
+}
+
 /*
 This will be done after the calculation is complete. It will draw a rectangle a bit larger than the face on the canvas
 */
@@ -52,11 +142,9 @@ void FaceDetector::draw(cv::Mat& canvas) {
 * user body parts. This can be used to make a mask to sample only important parts of the image for movement. It can also
 * be used to ignore the head movement or upper torso.
 */
-bool FaceDetector::detectFace(cv::Mat& grayscaleImage, FaceData & data) {
+bool FaceDetector::detectFace(cv::Mat& grayscaleImage, FaceData & data, CascadeSettings& settings, int expectedHeight) {
 	std::vector<cv::Rect> faces;
-	int minFaceSize = 0.2 * this->frameHeight;
-	this->face_cascade.detectMultiScale(grayscaleImage, faces, 1.1, 1, 0 | cv::CASCADE_SCALE_IMAGE, cv::Size(minFaceSize, minFaceSize));
-	data.count = faces.size();
+	data.count = this->detectFaces(grayscaleImage, faces, settings, expectedHeight);
 	if (faces.size() > 0) {
 		data.rect = faces[0];
 		return true;
@@ -66,34 +154,175 @@ bool FaceDetector::detectFace(cv::Mat& grayscaleImage, FaceData & data) {
 
 
 /*
- * Detect a face in a grayscale image.
- */
-bool FaceDetector::detect(cv::Mat& gray) {
-	auto start = std::chrono::high_resolution_clock::now();
-	// face detection for normalization
-	FaceData newFaces;
-	float movementThreshold = this->faceAreaThresholdFactor * this->frameWidth;
+* All faces in the image, for the multi subject mode. Returns the amount found. If the height of the face is known
+* (expectedHeight, 0 if not) only the scales around it are tried, see lockedScale.
+*
+* The cascade runs on a copy resized by detectionScale, the rects are mapped back to the image.
+*/
+int FaceDetector::detectFaces(cv::Mat& grayscaleImage, std::vector<cv::Rect>& faces, int expectedHeight) {
+	CascadeSettings settings = this->getCascadeSettings();
+	return this->detectFaces(grayscaleImage, faces, settings, expectedHeight);
+}
+
+/*
+* The same with the given settings instead of those of the detector, see FaceDetectionWorker.
+*/
+int FaceDetector::detectFaces(cv::Mat& grayscaleImage, std::vector<cv::Rect>& faces, CascadeSettings& settings, int expectedHeight) {
+	int minFaceSize = 0.2 * settings.frameHeight;
+	int maxFaceSize = 0; // no limit
+	double scale = settings.detectionScale;
+	if (expectedHeight > 0) {
+		minFaceSize = expectedHeight / settings.lockedScaleRange;
+		maxFaceSize = expectedHeight * settings.lockedScaleRange;
+		scale = settings.lockedFaceHeight / double(expectedHeight);
+	}
+	// the smallest face has to stay large enough for the cascade to find it
+	cv::Size window = this->face_cascade.getOriginalWindowSize();
+	if (window.height > 0 && minFaceSize > 0)
+		scale = std::max(scale, settings.minimumFaceWindow * window.height / double(minFaceSize));
+	scale = std::min(scale, 1.0);
+
+	if (scale == 1) {
+		this->face_cascade.detectMultiScale(grayscaleImage, faces, 1.1, 1, 0 | cv::CASCADE_SCALE_IMAGE,
+			cv::Size(minFaceSize, minFaceSize), cv::Size(maxFaceSize, maxFaceSize));
+		return faces.size();
+	}
+
+	// the copy is a part of a buffer that only grows, resize does not reallocate a destination of its size
+	cv::Size scaledSize(cv::saturate_cast<int>(grayscaleImage.cols * scale), cv::saturate_cast<int>(grayscaleImage.rows * scale));
+	if (this->scaledBuffer.cols < scaledSize.width || this->scaledBuffer.rows < scaledSize.height)
+		this->scaledBuffer.create(std::max(this->scaledBuffer.rows, scaledSize.height), std::max(this->scaledBuffer.cols, scaledSize.width), CV_8U);
+	cv::Mat scaled = this->scaledBuffer(cv::Rect(cv::Point(0, 0), scaledSize));
+	cv::resize(grayscaleImage, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+	int minScaled = std::floor(minFaceSize * scale);
+	int maxScaled = std::ceil(maxFaceSize * scale);
+	this->face_cascade.detectMultiScale(scaled, faces, 1.1, 1, 0 | cv::CASCADE_SCALE_IMAGE,
+		cv::Size(minScaled, minScaled), cv::Size(maxScaled, maxScaled));
+	for (cv::Rect& face : faces) {
+		cv::Point topLeft(std::round(face.x / scale), std::round(face.y / scale));
+		cv::Point bottomRight(std::round(face.br().x / scale), std::round(face.br().y / scale));
+		face = cv::Rect(topLeft, bottomRight) & cv::Rect(0, 0, grayscaleImage.cols, grayscaleImage.rows);
+	}
+	return faces.size();
+}
+
+/*
+* Run the cascade. If the face is locked we first look around the locked rect and fall back to the full image.
+* This only reads the cascade and the given settings so it can be called from the worker thread.
+*/
+bool FaceDetector::detectCascade(cv::Mat& gray, cv::Rect& lockedFace, bool faceLocked, CascadeSettings& settings, FaceData& data) {
 	bool detected = false;
-	if (this->faceLocked) {
+	if (faceLocked) {
 		SearchSpace space;
-		getSearchSpace(space, gray, this->face.rect, 50);
+		getSearchSpace(space, gray, lockedFace, 50);
 
-		// detect the face in the grayscale image
-		detected = this->detectFace(space.mat, newFaces);
+		// detect the face in the grayscale image, at the size of the locked face if we know it
+		detected = this->detectFace(space.mat, data, settings, settings.lockedScale ? lockedFace.height : 0);
 		if (detected) {
 			// restore original coordinates
-			fromSearchSpace(space, newFaces.rect);
+			fromSearchSpace(space, data.rect);
 		}
 		else {
 			// fallback
-			detected = this->detectFace(gray, newFaces);
+			detected = this->detectFace(gray, data, settings);
 		}
 	}
 	else {
 		// detect in full image
-		detected = this->detectFace(gray, newFaces);
+		detected = this->detectFace(gray, data, settings);
+	}
+	return detected;
+}
+
+CascadeSettings FaceDetector::getCascadeSettings() {
+	CascadeSettings settings;
+	settings.frameHeight = this->frameHeight;
+	settings.detectionScale = this->detectionScale;
+	settings.minimumFaceWindow = this->minimumFaceWindow;
+	settings.lockedScale = this->lockedScale;
+	settings.lockedScaleRange = this->lockedScaleRange;
+	settings.lockedFaceHeight = this->lockedFaceHeight;
+	return settings;
+}
+
+/*
+* Detect a face in a grayscale image.
+*/
+bool FaceDetector::detect(cv::Mat& gray) {
+	PROFILE_SCOPE(PROFILE_FACE);
+	this->framesSinceDetection += 1;
+
+	if (this->asynchronous) {
+		if (this->worker.isRunning() == false)
+			this->worker.start(this);
+
+		// apply a finished cascade reading. It was made on an older frame, the tracking below moves it to this one.
+		// A reading from before a reset can be of another frame size, it is collected but not applied.
+		FaceData newFaces;
+		bool detected = false;
+		int generation = 0;
+		if (this->worker.getResult(newFaces, detected, this->detectionFrame, generation) && generation == this->generation) {
+			this->faceAvailable = this->update(detected, newFaces, this->detectionFrame);
+		}
+		if (this->isDetectionDue()) {
+			CascadeSettings settings = this->getCascadeSettings();
+			if (this->worker.submit(gray, this->face.rect, this->faceLocked, settings, this->generation))
+				this->framesSinceDetection = 0;
+		}
+		if (this->faceAvailable)
+			this->track(gray);
+		return this->faceAvailable;
+	}
+
+	if (this->isDetectionDue()) {
+		FaceData newFaces;
+		CascadeSettings settings = this->getCascadeSettings();
+		bool detected = this->detectCascade(gray, this->face.rect, this->faceLocked, settings, newFaces);
+		this->framesSinceDetection = 0;
+		this->faceAvailable = this->update(detected, newFaces, gray);
 	}
+	else if (this->faceAvailable) {
+		this->track(gray);
+	}
+	return this->faceAvailable;
+}
+
+/*
+* Feed a cascade reading that was made elsewhere, like the shared run of the multi subject mode. This is the state
+* machine of detect without the cascade. Returns true if there is a face to work with.
+*/
+bool FaceDetector::apply(bool detected, FaceData& reading, cv::Mat& gray) {
+	this->framesSinceDetection = 0;
+	this->faceAvailable = this->update(detected, reading, gray);
+	return this->faceAvailable;
+}
 
+/*
+* A frame without a cascade reading: follow the face with the template, like detect does between readings.
+*/
+bool FaceDetector::follow(cv::Mat& gray) {
+	this->framesSinceDetection += 1;
+	if (this->faceAvailable)
+		this->track(gray);
+	return this->faceAvailable;
+}
+
+/*
+* The cascade is run on every frame until the face is locked. After that only every detectionInterval frames or
+* when the tracker lost the face.
+*/
+bool FaceDetector::isDetectionDue() {
+	if (this->faceLocked == false || this->drifted || this->faceTemplate.empty())
+		return true;
+	return this->detectionInterval > 0 && this->framesSinceDetection >= this->detectionInterval;
+}
+
+/*
+* Feed a cascade reading into the good/bad readings state machine. The detection frame is the frame the reading was
+* made in, the face template is taken from it when the reading is accepted.
+*/
+bool FaceDetector::update(bool detected, FaceData& newFaces, cv::Mat& detectionFrame) {
+	float movementThreshold = this->faceAreaThresholdFactor * this->frameWidth;
 	if (detected) {
 		this->badReadings = 0;
 
@@ -115,6 +344,9 @@ bool FaceDetector::detect(cv::Mat& gray) {
 		if (newFaces.count == 1 && (this->faceLocked == false || (this->faceLocked && faceInArea))) {
 			this->face.count = newFaces.count;
 			this->face.rect = newFaces.rect;
+			this->drifted = false;
+			cv::Rect templateRect = this->face.rect & cv::Rect(0, 0, detectionFrame.cols, detectionFrame.rows);
+			detectionFrame(templateRect).copyTo(this->faceTemplate);
 		}
 
 		// if we have a face, update the position and return true: we have something to work with.
@@ -137,17 +369,182 @@ bool FaceDetector::detect(cv::Mat& gray) {
 			return true;
 		}
 		return false;
-	}	
+	}
 }
 
+/*
+* Follow the face between cascade readings by matching the template of the last accepted face around its last
+* position. The size of the rect is kept, so the scale is only updated by the cascade.
+* Returns false and flags the face as drifted if the match is not good enough.
+*/
+bool FaceDetector::track(cv::Mat& gray) {
+	if (this->faceTemplate.empty() || this->face.count == 0)
+		return false;
+
+	cv::Rect searchRect = inflateRect(this->face.rect, this->trackingSearchRadius, gray);
+	if (searchRect.width < this->faceTemplate.cols || searchRect.height < this->faceTemplate.rows) {
+		this->drifted = true;
+		return false;
+	}
+
+	double maxScore = 0;
+	cv::Point maxLocation;
+	cv::matchTemplate(gray(searchRect), this->faceTemplate, this->trackingScores, cv::TM_CCOEFF_NORMED);
+	cv::minMaxLoc(this->trackingScores, nullptr, &maxScore, nullptr, &maxLocation);
+
+	if (maxScore < this->trackingThreshold) {
+		this->drifted = true;
+		return false;
+	}
+
+	this->face.rect.x = searchRect.x + maxLocation.x;
+	this->face.rect.y = searchRect.y + maxLocation.y;
+	this->faceCenterX = getCenterX(this->face.rect);
+	this->faceCenterY = getCenterY(this->face.rect);
+	return true;
+}
+
+/*
+* Run the cascade on a worker thread. The main thread uses the tracked face in the meantime.
+*/
+void FaceDetector::setAsynchronous(bool enabled) {
+	this->asynchronous = enabled;
+	if (enabled == false)
+		this->worker.stop();
+}
+
+/*
+* Run the cascade on a half size copy, and only at the size of the face once it is locked.
+*/
+void FaceDetector::setFastDetection(bool enabled) {
+	this->detectionScale = enabled ? 0.5 : 1;
+	this->lockedScale = enabled;
+}
+
+/*
+* A new frame size also drops the asynchronous reading in flight, it is in the coordinates of the old size.
+*/
 void FaceDetector::setVideoProperties(int frameWidth, int frameHeight) {
+	if (frameWidth != this->frameWidth || frameHeight != this->frameHeight)
+		this->generation++;
 	this->frameHeight = frameHeight;
 	this->frameWidth = frameWidth;
 }
 
+/*
+* Start over for a new feed or frame size. A cascade reading the worker is making or has finished is of the old frames
+* and is dropped when it is collected.
+*/
 void FaceDetector::reset() {
+	this->generation++;
+	this->clearFace();
+}
+
+/*
+* Forget the face after it was lost. Unlike reset this keeps the frames, an asynchronous reading in flight is still
+* applied: before the first one arrives detect has no face and the pipeline clears it every frame.
+*/
+void FaceDetector::clearFace() {
 	this->faceLocked = false;
 	this->face.count = 0;
 	this->goodReadings = 0;
 	this->badReadings = 0;
+	this->faceAvailable = false;
+	this->drifted = false;
+	this->framesSinceDetection = 0;
+	this->faceTemplate.release();
+}
+
+
+
+FaceDetectionWorker::FaceDetectionWorker() {}
+FaceDetectionWorker::~FaceDetectionWorker() {
+	this->stop();
+}
+
+void FaceDetectionWorker::start(FaceDetector* detector) {
+	this->stop();
+	this->detector = detector;
+	this->running = true;
+	this->busy = false;
+	this->jobReady = false;
+	this->resultReady = false;
+	this->thread = std::thread(&FaceDetectionWorker::loop, this);
+}
+
+void FaceDetectionWorker::stop() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->running = false;
+	}
+	this->condition.notify_all();
+	if (this->thread.joinable())
+		this->thread.join();
+}
+
+bool FaceDetectionWorker::isRunning() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->running;
+}
+
+/*
+* Hand a frame to the worker. Returns false if the worker is still busy with the previous one, the frame is dropped then.
+*/
+bool FaceDetectionWorker::submit(cv::Mat& gray, cv::Rect& lockedFace, bool faceLocked, CascadeSettings& settings, int generation) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->running == false || this->busy)
+		return false;
+
+	// the worker only touches the frame while busy, so this is safe to fill here.
+	gray.copyTo(this->frame);
+	this->lockedFace = lockedFace;
+	this->faceLocked = faceLocked;
+	this->settings = settings;
+	this->generation = generation;
+	this->busy = true;
+	this->jobReady = true;
+	this->condition.notify_one();
+	return true;
+}
+
+/*
+* Collect the result of a finished job. The frame it was detected in is swapped into frame, generation is that of the
+* job. Returns false if there is no result yet.
+*/
+bool FaceDetectionWorker::getResult(FaceData& data, bool& detected, cv::Mat& frame, int& generation) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->resultReady == false)
+		return false;
+
+	data = this->result;
+	detected = this->detected;
+	generation = this->generation;
+	std::swap(frame, this->frame);
+	this->resultReady = false;
+	this->busy = false;
+	return true;
+}
+
+void FaceDetectionWorker::loop() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	for (;;) {
+		this->condition.wait(lock, [this] { return this->jobReady || this->running == false; });
+		if (this->running == false)
+			break;
+		this->jobReady = false;
+
+		// run the cascade without holding the lock, submit does not touch the frame while we are busy.
+		cv::Rect lockedFace = this->lockedFace;
+		bool faceLocked = this->faceLocked;
+		CascadeSettings settings = this->settings;
+		lock.unlock();
+		FaceData data;
+		data.count = 0;
+		bool detected = this->detector->detectCascade(this->frame, lockedFace, faceLocked, settings, data);
+		lock.lock();
+
+		this->result = data;
+		this->detected = detected;
+		this->resultReady = true;
+	}
 }
\ No newline at end of file
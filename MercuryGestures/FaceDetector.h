@@ -1,6 +1,65 @@
 #pragma once
 
 #include "MercuryCore.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <memory>
+
+class FaceDetector;
+
+/*
+* The settings the cascade runs with, see FaceDetector::detectFaces. The worker gets a copy with every job, so the main
+* thread can change those of the detector while the cascade runs.
+*/
+struct CascadeSettings {
+	int frameHeight;
+	double detectionScale;
+	double minimumFaceWindow;
+	bool lockedScale;
+	double lockedScaleRange;
+	int lockedFaceHeight;
+};
+
+/*
+* Runs the cascade classifier of a FaceDetector on its own thread. One job is handled at a time, the detector picks up
+* the result on a later frame.
+*/
+class FaceDetectionWorker {
+public:
+	FaceDetectionWorker();
+	~FaceDetectionWorker();
+
+	void start(FaceDetector* detector);
+	void stop();
+	bool isRunning();
+	bool submit(cv::Mat& gray, cv::Rect& lockedFace, bool faceLocked, CascadeSettings& settings, int generation);
+	bool getResult(FaceData& data, bool& detected, cv::Mat& frame, int& generation);
+
+private:
+	FaceDetector* detector = nullptr;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool running = false;
+	bool busy = false;        // a job has been submitted and its result has not been collected yet
+	bool jobReady = false;
+	bool resultReady = false;
+
+	// the job
+	cv::Mat frame;
+	cv::Rect lockedFace;
+	bool faceLocked = false;
+	CascadeSettings settings;
+	int generation = 0; // of the detector when the job was submitted, see FaceDetector::reset
+
+	// the result
+	FaceData result;
+	bool detected = false;
+
+	void loop();
+};
 
 class FaceDetector {
 public:
@@ -25,21 +84,89 @@ public:
 	int normalizationIterations = 10;
 	double pixelSizeInCm = 0.25; // will be refined in the normalization phase
 	double normalizationScale = 0.25; // cm per pixel based on face detection.
+	double bodyReach = 50; // cm left and right of the face center the hands are looked for, see getBodyRegion
+
+	// rate decoupling. Once the face is locked the cascade runs every detectionInterval frames (0 = only on drift),
+	// in asynchronous mode on its own thread. In between a template match on the face keeps the rect current. If that
+	// match drops below trackingThreshold the face has drifted and the cascade is run again as soon as possible.
+	bool asynchronous = false;
+	int detectionInterval = 1;
+	double trackingThreshold = 0.7;
+	int trackingSearchRadius = 20;   // pixels around the face rect the template is searched in
+	int framesSinceDetection = 0;
+	bool drifted = false;
+	bool faceAvailable = false;      // result of the last cascade reading, returned on the frames in between
+	cv::Mat faceTemplate;
+	cv::Mat trackingScores;          // result of matching the template, reused every frame
+	cv::Mat detectionFrame;          // frame the last asynchronous result was detected in
+	cv::Mat scaledBuffer;            // the downscaled cascade input of detectFaces, only used by the thread running the cascade
+	int generation = 0;              // bumped by reset, asynchronous results of an older generation are dropped
+
+	// cascade cost. The cascade runs on the frame resized by detectionScale, but never so far that the smallest face
+	// gets below minimumFaceWindow times the window of the cascade. With lockedScale the search around a locked face
+	// only tries the scales within lockedScaleRange of its size, on a copy resized so that face is lockedFaceHeight high.
+	double detectionScale = 1;
+	double minimumFaceWindow = 1.5;
+	bool lockedScale = false;
+	double lockedScaleRange = 1.25;
+	int lockedFaceHeight = 40;
 
 	FaceDetector();
 	~FaceDetector();
 
 	void updateScale();
 	void addResultToMask(cv::Mat& mask);
+	cv::Rect getBodyRegion();
 	void draw(cv::Mat& canvas);
 	/**
 	* This detects faces. It assumes only one face will be in view. It will draw the boundaries of the expected position of
 	* user body parts. This can be used to make a mask to sample only important parts of the image for movement. It can also
 	* be used to ignore the head movement or upper torso.
 	*/
-	bool detectFace(cv::Mat& grayscaleImage, FaceData & data);
+	bool detectFace(cv::Mat& grayscaleImage, FaceData & data, CascadeSettings& settings, int expectedHeight = 0);
+	int detectFaces(cv::Mat& grayscaleImage, std::vector<cv::Rect>& faces, int expectedHeight = 0);
+	int detectFaces(cv::Mat& grayscaleImage, std::vector<cv::Rect>& faces, CascadeSettings& settings, int expectedHeight = 0);
+	bool detectCascade(cv::Mat& gray, cv::Rect& lockedFace, bool faceLocked, CascadeSettings& settings, FaceData& data);
+	CascadeSettings getCascadeSettings();
 	bool detect(cv::Mat& gray);
+	bool apply(bool detected, FaceData& reading, cv::Mat& gray);
+	bool follow(cv::Mat& gray);
+	bool isDetectionDue();
 	bool setup();
+	void setAsynchronous(bool enabled);
+	void setFastDetection(bool enabled);
 	void setVideoProperties(int width, int height);
+	void clearFace();
 	void reset();
-};
\ No newline at end of file
+
+private:
+	FaceDetectionWorker worker;
+
+	bool update(bool detected, FaceData& newFaces, cv::Mat& detectionFrame);
+	bool track(cv::Mat& gray);
+};
+
+/*
+* Parse a cascade xml into the storage (converting the old haarcascade format), to set up detectors with.
+*/
+bool loadCascadeStorage(std::string cascadeName, cv::FileStorage& storage);
+
+/*
+* The parsed cascades of the process, by file name. Parsing the xml is the slow part of setting up a detector, with
+* the cache this happens once per process however many pipelines are made. The classifiers are read from the parsed
+* storage, they are not shared: a CascadeClassifier keeps state while detecting so every detector needs its own.
+*/
+class CascadeCache {
+public:
+	static CascadeCache& instance();
+
+	bool load(std::string cascadeName);
+	bool setup(std::string cascadeName, cv::CascadeClassifier& classifier);
+	void clear();
+
+private:
+	std::mutex mutex;
+	std::map<std::string, std::unique_ptr<cv::FileStorage>> storages;
+
+	cv::FileStorage* find(std::string& cascadeName);
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "FramePool.h"
+
+FramePool::FramePool() {}
+FramePool::~FramePool() {}
+
+/*
+* Get a buffer of this size and type. The contents are undefined.
+*/
+cv::Mat FramePool::acquire(int rows, int cols, int type) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	int matching = 0;
+	for (auto& buffer : this->buffers) {
+		if (buffer.rows == rows && buffer.cols == cols && buffer.type() == type) {
+			// only the pool holds a reference to this one, so nobody uses it.
+			if (buffer.u->refcount == 1)
+				return buffer;
+			matching++;
+		}
+	}
+
+	this->allocations++;
+	cv::Mat buffer(rows, cols, type);
+	if (matching < this->maxBuffersPerKey)
+		this->buffers.push_back(buffer);
+	return buffer;
+}
+
+cv::Mat FramePool::acquire(cv::Size size, int type) {
+	return this->acquire(size.height, size.width, type);
+}
+
+cv::Mat FramePool::acquireZeros(int rows, int cols, int type) {
+	cv::Mat buffer = this->acquire(rows, cols, type);
+	buffer.setTo(0);
+	return buffer;
+}
+
+/*
+* The amount of buffers that had to be allocated since the start. This should stop growing after the first frames.
+*/
+int FramePool::getAllocationCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->allocations;
+}
+
+int FramePool::getBufferCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->buffers.size();
+}
+
+/*
+* Drop the references of the pool. Buffers that are still in use stay alive until their last header is gone.
+*/
+void FramePool::clear() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->buffers.clear();
+}
+
+cv::Mat acquireMat(FramePool* pool, int rows, int cols, int type) {
+	if (pool == nullptr)
+		return cv::Mat(rows, cols, type);
+	return pool->acquire(rows, cols, type);
+}
+
+cv::Mat acquireZeros(FramePool* pool, int rows, int cols, int type) {
+	if (pool == nullptr)
+		return cv::Mat::zeros(rows, cols, type);
+	return pool->acquireZeros(rows, cols, type);
+}
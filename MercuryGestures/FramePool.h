@@ -0,0 +1,37 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include <mutex>
+
+/*
+* A pool of frame buffers for the per frame temporaries of the detectors, keyed by size and type. The pool keeps a
+* reference to every buffer it made. A buffer is free again when all other cv::Mat headers to it are gone, so the
+* returned Mats can be used like any other Mat and are given back by destroying (or reassigning) them.
+* After the first frames every acquire is served from the pool and no new buffers are allocated.
+* The pool can be used from multiple threads.
+*/
+class FramePool {
+public:
+	int maxBuffersPerKey = 16; // above this acquire falls back to plain allocation
+
+	FramePool();
+	~FramePool();
+
+	cv::Mat acquire(int rows, int cols, int type);
+	cv::Mat acquire(cv::Size size, int type);
+	cv::Mat acquireZeros(int rows, int cols, int type);
+	int getAllocationCount();
+	int getBufferCount();
+	void clear();
+
+private:
+	std::mutex mutex;
+	std::vector<cv::Mat> buffers;
+	int allocations = 0;
+};
+
+/*
+* Get a scratch Mat from the pool, or a new one if there is no pool.
+*/
+cv::Mat acquireMat(FramePool* pool, int rows, int cols, int type);
+cv::Mat acquireZeros(FramePool* pool, int rows, int cols, int type);
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* The buffers of the last depth frames, indexed by frame number. Advancing to the next frame only moves the index: the
+* slot of the oldest frame becomes the current one, so keeping the history copies nothing. With cv::Mat the slots keep
+* their allocation, a detector that writes into current() with the same size reuses the buffer of that old frame.
+*/
+template <typename T>
+class FrameRing {
+public:
+	FrameRing(int depth = 2) {
+		this->setDepth(depth);
+	}
+
+	/*
+	* Change the amount of frames kept. This drops the history.
+	*/
+	void setDepth(int depth) {
+		this->slots.assign(std::max(1, depth), T());
+		this->reset();
+	}
+
+	/*
+	* Forget the history, the buffers are kept.
+	*/
+	void reset() {
+		this->frame = -1;
+		this->count = 0;
+	}
+
+	/*
+	* Move on to the next frame. Returns its slot, which still holds the oldest frame.
+	*/
+	T& advance() {
+		this->frame++;
+		this->count = std::min(this->count + 1, int(this->slots.size()));
+		return this->current();
+	}
+
+	T& current() {
+		return this->get(0);
+	}
+
+	/*
+	* The frame before the current one, an empty buffer if there is none yet.
+	*/
+	T& previous() {
+		if (this->has(1))
+			return this->get(1);
+		this->none = T();
+		return this->none;
+	}
+
+	/*
+	* The frame back frames ago. Going further back than the history wraps around, check with has.
+	*/
+	T& get(int back) {
+		long long index = this->frame - back;
+		int depth = this->slots.size();
+		return this->slots[int(((index % depth) + depth) % depth)];
+	}
+
+	/*
+	* Get the buffer of a frame by its number.
+	*/
+	T& at(long long frame) {
+		return this->get(int(this->frame - frame));
+	}
+
+	bool has(int back) {
+		return back >= 0 && back < this->count;
+	}
+
+	bool contains(long long frame) {
+		return this->has(int(this->frame - frame));
+	}
+
+	long long getFrame() {
+		return this->frame;
+	}
+
+	int getDepth() {
+		return this->slots.size();
+	}
+
+private:
+	std::vector<T> slots;
+	long long frame = -1;  // number of the current frame
+	int count = 0;         // frames in the history
+	T none;                // returned by previous when there is no history
+};
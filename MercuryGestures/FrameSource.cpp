@@ -0,0 +1,184 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "FrameSource.h"
+#include <algorithm>
+
+FrameSource::FrameSource() {}
+
+FrameSource::~FrameSource() {
+	this->release();
+}
+
+/*
+* Open a video file, stream url or camera, see openSource. Everything but a file is live.
+*/
+bool FrameSource::open(std::string source) {
+	this->release();
+	if (openSource(this->cap, source) == false)
+		return false;
+
+	bool cameraIndex = source.size() > 0 && std::all_of(source.begin(), source.end(), ::isdigit);
+	this->live = cameraIndex || source.find("://") != std::string::npos;
+	this->fps = ::getFps(this->cap);
+	this->ended = false;
+	this->hasNewest = false;
+
+	// the capture thread keeps its own newest frame, frames queued in the backend would only add latency.
+	if (this->live)
+		this->cap.set(CV_CAP_PROP_BUFFERSIZE, 1);
+	return true;
+}
+
+/*
+* Ask the source to deliver frames of this height (or the nearest mode it has), with the aspect ratio it has now. Only
+* cameras are asked, the decoders of files and streams cannot scale. Call before start. Returns true if the source
+* delivers frames that are not higher than the target.
+*/
+bool FrameSource::setTargetHeight(int height) {
+	cv::Size size = this->getFrameSize();
+	if (height <= 0 || size.height <= height)
+		return true;
+	if (this->live == false || this->threaded)
+		return false;
+
+	int width = std::round(size.width * height / double(size.height));
+	this->cap.set(CV_CAP_PROP_FRAME_WIDTH, width);
+	this->cap.set(CV_CAP_PROP_FRAME_HEIGHT, height);
+	return this->getFrameSize().height <= height;
+}
+
+/*
+* Start the capture thread of a live source. Files are read on the calling thread, this does nothing for them.
+*/
+void FrameSource::start() {
+	if (this->live == false || this->threaded || this->cap.isOpened() == false)
+		return;
+	this->threaded = true;
+	this->stopping = false;
+	this->thread = std::thread(&FrameSource::capture, this);
+}
+
+/*
+* Get the next frame. For a live source that has been started this is the newest frame, it blocks until there is one
+* that was not read yet. Otherwise skip frames are passed over without decoding them first.
+* Returns false when the source has ended.
+*/
+bool FrameSource::read(CapturedFrame& frame, int skip) {
+	if (this->threaded) {
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->frameReady.wait(lock, [this] { return this->hasNewest || this->ended; });
+		if (this->hasNewest == false)
+			return false;
+		// swap, so the buffer of the previous read is the next one the capture thread fills
+		std::swap(frame.image, this->newest.image);
+		frame.timestamp = this->newest.timestamp;
+		frame.dropped = this->newest.dropped;
+		this->hasNewest = false;
+		return true;
+	}
+
+	frame.dropped = 0;
+	for (int i = skip; i > 0 && this->cap.grab(); i--)
+		frame.dropped++;
+	return this->grab(frame);
+}
+
+/*
+* True if a read would not block: the capture thread has a frame that was not read yet, or the source has ended. Reads
+* of files and of sources that were not started decode on the calling thread, for these this is always true.
+*/
+bool FrameSource::hasFrame() {
+	if (this->threaded == false)
+		return true;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->hasNewest || this->ended;
+}
+
+/*
+* Stop the capture thread. Reads after this fail once the last captured frame has been read.
+*/
+void FrameSource::stop() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	if (this->thread.joinable())
+		this->thread.join();
+}
+
+void FrameSource::release() {
+	this->stop();
+	this->cap.release();
+	this->live = false;
+	this->threaded = false;
+}
+
+bool FrameSource::isOpened() {
+	return this->cap.isOpened();
+}
+
+bool FrameSource::isLive() {
+	return this->live;
+}
+
+int FrameSource::getFps() {
+	return this->fps;
+}
+
+cv::Size FrameSource::getFrameSize() {
+	return cv::Size(int(this->cap.get(CV_CAP_PROP_FRAME_WIDTH)), int(this->cap.get(CV_CAP_PROP_FRAME_HEIGHT)));
+}
+
+
+//***************************************** PRIVATE  **********************************************//
+
+
+/*
+* Grab and decode a frame. The time is taken right after the grab, before the decoding.
+*/
+bool FrameSource::grab(CapturedFrame& frame) {
+	if (this->cap.grab() == false)
+		return false;
+	frame.timestamp = getTimestamp();
+	return this->cap.retrieve(frame.image) && frame.image.empty() == false;
+}
+
+/*
+* The capture thread. A frame that has not been read when the next one is captured is replaced by it.
+*/
+void FrameSource::capture() {
+	CapturedFrame captured;
+	int dropped = 0;
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->stopping)
+				break;
+		}
+		if (this->grab(captured) == false)
+			break;
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->hasNewest)
+				dropped += 1 + this->newest.dropped;
+			std::swap(this->newest.image, captured.image);
+			this->newest.timestamp = captured.timestamp;
+			this->newest.dropped = dropped;
+			this->hasNewest = true;
+			dropped = 0;
+			this->frameReady.notify_one();
+		}
+		if (this->onFrame)
+			this->onFrame();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->ended = true;
+		this->frameReady.notify_all();
+	}
+	if (this->onFrame)
+		this->onFrame();
+}
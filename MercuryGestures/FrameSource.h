@@ -0,0 +1,67 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+* A frame as it came from the source.
+*/
+struct CapturedFrame {
+	cv::Mat image;
+	long long timestamp = 0;  // capture time in us since the epoch, taken right after the grab
+	int dropped = 0;          // frames of the source skipped before this one
+};
+
+/*
+* A video file, stream url or camera to read frames from.
+*
+* Live sources (cameras and stream urls) are read on a capture thread of their own once started. It grabs as fast as
+* the source delivers and only keeps the newest frame, so a slow consumer gets the latest frame instead of one that
+* waited in the buffers of the backend. The frames that were replaced before they were read are counted as dropped.
+* Files are read on the calling thread, every frame is delivered unless it is skipped on purpose.
+*
+* Cameras are asked for the target height, so they do not deliver pixels that are scaled away right after. A backend
+* that has no such mode ignores this, the frame is then resized in Pipeline::prepare as before.
+*
+* The image of a read frame is valid until the next read, its buffer is handed back to the capture.
+*/
+class FrameSource {
+public:
+	// called on the capture thread after every captured frame and when the source ends, see hasFrame. Set it before
+	// start, it must not read from the source itself.
+	std::function<void()> onFrame;
+
+	FrameSource();
+	~FrameSource();
+
+	bool open(std::string source);
+	bool setTargetHeight(int height);
+	void start();
+	bool read(CapturedFrame& frame, int skip = 0);
+	bool hasFrame();
+	void stop();
+	void release();
+	bool isOpened();
+	bool isLive();
+	int getFps();
+	cv::Size getFrameSize();
+
+private:
+	cv::VideoCapture cap;
+	bool live = false;
+	bool threaded = false;     // started, the frames come from the capture thread
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable frameReady;
+	CapturedFrame newest;      // the frame the capture thread has for the next read
+	bool hasNewest = false;
+	bool ended = false;
+	bool stopping = false;
+	int fps = 25;
+
+	bool grab(CapturedFrame& frame);
+	void capture();
+};
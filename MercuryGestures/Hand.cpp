@@ -1,7 +1,8 @@
 #pragma once
 #include "MercuryCore.h"
 #include "HandDetector.h"
-#include <set>
+#include "CoverageMap.h"
+#include "Profiler.h"
 
 
 // Basic constructor, initializing all variables
@@ -73,12 +74,10 @@ bool Hand::isClose(cv::Point& otherHandPosition, bool drawDebug) {
 		double distance = getDistance(this->position, otherHandPosition);
 		// if we're close we search for space away from the other hand and set intersecting to true
 		if (distance < minimalDistance) {
-#ifdef DEBUG
 			if (drawDebug) {
-				rect(*this->rgbSkinMask, this->position, 40, this->color, 1);
-				cv::putText(*this->rgbSkinMask, "close", this->position - cv::Point(80, 40), 0, 0.5, this->color);
+				this->debug->rect(this->position, 40, this->color, 1);
+				this->debug->text("close", this->position - cv::Point(80, 40), 0.5, this->color);
 			}
-#endif
 			return true;
 		}
 	}
@@ -89,8 +88,8 @@ bool Hand::isClose(cv::Point& otherHandPosition, bool drawDebug) {
 /*
 We shift the hand awat from the other one in small steps. Only left right are allowed.
 */
-void Hand::handleIntersection(cv::Point& otherHandPosition, cv::Mat& skinMask) {
-	this->improveByDirection(skinMask, this->leftHand ? SEARCH_STRICT_LEFT : SEARCH_STRICT_RIGHT, 1, 255);
+void Hand::handleIntersection(cv::Point& otherHandPosition, CoverageMap& skinCoverage) {
+	this->improveByDirection(skinCoverage, this->leftHand ? SEARCH_STRICT_LEFT : SEARCH_STRICT_RIGHT, 1, 255);
 }
 
 
@@ -105,12 +104,10 @@ void Hand::setInvalideState() {
 	}
 	this->ignoreState = false;
 
-#ifdef DEBUG
 	if (this->invalidState) {
-		rect(*this->rgbSkinMask, this->position, 40, CV_RGB(10, 40, 255), 3);
-		cv::putText(*this->rgbSkinMask, "intersect", this->position - cv::Point(80, 40), 0, 0.5, this->color);
+		this->debug->rect(this->position, 40, CV_RGB(10, 40, 255), 3);
+		this->debug->text("intersect", this->position - cv::Point(80, 40), 0.5, this->color);
 	}
-#endif
 }
 
 
@@ -140,7 +137,7 @@ void Hand::draw(cv::Mat& canvas) {
 	}
 	else {
 		cv::circle(canvas, this->position, 25, this->color, 2);
-		//cv::circle(*this->rgbSkinMask, this->position, 25, this->color, 2);
+		//this->debug->circle(this->position, 25, this->color, 2);
 		cv::putText(canvas, this->leftHand ? "L" : "R", this->position, 0, 0.8, this->color, 3);
 
 #ifdef DEBUG
@@ -222,7 +219,8 @@ void Hand::drawTrace(cv::Mat& canvas, std::vector<cv::Point>& positions, int sta
 	- Refine the result by area optimalization and transversing the blob.
 *
 */
-void Hand::solve(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask, std::vector<BlobInformation>& blobs, cv::Mat& movementMap) {
+void Hand::solve(CoverageMap& skinCoverage, std::vector<BlobInformation>& blobs, CoverageMap& movementCoverage) {
+	PROFILE_SCOPE(PROFILE_HAND_SOLVE);
 	// if the estimate has been updated, update the position. If the improvement algorithms fail, this is the fallback
 	if (this->estimateUpdated == true) {
 		this->position = this->blobEstimate;
@@ -232,8 +230,8 @@ void Hand::solve(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask, std::vecto
 	auto lastPosition = this->positionHistory[this->positionIndex]; // still the last one since we have not yet found the final pos.
 	// revert to search for a position based on the last known position
 	if (lastPosition.x != 0 && lastPosition.y != 0 && this->invalidState == false) {
-		auto predictedPoint = this->getPredictedPosition(gray, grayPrev, skinMask);
-		this->improveByAreaSearch(skinMask, movementMap, predictedPoint);
+		auto predictedPoint = this->getPredictedPosition(skinCoverage);
+		this->improveByAreaSearch(skinCoverage, predictedPoint);
 	}
 
 	// is we are forced to switch to a blob estimate and it is far (> 15cm) away we reset the history.
@@ -250,10 +248,10 @@ void Hand::solve(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask, std::vecto
 		SearchMode searchMode = this->getSearchModeFromBlobs(blobs);
 
 		// find a good estimate
-		this->improveByCoverage(skinMask, searchMode, 5);
+		this->improveByCoverage(skinCoverage, searchMode, this->getIterations(this->coverageSearchIterations));
 
 		// find a good estimate
-		this->improveByDirection(skinMask, searchMode, 20);
+		this->improveByDirection(skinCoverage, searchMode, this->getIterations(this->directionSearchIterations));
 	}
 }
 
@@ -263,11 +261,11 @@ void Hand::solve(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask, std::vecto
 * After the solving of the intersections, we use the history to smooth out the position, 
 store the position and use this position to improve the estimate of the last point.
 */
-void Hand::finalize(cv::Mat& skinMask, cv::Mat& movementMap) {
+void Hand::finalize(CoverageMap& skinCoverage, CoverageMap& movementCoverage) {
 	// we do not want to improve the position if it is not initialized.
 	if (this->position.x != 0 && this->position.y != 0) {
 		// check if we can use averaging to smooth the result.
-		this->improveUsingHistory(skinMask, movementMap);
+		this->improveUsingHistory(movementCoverage);
 
 		// store the position in the list
 		this->positionIndex = this->getNextIndex(this->positionIndex);
@@ -303,25 +301,24 @@ void Hand::improvePreviousPoint() {
 /*
 * This method will search the surrounding 8.5 cm for a hand blob.
 */
-bool Hand::improveByAreaSearch(cv::Mat& skinMask, cv::Mat& movementMap, cv::Point& position) {
+bool Hand::improveByAreaSearch(CoverageMap& skinCoverage, cv::Point& position) {
 	double distance = getDistance(position, this->position);
 	double maxDistance = 2 * this->maxVelocity * cmInPixels / fps;
 
 	// if a jump or if no data
 	if (distance > maxDistance || this->estimateUpdated == false) {
-		int maxIterations = 10;
+		int maxIterations = this->getIterations(this->areaSearchIterations);
 		int stepSize = 4;
 		int radius = 8.5 * this->cmInPixels;
 
-		double pointQuality = this->getPointQuality(position, skinMask);
-#ifdef DEBUG
-		cv::circle(*this->rgbSkinMask, position, radius, CV_RGB(0, 100, 30), 4);
-		cv::putText(*this->rgbSkinMask, joinString("q:", int(100 * pointQuality)), position + cv::Point(10, 0), 0, 1, CV_RGB(0, 100, 30), 2);
-#endif
+		double pointQuality = this->getPointQuality(position, skinCoverage);
+		this->debug->circle(position, radius, CV_RGB(0, 100, 30), 4);
+		this->debug->text("q:", int(100 * pointQuality), position + cv::Point(10, 0), 1, CV_RGB(0, 100, 30), 2);
+
 		// We do a quality check to ensure that the point we are in is not crap. 
 		// If it is we need to ignore the search and get the estimate.
 		if (pointQuality > 0.1) {
-			this->position = this->lookAround(position, skinMask, maxIterations, stepSize, radius, FREE_SEARCH, 50);
+			this->position = this->lookAround(position, skinCoverage, maxIterations, stepSize, radius, FREE_SEARCH, 50);
 			return true;
 		}
 	}
@@ -332,7 +329,7 @@ bool Hand::improveByAreaSearch(cv::Mat& skinMask, cv::Mat& movementMap, cv::Poin
 /*
 * We get a position based on a linear extrapolation from the last point. 
 */
-cv::Point Hand::getPredictedPosition(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask) {
+cv::Point Hand::getPredictedPosition(CoverageMap& skinCoverage) {
 	int p1_index = this->positionIndex;
 	int p2_index = this->getPreviousIndex(p1_index);
 	int p3_index = this->getPreviousIndex(p2_index);
@@ -350,13 +347,13 @@ cv::Point Hand::getPredictedPosition(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat&
 
 	cv::Point predictedPositionPosition(position_n_1.x + dx1,			  position_n_1.y + dy1);
 	cv::Point predictedPositionVelocity(position_n_1.x + (dx1 + dx2) / 2, position_n_1.y + (dy1 + dy2) / 2);
-	cv::Point predictedOpticalFlow = this->getEstimateByOpticalFlow(gray, grayPrev, skinMask, position_n_1);
+	cv::Point predictedOpticalFlow = this->getEstimateByOpticalFlow(position_n_1);
 
 	// get the quality of all points we consider:
-	double pointQualityCurrent		= this->getPointQuality(position_n_1,				skinMask);
-	double pointQualityPosition		= this->getPointQuality(predictedPositionPosition,  skinMask);
-	double pointQualityVelocity		= this->getPointQuality(predictedPositionVelocity,  skinMask);
-	double pointQualityOpticalFlow	= this->getPointQuality(predictedOpticalFlow,		skinMask);
+	double pointQualityCurrent		= this->getPointQuality(position_n_1,				skinCoverage);
+	double pointQualityPosition		= this->getPointQuality(predictedPositionPosition,  skinCoverage);
+	double pointQualityVelocity		= this->getPointQuality(predictedPositionVelocity,  skinCoverage);
+	double pointQualityOpticalFlow	= this->getPointQuality(predictedOpticalFlow,		skinCoverage);
 	
 	//basic estimate:
 	cv::Point bestPrediction = position_n_1;
@@ -376,8 +373,8 @@ cv::Point Hand::getPredictedPosition(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat&
 		pointQuality = pointQualityOpticalFlow;
 	}
 
-	rect(*this->rgbSkinMask, predictedOpticalFlow, 10, CV_RGB(255, 0, 0), 1); // orange rect
-	cv::putText(*this->rgbSkinMask, joinString("q:", int(100 * pointQualityOpticalFlow)), predictedOpticalFlow + cv::Point(10, 0), 0, 0.5, CV_RGB(255, 0, 0), 1);
+	this->debug->rect(predictedOpticalFlow, 10, CV_RGB(255, 0, 0), 1); // orange rect
+	this->debug->text("q:", int(100 * pointQualityOpticalFlow), predictedOpticalFlow + cv::Point(10, 0), 0.5, CV_RGB(255, 0, 0), 1);
 
 	// if about 10% of the searchspace has been filled we accept the point
 	if (pointQuality > 0.1) {
@@ -389,63 +386,56 @@ cv::Point Hand::getPredictedPosition(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat&
 }
 
 
+/*
+* Does this hand use the optical flow estimate this frame? Only if there is a last known position.
+*/
+bool Hand::needsOpticalFlow() {
+	auto lastPosition = this->positionHistory[this->positionIndex];
+	return lastPosition.x != 0 && lastPosition.y != 0 && this->invalidState == false;
+}
+
 /*
 We deploy a number of optical flow trackers on the hand locations if it overlaps with the skinmap.
-We then take the average dx and dy witout outliers and compute the new position.
+The trackers of both hands are tracked together by the hand detector, see getEstimateByOpticalFlow for the result.
 */
-cv::Point Hand::getEstimateByOpticalFlow(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask, cv::Point& lastPosition) {
+void Hand::deployOpticalFlowTrackers(cv::Mat& skinMask) {
 	// these are class members for drawing in debug mode..
 	this->opticalFlowPoint = cv::Point(0, 0);
 	this->opticalFlowPointsPrev.clear();
 	this->opticalFlowSuccess.clear();
 	this->opticalFlowPoints.clear();
+	this->opticalFlowStatus.clear();
 
-	// move to a smaller searchspace to increase efficiency.
-	SearchSpace space;
-	getSearchSpace(space, grayPrev, lastPosition, 60);
-	cv::Mat graySearchSpace = gray(space.area);
-	toSearchSpace(space, lastPosition);
+	if (this->needsOpticalFlow() == false)
+		return;
 
 	// deploy trackers
+	cv::Point lastPosition = this->positionHistory[this->positionIndex];
 	int amount = 6;
 	int spacing = 2 * this->cmInPixels;
 	for (int i = 0; i < amount; i++) {
 		for (int j = 0; j < amount; j++) {
 			cv::Point offset(-(amount / 2) * spacing + spacing * i, -(amount / 2) * spacing + spacing * j);
 			cv::Point tracker = lastPosition + offset;
-			fromSearchSpace(space, tracker);
 			if (tracker.x < skinMask.cols && tracker.x > 0 && tracker.y > 0 && tracker.y < skinMask.rows) {
 				if (skinMask.at<uchar>(tracker) == 255) {
-					toSearchSpace(space, tracker);
 					this->opticalFlowSuccess.push_back(false);
 					this->opticalFlowPointsPrev.push_back(tracker);
 				}
 			}
 		}
 	}
+}
 
-	// map the position back
-	fromSearchSpace(space, lastPosition);
-
+/*
+We take the average dx and dy of the tracked points witout outliers and compute the new position.
+*/
+cv::Point Hand::getEstimateByOpticalFlow(cv::Point& lastPosition) {
 	// we require points to search over. this can be 0 if the point does not overlap with a skin area
-	if (this->opticalFlowPointsPrev.size() == 0) {
+	if (this->opticalFlowPointsPrev.size() == 0 || this->opticalFlowPoints.size() != this->opticalFlowPointsPrev.size()) {
 		return cv::Point(0, 0);
 	}
 
-	// Find position of feature in new image
-	cv::calcOpticalFlowPyrLK(
-		space.mat, graySearchSpace, // 2 consecutive images
-		this->opticalFlowPointsPrev, // input point positions in first im
-		this->opticalFlowPoints, // output point positions in the 2nd
-		this->opticalFlowStatus,    // tracking success
-		this->opticalFlowErr      // tracking error
-	);
-
-	for (int i = 0; i < this->opticalFlowPointsPrev.size(); i++) {
-		fromSearchSpace(space, this->opticalFlowPointsPrev[i]);
-		fromSearchSpace(space, this->opticalFlowPoints[i]);
-	}
-
 	// get estimate of averages
 	double dxAverage = 0;
 	double dyAverage = 0;
@@ -541,13 +531,13 @@ SearchMode Hand::getSearchModeFromBlobs(std::vector<BlobInformation>& blobs) {
 /*
 * We use a reasonably sized tracker to walk over the blob, this should center the point in the blob.
 */
-void Hand::improveByCoverage(cv::Mat& skinMask, SearchMode searchMode, int maxIterations, int colorBase) {
+void Hand::improveByCoverage(CoverageMap& skinCoverage, SearchMode searchMode, int maxIterations, int colorBase) {
 	int stepSize = 3;
 	int radius = 8 * this->cmInPixels; 
 
 	// find the new best position
-	cv::putText(*this->rgbSkinMask, joinString("cov ", searchMode) , this->position, 0, 0.5, CV_RGB(255, 0, 0), 1);
-	cv::Point maxPos = this->lookAround(this->position, skinMask, maxIterations, stepSize, radius, searchMode, colorBase);
+	this->debug->text("cov ", searchMode, this->position, 0.5, CV_RGB(255, 0, 0), 1);
+	cv::Point maxPos = this->lookAround(this->position, skinCoverage, maxIterations, stepSize, radius, searchMode, colorBase);
 
 	// update position with improved one.
 	this->position = maxPos;
@@ -557,7 +547,7 @@ void Hand::improveByCoverage(cv::Mat& skinMask, SearchMode searchMode, int maxIt
 /*
 * We use a small sized tracker to walk over the blob towards the expected position of the hand.
 */
-void Hand::improveByDirection(cv::Mat& skinMask, SearchMode searchMode, int maxIterations, int colorBase) {
+void Hand::improveByDirection(CoverageMap& skinCoverage, SearchMode searchMode, int maxIterations, int colorBase) {
 	if (searchMode == FREE_SEARCH)
 		return;
 
@@ -565,7 +555,7 @@ void Hand::improveByDirection(cv::Mat& skinMask, SearchMode searchMode, int maxI
 	int radius = 2.5 * this->cmInPixels;
 
 	// find the new best position
-	cv::Point maxPos = this->lookAround(this->position, skinMask, maxIterations, stepSize, radius, searchMode, colorBase);
+	cv::Point maxPos = this->lookAround(this->position, skinCoverage, maxIterations, stepSize, radius, searchMode, colorBase);
 
 	// update position with improved one.
 	this->position = maxPos;
@@ -577,7 +567,7 @@ void Hand::improveByDirection(cv::Mat& skinMask, SearchMode searchMode, int maxI
 * if there is a little movement, we weight he current position more strongly.
 * if there is a lot of movement, we accept the current position.
 */
-void Hand::improveUsingHistory(cv::Mat& skinMask, cv::Mat& movementMap) {
+void Hand::improveUsingHistory(CoverageMap& movementCoverage) {
 	int historyAverage = 5; // must be lower or equal to this->historySize
 	int index = this->positionIndex; 
 	double distanceThreshold = 3 * this->cmInPixels;
@@ -596,21 +586,21 @@ void Hand::improveUsingHistory(cv::Mat& skinMask, cv::Mat& movementMap) {
 	avgX /= historyAverage;
 	avgY /= historyAverage;
 
-	double movementCoverage = this->getPointQuality(this->position, movementMap, 30);
+	double movementQuality = this->getPointQuality(this->position, movementCoverage, 30);
 	// if the movement is very small, mostly copy over the average
-	if (movementCoverage < 0.001) {
+	if (movementQuality < 0.001) {
 		this->position.x = 0.95 * avgX + 0.05 * this->position.x;
 		this->position.y = 0.95 * avgY + 0.05 * this->position.y;
 	}
 	// if there is some movement, average the average and the pos by 80/20
-	else if (movementCoverage < 0.05) {
-		//rect(*this->rgbSkinMask, cv::Point(avgX, avgY), 10, CV_RGB(200, 0, 200), 8);
+	else if (movementQuality < 0.05) {
+		//this->debug->rect(cv::Point(avgX, avgY), 10, CV_RGB(200, 0, 200), 8);
 		this->position.x = 0.8 * avgX + 0.2 * this->position.x;
 		this->position.y = 0.8 * avgY + 0.2 * this->position.y;
 	}
 	// if there is reasonable movement, average the average and the pos by 50/50
-	else if (movementCoverage < 0.2) {
-		//rect(*this->rgbSkinMask, cv::Point(avgX, avgY), 15, CV_RGB(0, 200, 200), 8);
+	else if (movementQuality < 0.2) {
+		//this->debug->rect(cv::Point(avgX, avgY), 15, CV_RGB(0, 200, 200), 8);
 		this->position.x = 0.5 * avgX + 0.5 * this->position.x;
 		this->position.y = 0.5 * avgY + 0.5 * this->position.y;
 	}
@@ -625,194 +615,43 @@ void Hand::improveUsingHistory(cv::Mat& skinMask, cv::Mat& movementMap) {
 
 /*
  * Explore the area around the blob for maximum coverage. This will center a circle within the blob (ideally).
+ * The search itself is the coarse to fine walk of the CoverageSearch, see there.
  */
-cv::Point Hand::lookAround(cv::Point start, cv::Mat& skinMask, int maxIterations,int stepSize, int radius, SearchMode searchMode, int colorBase) {
-	cv::Point maxPos = start;
-
+cv::Point Hand::lookAround(cv::Point start, CoverageMap& coverage, int maxIterations,int stepSize, int radius, SearchMode searchMode, int colorBase) {
+	PROFILE_SCOPE(PROFILE_LOOK_AROUND);
 	SearchSpace space;
-	getSearchSpace(space, skinMask, maxPos);
-
-#ifdef DEBUG
-	cv::circle(*this->rgbSkinMask, maxPos, radius, this->color, 1);
-	//cv::circle(*this->rgbSkinMask, maxPos, 3, CV_RGB(0, 80, 180), 5);
-#endif
-
-	// Offet the position by the searchwindow
-	toSearchSpace(space, maxPos);
+	getSearchSpace(space, coverage.mask, start);
 
-	// get the initial estimate.
-	double maxValue = this->getCoverage(maxPos, space.mat, radius);
+	this->debug->circle(start, radius, this->color, 1);
+	//this->debug->circle(start, 3, CV_RGB(0, 80, 180), 5);
 
-	// search in a box
-	int index_n_1 = -1;
-	int index_n_2 = -1;
+	cv::Point maxPos = this->coverageSearch.search(start, coverage, space, maxIterations, stepSize, radius, searchMode);
 
-	int vectorSize = 5;
-	if (searchMode == FREE_SEARCH)
-		vectorSize = 8;
-	else if (searchMode == SEARCH_STRICT_LEFT || searchMode == SEARCH_STRICT_RIGHT)
-		vectorSize = 1;
-
-	std::vector<double> newValues(vectorSize,0);
-	std::vector<cv::Point> newPositions(vectorSize, cv::Point(0,0));
-	
-	std::set<int> positionHistory;
-	for (int i = 0; i < maxIterations; i++) {
-
-		if (searchMode == SEARCH_RIGHT) {
-			// WHEN SEARCH_RIGHT IS ON, WE SEARCH ON THE LEFT SIDE OF THE SCREEN -> RIGHT FOR THE PERSON
-			// x x .
-			// x o .
-			// x x .
-
-			// also search up and down, just not right
-			newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, 0, stepSize, radius);
-			newValues[1] = this->shiftPosition(space.mat, newPositions[1], maxPos, 0, -stepSize, radius);
-			newValues[2] = this->shiftPosition(space.mat, newPositions[2], maxPos, -stepSize, stepSize, radius);
-			newValues[3] = this->shiftPosition(space.mat, newPositions[3], maxPos, -stepSize, -stepSize, radius);
-			newValues[4] = this->shiftPosition(space.mat, newPositions[4], maxPos, -stepSize, 0, radius);
-		}
-		else if (searchMode == SEARCH_STRICT_RIGHT) {
-			// WHEN SEARCH_STRICT_RIGHT IS ON, WE SEARCH ON THE LEFT SIDE OF THE SCREEN -> RIGHT FOR THE PERSON
-			// . . .
-			// x o .
-			// . . .
-	
-
-			//newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, -stepSize, stepSize, radius);
-			//newValues[1] = this->shiftPosition(space.mat, newPositions[1], maxPos, -stepSize, -stepSize, radius);
-			//newValues[2] = this->shiftPosition(space.mat, newPositions[2], maxPos, -stepSize, 2 * -stepSize, radius);
-			//newValues[3] = this->shiftPosition(space.mat, newPositions[3], maxPos, -stepSize, 2 * stepSize, radius);
-			newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, -stepSize, 0, radius);
-		}
-		else if (searchMode == SEARCH_STRICT_LEFT) {
-			// WHEN SEARCH_STRICT_LEFT IS ON, WE SEARCH ON THE RIGHT SIDE OF THE SCREEN -> LEFT FOR THE PERSON
-			// . . .
-			// . o x
-			// . . .
-
-			//newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, stepSize, stepSize, radius);
-			//newValues[1] = this->shiftPosition(space.mat, newPositions[1], maxPos, stepSize, -stepSize, radius);
-			//newValues[2] = this->shiftPosition(space.mat, newPositions[2], maxPos, stepSize, 2 * -stepSize, radius);
-			//newValues[3] = this->shiftPosition(space.mat, newPositions[3], maxPos, stepSize, 2 * stepSize, radius);
-			newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, stepSize, 0, radius);
-			
-		}
-		else if (searchMode == SEARCH_LEFT) {
-			// WHEN SEARCH_LEFT IS ON, WE SEARCH ON THE RIGHT SIDE OF THE SCREEN -> LEFT FOR THE PERSON
-			// . x x
-			// . o x
-			// . x x
-
-			// also search up and down, just not left
-			newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, 0, stepSize, radius);
-			newValues[1] = this->shiftPosition(space.mat, newPositions[1], maxPos, 0, -stepSize, radius);
-			newValues[2] = this->shiftPosition(space.mat, newPositions[2], maxPos, stepSize, stepSize, radius);
-			newValues[3] = this->shiftPosition(space.mat, newPositions[3], maxPos, stepSize, -stepSize, radius);
-			newValues[4] = this->shiftPosition(space.mat, newPositions[4], maxPos, stepSize, 0, radius);
-		}
-		else if (searchMode == SEARCH_UP) {
-			// x x x
-			// x o x
-			// . . .
-
-			// allow left right
-			newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, -stepSize, 0, radius);
-			newValues[1] = this->shiftPosition(space.mat, newPositions[1], maxPos, stepSize, 0, radius);
-			newValues[2] = this->shiftPosition(space.mat, newPositions[2], maxPos, stepSize, -stepSize, radius);
-			newValues[3] = this->shiftPosition(space.mat, newPositions[3], maxPos, -stepSize, -stepSize, radius);
-			newValues[4] = this->shiftPosition(space.mat, newPositions[4], maxPos, 0, -stepSize, radius);
-		}
-		else if (searchMode == SEARCH_DOWN) {
-			// . . .
-			// x o x
-			// x x x
-
-			// allow left right
-			newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, -stepSize, 0, radius);
-			newValues[1] = this->shiftPosition(space.mat, newPositions[1], maxPos, stepSize, 0, radius);
-			newValues[2] = this->shiftPosition(space.mat, newPositions[2], maxPos, stepSize, stepSize, radius);
-			newValues[3] = this->shiftPosition(space.mat, newPositions[3], maxPos, -stepSize, stepSize, radius);
-			newValues[4] = this->shiftPosition(space.mat, newPositions[4], maxPos, 0, stepSize, radius);
-		}
-		else {// if (searchMode == FREE_SEARCH) {
-			  // x x x
-			  // x o x
-			  // x x x
-
-			newValues[0] = this->shiftPosition(space.mat, newPositions[0], maxPos, stepSize, stepSize, radius);
-			newValues[1] = this->shiftPosition(space.mat, newPositions[1], maxPos, stepSize, -stepSize, radius);
-			newValues[2] = this->shiftPosition(space.mat, newPositions[2], maxPos, stepSize, 0, radius);
-			newValues[3] = this->shiftPosition(space.mat, newPositions[3], maxPos, -stepSize, stepSize, radius);
-			newValues[4] = this->shiftPosition(space.mat, newPositions[4], maxPos, -stepSize, -stepSize, radius);
-			newValues[5] = this->shiftPosition(space.mat, newPositions[5], maxPos, -stepSize, 0, radius);
-			newValues[6] = this->shiftPosition(space.mat, newPositions[6], maxPos, 0, stepSize, radius);
-			newValues[7] = this->shiftPosition(space.mat, newPositions[7], maxPos, 0, -stepSize, radius);
-		}
-
-	
-		double newMax = 0;
-		int maxIndex = 0;
-		for (int j = 0; j < vectorSize; j++) {
-			if (newMax < newValues[j]) {
-				// if position not in the positions, allow.
-				if (positionHistory.find(newPositions[j].x * 1000 + newPositions[j].y) == positionHistory.end()) {
-					newMax = newValues[j];
-					maxIndex = j;
-				}
-			}
-		}
-
-		if (newMax >= maxValue) {
-			maxValue = newMax;
-#ifdef DEBUG
-			cv::Point drawPoint(maxPos.x + space.x, maxPos.y + space.y);
-			cv::circle(*this->rgbSkinMask, drawPoint, 2, CV_RGB(colorBase, 0, std::min(30 * i, 255)), 2);
-#endif
-			maxPos = newPositions[maxIndex];
-			positionHistory.insert(maxPos.x * 1000 + maxPos.y);
-		}
-		else {
-			break;
-		}
+	// draw the steps taken
+	cv::Point drawPoint = start;
+	for (int i = 0; i < this->coverageSearch.path.size(); i++) {
+		this->debug->circle(drawPoint, 2, CV_RGB(colorBase, 0, std::min(30 * i, 255)), 2);
+		drawPoint = this->coverageSearch.path[i];
 	}
 
-	// restore the transformation of the coordinates
-	fromSearchSpace(space, maxPos);
-#ifdef DEBUG
+	// draw the search direction
 	auto color = this->color;
 	if (colorBase < 150)
 		color = CV_RGB(100, 0, 100);
-	if (searchMode == SEARCH_RIGHT) {
-		cv::line(*this->rgbSkinMask, maxPos, cv::Point(maxPos.x - 40, maxPos.y), color, 1);
-		cv::circle(*this->rgbSkinMask, cv::Point(maxPos.x - 40, maxPos.y), 10, color, 1);
-	}
-	else if (searchMode == SEARCH_STRICT_RIGHT) {
-		cv::line(*this->rgbSkinMask, maxPos, cv::Point(maxPos.x - 40, maxPos.y), color, 1);
-		rect(*this->rgbSkinMask, cv::Point(maxPos.x - 50, maxPos.y), 10, color, 1);
-	}
-	else if (searchMode == SEARCH_LEFT) {
-		cv::line(*this->rgbSkinMask, maxPos, cv::Point(maxPos.x + 40, maxPos.y), color, 1);
-		cv::circle(*this->rgbSkinMask, cv::Point(maxPos.x + 40, maxPos.y), 10, color, 1);
+	const SearchPattern& pattern = getSearchPattern(searchMode);
+	if (pattern.heading == cv::Point(0, 0)) {
+		this->debug->line(cv::Point(maxPos.x, maxPos.y - 40), cv::Point(maxPos.x, maxPos.y + 40), color, 1);
+		this->debug->line(cv::Point(maxPos.x - 40, maxPos.y), cv::Point(maxPos.x + 40, maxPos.y), color, 1);
+		this->debug->circle(maxPos, 10, color, 1);
 	}
-	else if (searchMode == SEARCH_STRICT_LEFT) {
-		cv::line(*this->rgbSkinMask, maxPos, cv::Point(maxPos.x + 40, maxPos.y), color, 1);
-		rect(*this->rgbSkinMask, cv::Point(maxPos.x + 50, maxPos.y), 10, color, 1);
-	}
-	else if (searchMode == SEARCH_UP) {
-		cv::line(*this->rgbSkinMask, maxPos, cv::Point(maxPos.x, maxPos.y - 40), color, 1);
-		cv::circle(*this->rgbSkinMask, cv::Point(maxPos.x, maxPos.y - 40), 10, color, 1);
-	}
-	else if (searchMode == SEARCH_DOWN) {
-		cv::line(*this->rgbSkinMask, maxPos, cv::Point(maxPos.x, maxPos.y + 40), color, 1);
-		cv::circle(*this->rgbSkinMask, cv::Point(maxPos.x, maxPos.y + 40), 10, color, 1);
-	}
-	else { // searchMode == FREE_SEARCH
-		cv::line(*this->rgbSkinMask, cv::Point(maxPos.x, maxPos.y - 40), cv::Point(maxPos.x, maxPos.y + 40), color, 1);
-		cv::line(*this->rgbSkinMask, cv::Point(maxPos.x - 40, maxPos.y), cv::Point(maxPos.x + 40, maxPos.y), color, 1);
-		cv::circle(*this->rgbSkinMask, maxPos, 10, color, 1);
+	else {
+		cv::Point target(maxPos.x + 40 * pattern.heading.x, maxPos.y + 40 * pattern.heading.y);
+		this->debug->line(maxPos, target, color, 1);
+		if (pattern.strict)
+			this->debug->rect(cv::Point(maxPos.x + 50 * pattern.heading.x, maxPos.y + 50 * pattern.heading.y), 10, color, 1);
+		else
+			this->debug->circle(target, 10, color, 1);
 	}
-#endif
 
 	// return best position
 	return maxPos;
@@ -820,36 +659,19 @@ cv::Point Hand::lookAround(cv::Point start, cv::Mat& skinMask, int maxIterations
 
 
 /*
-* We use a circle mask and get a percentage of how much this was filled by the blob. 
+* We use a circle and get a percentage of how much this was filled by the blob. The position is in search space
+* coordinates and only the pixels inside of the search space are taken into account.
 * Returns value between 0 .. 1
 */
-double Hand::getCoverage(cv::Point& pos, cv::Mat& blobMap, int radius) {
-	cv::Mat mask = cv::Mat::zeros(blobMap.rows, blobMap.cols, blobMap.type()); // all 0
-	cv::circle(mask, pos, radius, 155, CV_FILLED);
-	cv::Mat result;
-	cv::bitwise_and(blobMap, mask, result);
-	
-	double value = cv::sum(result)[0] / (radius*radius*3.1415 * 255.0);
-	return value;
+double Hand::getCoverage(cv::Point& pos, CoverageMap& coverage, SearchSpace& space, int radius) {
+	cv::Point center = pos;
+	fromSearchSpace(space, center);
+	return coverage.getCoverage(center, radius, space.area);
 }
 
 
-/*
-* We shift the point in the x and y direction and get the coverage
-*/
-double Hand::shiftPosition(
-	cv::Mat& skinMask, cv::Point& newPosition,
-	cv::Point& basePosition, int xOffset, int yOffset, int radius) {
-
-	cv::Point newPos = basePosition;
-	newPos.x += xOffset;
-	newPos.y += yOffset;
-	newPosition = newPos;
-	return this->getCoverage(newPos, skinMask, radius);
-}
-
 // Small util to get the quality with a default radius...
-double Hand::getPointQuality(cv::Point& point, cv::Mat& qualityMask, int radius) {
+double Hand::getPointQuality(cv::Point& point, CoverageMap& quality, int radius) {
 	// do not measure the quality of uninitialized points;
 	if (point.x == 0 && point.y == 0) {
 		return 0;
@@ -861,12 +683,19 @@ double Hand::getPointQuality(cv::Point& point, cv::Mat& qualityMask, int radius)
 
 	// construct a searchspace and search in it. We transform the point back and forth.
 	SearchSpace space;
-	getSearchSpace(space, qualityMask, point, 2 * radius);
+	getSearchSpace(space, quality.mask, point, 2 * radius);
 	toSearchSpace(space,point);
-	double quality = this->getCoverage(point, space.mat, radius);
+	double value = this->getCoverage(point, quality, space, radius);
 	fromSearchSpace(space, point);
 
-	return quality;
+	return value;
+}
+
+/*
+* Scale the iterations of a search with the search effort, at least one.
+*/
+int Hand::getIterations(int iterations) {
+	return std::max(1, int(std::round(iterations * this->searchEffort)));
 }
 
 // History is a deck. Get the index:
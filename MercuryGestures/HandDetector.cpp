@@ -1,39 +1,8 @@
 #pragma once
 #include "MercuryCore.h"
 #include "HandDetector.h"
-
-
-/************************************  UTIL  *********************************************/
-
-/*
-* Get the amount of edges inside of a blob as an integer
-*/
-BlobEdgeData getEdgeData(BlobInformation& blob, cv::Mat& edges) {
-	// the data to fill
-	BlobEdgeData data;
-
-	// draw a mask of the blob
-	cv::Mat blobMask = cv::Mat::zeros(edges.rows, edges.cols, edges.type());
-	std::vector<cv::Vec4i> hierarchy;
-	std::vector<std::vector<cv::Point>> contours;
-	contours.push_back(blob.contour);
-	cv::drawContours(blobMask, contours, 0, 255, CV_FILLED, 8, hierarchy, 0, cv::Point());
-
-	// store the size of the data
-	data.size = cv::sum(blobMask)[0] / 255;
-
-	// make the mask a little smaller so we do not use the outer edges of the blob
-	erode(blobMask, blobMask, 6);
-
-	// use the AND operation to only get the edges
-	cv::Mat combined;
-	cv::bitwise_and(edges, blobMask, combined);
-	data.edgeCount = cv::sum(combined)[0] / 255;
-
-	return data;
-}
-
-/************************************ /UTIL  *********************************************/
+#include "Morphology.h"
+#include "Profiler.h"
 
 
 /*
@@ -44,31 +13,180 @@ HandDetector::HandDetector(int fps) {
 	this->leftHand.leftHand = true;
 	this->leftHand.fps = fps;
 	this->leftHand.color = CV_RGB(0, 150, 255);
-	this->leftHand.rgbSkinMask = &this->rgbSkinMask;
+	this->leftHand.debug = &this->debugSink;
 	
 	this->rightHand.fps = fps;
 	this->rightHand.color = CV_RGB(0, 255, 0);
-	this->rightHand.rgbSkinMask = &this->rgbSkinMask;
+	this->rightHand.debug = &this->debugSink;
 }
 HandDetector::~HandDetector() {}
 
 
 /*
-* Get the amount of edges inside of a blob as an integer
+* Turn the debug map on or off at runtime. Headless pipelines turn this off. Without DEBUG there is nothing to turn on.
+*/
+void HandDetector::setDebugDrawing(bool enabled) {
+	this->debugSink.setActive(enabled);
+}
+
+
+/*
+* Set the frame size. The face mask is trained on frames of the old size, so a new size starts it over.
 */
 void HandDetector::setVideoProperties(int frameWidth, int frameHeight) {
+	if (frameWidth != this->frameWidth || frameHeight != this->frameHeight) {
+		this->faceMask.release();
+		this->faceMaskAverageArea = 0;
+	}
 	this->frameHeight = frameHeight;
 	this->frameWidth = frameWidth;
 }
 
+/*
+* Scale the search iterations of both hands, 1 is the full search.
+*/
+void HandDetector::setSearchEffort(double effort) {
+	this->leftHand.searchEffort = effort;
+	this->rightHand.searchEffort = effort;
+}
+
+void HandDetector::setParameters(HandParameters& parameters) {
+	this->parameters = parameters;
+	for (Hand* hand : { &this->leftHand, &this->rightHand }) {
+		hand->coverageSearchIterations = parameters.coverageSearchIterations;
+		hand->directionSearchIterations = parameters.directionSearchIterations;
+		hand->areaSearchIterations = parameters.areaSearchIterations;
+	}
+}
+
+
+/*
+* Find the blobs in the skin mask. The large blobs are filled (to avoid gaps in contours or contours in contours) and
+* closed, after that the connected components give the area, bounding box and centroid of every blob in one pass.
+* The extreme points are found on the borders of the bounding box. Contours are only made on request, see getContour.
+* With an area only that part of the skin mask is searched. The labels outside of it are background and the blobs are
+* mapped back to frame coordinates.
+*/
+void HandDetector::extractBlobs(cv::Mat& skinMask, double minArea, std::vector<BlobInformation>& blobs, cv::Rect searchArea) {
+	PROFILE_SCOPE(PROFILE_CONTOURS);
+	blobs.clear();
+
+	if (searchArea.area() == 0)
+		searchArea = cv::Rect(0, 0, skinMask.cols, skinMask.rows);
+	SearchSpace space;
+	getSearchSpace(space, skinMask, searchArea, 0);
+	cv::Mat& areaMask = space.mat;
+
+	// fill the large blobs
+	cv::Mat filledBlobs = acquireMat(this->framePool, areaMask.rows, areaMask.cols, areaMask.type());
+	areaMask.copyTo(filledBlobs);
+	std::vector<std::vector<cv::Point>>& contours = this->contours;
+	cv::Mat contourInput = acquireMat(this->framePool, areaMask.rows, areaMask.cols, areaMask.type());
+	areaMask.copyTo(contourInput);
+	cv::findContours(contourInput, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+	for (int i = 0; i < contours.size(); i++) {
+		if (cv::contourArea(contours[i]) > minArea) {
+			cv::drawContours(filledBlobs, contours, i, 255, CV_FILLED, 8);
+		}
+	}
+
+	dilate(filledBlobs, filledBlobs);
+	erode(filledBlobs, filledBlobs);
+
+	// label them, the labels stay in frame coordinates
+	this->blobLabels.create(skinMask.rows, skinMask.cols, CV_32S);
+	cv::Mat areaLabels = this->blobLabels(space.area);
+	int labelCount = cv::connectedComponentsWithStats(filledBlobs, areaLabels, this->blobStats, this->blobCentroids, 8, CV_32S);
+	clearOutside(this->blobLabels, space.area);
+
+	// label 0 is the background
+	for (int label = 1; label < labelCount; label++) {
+		int area = this->blobStats.at<int>(label, cv::CC_STAT_AREA);
+		if (area <= minArea)
+			continue;
+
+		BlobInformation blob;
+		blob.index = label;
+		blob.label = label;
+		blob.area = area;
+		blob.rect = cv::Rect(
+			this->blobStats.at<int>(label, cv::CC_STAT_LEFT),
+			this->blobStats.at<int>(label, cv::CC_STAT_TOP),
+			this->blobStats.at<int>(label, cv::CC_STAT_WIDTH),
+			this->blobStats.at<int>(label, cv::CC_STAT_HEIGHT)
+		);
+		blob.center = cv::Point(this->blobCentroids.at<double>(label, 0), this->blobCentroids.at<double>(label, 1));
+		fromSearchSpace(space, blob.rect);
+		fromSearchSpace(space, blob.center);
+		blob.type = OTHER;
+		this->getExtremePoints(blob);
+		blobs.push_back(blob);
+	}
+}
+
+/*
+* The extreme points of a blob lie on the borders of its bounding box. We take the first pixel of the blob on each border.
+*/
+void HandDetector::getExtremePoints(BlobInformation& blob) {
+	cv::Rect& r = blob.rect;
+	int top = r.y;
+	int bottom = r.y + r.height - 1;
+	int left = r.x;
+	int right = r.x + r.width - 1;
+
+	for (int x = left; x <= right; x++) {
+		if (this->blobLabels.at<int>(top, x) == blob.label) { blob.top = cv::Point(x, top); break; }
+	}
+	for (int x = left; x <= right; x++) {
+		if (this->blobLabels.at<int>(bottom, x) == blob.label) { blob.bottom = cv::Point(x, bottom); break; }
+	}
+	for (int y = top; y <= bottom; y++) {
+		if (this->blobLabels.at<int>(y, left) == blob.label) { blob.left = cv::Point(left, y); break; }
+	}
+	for (int y = top; y <= bottom; y++) {
+		if (this->blobLabels.at<int>(y, right) == blob.label) { blob.right = cv::Point(right, y); break; }
+	}
+}
+
+/*
+* Get the outer contour of a blob. This is made from the label image the first time it is asked for.
+*/
+std::vector<cv::Point>& HandDetector::getContour(BlobInformation& blob) {
+	if (blob.contour.size() == 0) {
+		cv::Mat blobMask = this->getBlobMask(blob);
+		std::vector<std::vector<cv::Point>>& contours = this->contours;
+		cv::findContours(blobMask, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, blob.rect.tl());
+		if (contours.size() > 0)
+			blob.contour.assign(contours[0].begin(), contours[0].end());
+	}
+	return blob.contour;
+}
+
+/*
+* Draw the mask of a blob on a canvas.
+*/
+void HandDetector::drawBlob(cv::Mat& canvas, BlobInformation& blob, cv::Scalar color) {
+	canvas(blob.rect).setTo(color, this->getBlobMask(blob));
+}
+
+/*
+* The pixels of the blob in its bounding box, 255 for the blob. This is a part of a frame sized buffer, so it is only
+* valid until the next call.
+*/
+cv::Mat HandDetector::getBlobMask(BlobInformation& blob) {
+	if (this->blobMaskBuffer.size() != this->blobLabels.size())
+		this->blobMaskBuffer.create(this->blobLabels.rows, this->blobLabels.cols, CV_8U);
+	cv::Mat blobMask = this->blobMaskBuffer(cv::Rect(0, 0, blob.rect.width, blob.rect.height));
+	cv::compare(this->blobLabels(blob.rect), cv::Scalar(blob.label), blobMask, cv::CMP_EQ);
+	return blobMask;
+}
 
 /*
 * This is the detector entree point. It does too much at the moment so it is in need of seperation. We get the blobs, filter them on size,
 * segment them, judge them, forward them to the specific analysers
 */
-void HandDetector::detect(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& face, cv::Mat& skinMask, cv::Mat& movementMap, cv::Mat& edges, double pixelSizeInCm) {
-	skinMask.copyTo(this->skinMask);
-	
+void HandDetector::detect(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& face, cv::Mat& skinMask, cv::Mat& movementMap, cv::Mat& edges, double pixelSizeInCm, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_HANDS);
 	// get an estimate for the center based on the face.
 	int centerX = face.x + 0.5 * face.width;
 	
@@ -85,153 +203,102 @@ void HandDetector::detect(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& face, cv::
 	this->leftHand.faceCoverageThreshold = 0.6 * bottomFace + 0.4 * this->frameHeight;;
 	this->rightHand.faceCoverageThreshold = 0.4 * bottomFace + 0.6 * this->frameHeight;;
 
-#ifdef DEBUG
-	cv::cvtColor(this->skinMask, this->rgbSkinMask, CV_GRAY2RGB);
+	// start the debug map for this frame
+	this->debugSink.begin(skinMask);
 	int leftX = centerX - 50 * cmInPixels;
 	int rightX = centerX + 50 * cmInPixels;
-	cv::line(this->rgbSkinMask, cv::Point(centerX, 0), cv::Point(centerX, this->frameHeight),CV_RGB(255, 0, 0));
-	cv::line(this->rgbSkinMask, cv::Point(leftX, 0),   cv::Point(leftX, this->frameHeight),CV_RGB(255, 0, 255));
-	cv::line(this->rgbSkinMask, cv::Point(rightX, 0),  cv::Point(rightX, this->frameHeight),CV_RGB(255, 0, 255));
-	cv::line(this->rgbSkinMask, cv::Point(0, bottomFace),cv::Point(this->frameWidth, bottomFace),CV_RGB(255, 0, 0));
-	cv::line(this->rgbSkinMask, cv::Point(0, lowerBodyHalf), cv::Point(this->frameWidth, lowerBodyHalf), CV_RGB(255, 255, 0));
-#endif
-
-	// we detect contours twice, once to draw in full, once to detect. This is done to avoid gaps in contours or contours in contours
-	cv::Mat filledContours;
-	skinMask.copyTo(filledContours);
-	std::vector<std::vector<cv::Point>> contours;
-	std::vector<cv::Vec4i> hierarchy;
-	
-	// first find.
-	cv::findContours(filledContours, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+	this->debugSink.line(cv::Point(centerX, 0), cv::Point(centerX, this->frameHeight),CV_RGB(255, 0, 0));
+	this->debugSink.line(cv::Point(leftX, 0),   cv::Point(leftX, this->frameHeight),CV_RGB(255, 0, 255));
+	this->debugSink.line(cv::Point(rightX, 0),  cv::Point(rightX, this->frameHeight),CV_RGB(255, 0, 255));
+	this->debugSink.line(cv::Point(0, bottomFace),cv::Point(this->frameWidth, bottomFace),CV_RGB(255, 0, 0));
+	this->debugSink.line(cv::Point(0, lowerBodyHalf), cv::Point(this->frameWidth, lowerBodyHalf), CV_RGB(255, 255, 0));
 
 	// 36cm^2 --> decent hand size measurement
-	double minContour = 6 * 6 * cmInPixels * cmInPixels; 
-
-	// draw first pass
-	for (int i = 0; i < contours.size(); i++) {
-		if (cv::contourArea(contours[i]) > minContour) {
-			cv::drawContours(filledContours, contours, i, 255, CV_FILLED, 8, hierarchy, 0, cv::Point());
-		}
-	}
-
-	dilate(filledContours, filledContours);
-	erode(filledContours, filledContours);
-
-	// start seconds pass
-	contours.clear();
-	hierarchy.clear();
-	cv::findContours(filledContours, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+	double minContour = this->parameters.minContourSize * this->parameters.minContourSize * cmInPixels * cmInPixels;
+	std::vector<BlobInformation>& blobs = this->blobs;
+	this->extractBlobs(skinMask, minContour, blobs, area);
 
 	// mask to remove faces and other irrelevant blobs from the internal skinmask. Is trained over time.
-	cv::Mat highBlobsMask = cv::Mat::zeros(this->skinMask.rows, this->skinMask.cols, this->skinMask.type()); // all 0
-	// create a mat for the edgemask.
-	cv::Mat edgeMask;
-	cv::Mat movementSkinMask;
+	cv::Mat highBlobsMask = acquireZeros(this->framePool, skinMask.rows, skinMask.cols, skinMask.type()); // all 0
 
 	// analyze all blobs
 	int rangeLeftX = this->frameWidth;
 	int rangeRightX = 0;
-	std::vector<BlobInformation> lowerBodyBlobs;
-	std::vector<BlobInformation> midBodyBlobs;
-	std::vector<BlobInformation> highBlobs;
-	std::vector<BlobInformation> blobs;
-	for (int i = 0; i < contours.size(); i++) {
-		if (cv::contourArea(contours[i]) > minContour) {
-			cv::Point lowestPoint(0, 0);
-			cv::Point leftMostPoint(this->frameWidth, 0);
-			cv::Point rightMostPoint(0, 0);
-			cv::Point highestPoint(this->frameWidth, this->frameHeight);
-			for (int j = 0; j < contours[i].size(); j++) {
-				if (contours[i][j].y > lowestPoint.y)
-					lowestPoint = contours[i][j];
-				if (contours[i][j].y < highestPoint.y)
-					highestPoint = contours[i][j];
-				if (contours[i][j].x < leftMostPoint.x)
-					leftMostPoint = contours[i][j];
-				if (contours[i][j].x > rightMostPoint.x)
-					rightMostPoint = contours[i][j];
-			}
-			if (leftMostPoint.x < rangeLeftX)
-				rangeLeftX = leftMostPoint.x;
-			if (rightMostPoint.x > rangeRightX)
-				rangeRightX = rightMostPoint.x;
+	std::vector<BlobInformation>& lowerBodyBlobs = this->lowerBodyBlobs;
+	std::vector<BlobInformation>& midBodyBlobs = this->midBodyBlobs;
+	std::vector<BlobInformation>& highBlobs = this->highBlobs;
+	lowerBodyBlobs.clear();
+	midBodyBlobs.clear();
+	highBlobs.clear();
+	for (int i = 0; i < blobs.size(); i++) {
+		BlobInformation& blob = blobs[i];
+		cv::Point& lowestPoint = blob.bottom;
+		cv::Point& highestPoint = blob.top;
+		if (blob.left.x < rangeLeftX)
+			rangeLeftX = blob.left.x;
+		if (blob.right.x > rangeRightX)
+			rangeRightX = blob.right.x;
+
+		auto color = CV_RGB(255, 0, 0);
+		// the highest point is below the chest line
+		if (highestPoint.y > lowerBodyHalf) { 
+			color = CV_RGB(255, 255, 0);  // yellow
+			lowerBodyBlobs.push_back(blob);
+			blob.type = LOW;
+		}
+		// the lowest point is below the chest line and the highest below the chin line
+		else if (lowestPoint.y > lowerBodyHalf && highestPoint.y > bottomFace) { 
+			color = CV_RGB(255, 100, 50); // orange
+			midBodyBlobs.push_back(blob);
+			blob.type = MEDIUM;
+		}
+		// the lowest and highest points are below the chin and above the chest line
+		else if (lowestPoint.y > bottomFace && highestPoint.y > bottomFace) {
+			color = CV_RGB(150, 50, 150); // dark purple
+			midBodyBlobs.push_back(blob);
+			blob.type = MEDIUM;
+		}
+		// only the lowest point is below the chest line, the highest is above the chin line... stupid blob
+		else if (lowestPoint.y > lowerBodyHalf && highestPoint.y < bottomFace) {
+			color = CV_RGB(255, 0, 0); // red
+			blob.type = HIGH;
+			highBlobs.push_back(blob);
+		}
+		// the highest point is above the chin line
+		else  if (highestPoint.y < bottomFace) {
+			color = CV_RGB(150, 00, 0);  // dark red
+			blob.type = HIGH;
+			highBlobs.push_back(blob);
 
-			auto moment = cv::moments(contours[i], false);
-			auto midPoint = cv::Point2f(moment.m10 / moment.m00, moment.m01 / moment.m00);
-	
-			BlobInformation blob;
-			blob.index = i;
-			blob.top = highestPoint;
-			blob.left = leftMostPoint;
-			blob.right = rightMostPoint;
-			blob.bottom = lowestPoint;
-			blob.center = midPoint;
-			blob.type = OTHER;
-			blob.contour = contours[i];
-
-			auto color = CV_RGB(255, 0, 0);
-			// the highest point is below the chest line
-			if (highestPoint.y > lowerBodyHalf) { 
-				color = CV_RGB(255, 255, 0);  // yellow
-				lowerBodyBlobs.push_back(blob);
-				blob.type = LOW;
-			}
-			// the lowest point is below the chest line and the highest below the chin line
-			else if (lowestPoint.y > lowerBodyHalf && highestPoint.y > bottomFace) { 
-				color = CV_RGB(255, 100, 50); // orange
-				midBodyBlobs.push_back(blob);
-				blob.type = MEDIUM;
-			}
-			// the lowest and highest points are below the chin and above the chest line
-			else if (lowestPoint.y > bottomFace && highestPoint.y > bottomFace) {
-				color = CV_RGB(150, 50, 150); // dark purple
-				midBodyBlobs.push_back(blob);
-				blob.type = MEDIUM;
-			}
-			// only the lowest point is below the chest line, the highest is above the chin line... stupid blob
-			else if (lowestPoint.y > lowerBodyHalf && highestPoint.y < bottomFace) {
-				color = CV_RGB(255, 0, 0); // red
-				blob.type = HIGH;
-	  		    highBlobs.push_back(blob);
-			}
-			// the highest point is above the chin line
-			else  if (highestPoint.y < bottomFace) {
-				color = CV_RGB(150, 00, 0);  // dark red
-				blob.type = HIGH;
-				highBlobs.push_back(blob);
-				
-				cv::drawContours(highBlobsMask, contours, i, 255, CV_FILLED, 8, hierarchy, 0, cv::Point());
-			}
-#ifdef DEBUG
-			// draw the blobs on the rgb skin mask we use for debugging.
-			cv::drawContours(this->rgbSkinMask, contours, i, color, 2, 8, hierarchy, 0, cv::Point());
-#endif
-			blobs.push_back(blob);
+			this->drawBlob(highBlobsMask, blob, 255);
+		}
+		// draw the blobs on the rgb skin mask we use for debugging. Only then the contour is needed.
+		if (this->debugSink.isActive()) {
+			std::vector<std::vector<cv::Point>> contours(1, this->getContour(blob));
+			this->debugSink.contour(contours, 0, color, 2);
 		}
 	}
 
 	// improve the estimate of the centerX
 	centerX = 0.5 * (centerX + 0.5 * (rangeLeftX + rangeRightX));
 
-#ifdef DEBUG
-	cv::line(this->rgbSkinMask, cv::Point(centerX, 0), cv::Point(centerX, this->frameHeight), CV_RGB(255, 255, 0));		
-#endif
+	this->debugSink.line(cv::Point(centerX, 0), cv::Point(centerX, this->frameHeight), CV_RGB(255, 255, 0));
 
 
 	// update the face mask and process it
 	this->updateFaceMask(highBlobsMask);
-	cv::subtract(this->skinMask, this->faceMask, this->skinMask);
+	cv::subtract(skinMask, this->faceMask, this->skinMask);
 
-	// use the updated skin mask to get the edges inside of the blobs
-	cv::bitwise_and(edges, this->skinMask, edgeMask);
-	cv::bitwise_or(this->skinMask, movementMap, movementSkinMask);
+	// the hands query these a lot while searching, build them once for both.
+	this->skinCoverage.build(this->skinMask);
+	this->movementCoverage.build(movementMap);
 	
 	// case 1: 1 blob in the lower segment.
 	if (lowerBodyBlobs.size() == 1) {
 		// if there is one in the lower range and one in the higher range
 		if (midBodyBlobs.size() == 1) { // todo: put back?
-			std::vector<BlobInformation> blobContainer;
+			std::vector<BlobInformation>& blobContainer = this->blobPair;
+			blobContainer.clear();
 			blobContainer.push_back(lowerBodyBlobs[0]);
 			blobContainer.push_back(midBodyBlobs[0]);
 			this->updateHandsFromNBlobsWithAnalysis(blobContainer, edges);
@@ -277,16 +344,19 @@ void HandDetector::detect(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& face, cv::
 		this->updateHandsFromNBlobsByPosition(highBlobs);
 	}
 
+	// track the optical flow points of both hands in one go
+	this->trackHands(gray, grayPrev);
+
 	// solve for the hands
-	this->leftHand.solve( gray, grayPrev, this->skinMask, blobs, movementMap);
-	this->rightHand.solve(gray, grayPrev, this->skinMask, blobs, movementMap);
+	this->leftHand.solve( this->skinCoverage, blobs, this->movementCoverage);
+	this->rightHand.solve(this->skinCoverage, blobs, this->movementCoverage);
 
 	// handle possible intersections of the hands
 	this->handleIntersections();
 
 	// finalize the position
-	this->leftHand.finalize( this->skinMask, movementMap);
-	this->rightHand.finalize(this->skinMask, movementMap);
+	this->leftHand.finalize( this->skinCoverage, this->movementCoverage);
+	this->rightHand.finalize(this->skinCoverage, this->movementCoverage);
 }
 
 
@@ -309,9 +379,7 @@ void HandDetector::drawTraces(cv::Mat& canvas) {
 
 // show the debug map
 void HandDetector::show(std::string windowName) {
-#ifdef DEBUG
-	cv::imshow(windowName, this->rgbSkinMask);
-#endif
+	this->debugSink.show(windowName);
 	//cv::imshow("handSkinMask", this->skinMask);
 }
 
@@ -325,9 +393,19 @@ void HandDetector::addResultToMask(cv::Mat& canvas) {
 	this->rightHand.addResultToMask(canvas);
 }
 
+/*
+* Keep the hands where they are for a frame without detection. The optical flow needs consecutive frames, so
+* the next detection starts the trackers over.
+*/
+void HandDetector::skip() {
+	this->opticalFlow.invalidate();
+}
+
 void HandDetector::reset() {
 	this->leftHand.reset();
 	this->rightHand.reset();
+	this->opticalFlow.invalidate();
+	this->blobs.clear();
 }
 
 
@@ -340,11 +418,42 @@ This will handle possible intersections of the two hands symetrically. If the ha
 will already be repelled. If the intersection state is detected even after the pushing, we will
 set the hands as "trapped". This will cause them to fall back to the blob estimates.
 */
+/*
+* Deploy the optical flow trackers of both hands and track them in a single call on the shared pyramids.
+* The results are split back to the hands, they use them in solve.
+*/
+void HandDetector::trackHands(cv::Mat& gray, cv::Mat& grayPrev) {
+	PROFILE_SCOPE(PROFILE_OPTICAL_FLOW);
+	this->leftHand.deployOpticalFlowTrackers(this->skinCoverage.mask);
+	this->rightHand.deployOpticalFlowTrackers(this->skinCoverage.mask);
+
+	// the pyramid of this frame is needed next frame, even if no hand is tracked now.
+	this->opticalFlow.update(gray, grayPrev);
+
+	std::vector<cv::Point2f>& pointsPrev = this->flowPointsPrev;
+	pointsPrev.assign(this->leftHand.opticalFlowPointsPrev.begin(), this->leftHand.opticalFlowPointsPrev.end());
+	pointsPrev.insert(pointsPrev.end(), this->rightHand.opticalFlowPointsPrev.begin(), this->rightHand.opticalFlowPointsPrev.end());
+	if (pointsPrev.size() == 0)
+		return;
+
+	std::vector<cv::Point2f>& points = this->flowPoints;
+	std::vector<uchar>& status = this->flowStatus;
+	this->opticalFlow.track(pointsPrev, points, status);
+	if (points.size() != pointsPrev.size())
+		return;
+
+	int leftCount = this->leftHand.opticalFlowPointsPrev.size();
+	this->leftHand.opticalFlowPoints.assign(points.begin(), points.begin() + leftCount);
+	this->leftHand.opticalFlowStatus.assign(status.begin(), status.begin() + leftCount);
+	this->rightHand.opticalFlowPoints.assign(points.begin() + leftCount, points.end());
+	this->rightHand.opticalFlowStatus.assign(status.begin() + leftCount, status.end());
+}
+
 void HandDetector::handleIntersections() {
-#ifdef DEBUG
-	this->leftHand.isClose(this->rightHand.position, true);
-	this->rightHand.isClose(this->leftHand.position, true);
-#endif
+	if (this->debugSink.isActive()) {
+		this->leftHand.isClose(this->rightHand.position, true);
+		this->rightHand.isClose(this->leftHand.position, true);
+	}
 
 	bool handCloseTogether = this->leftHand.isClose(this->rightHand.position);
 	int iterations = 0;
@@ -353,8 +462,8 @@ void HandDetector::handleIntersections() {
 		// move to the side
 		cv::Point leftPosition = this->leftHand.position;
 
-		this->leftHand.handleIntersection(this->rightHand.position, this->skinMask);
-		this->rightHand.handleIntersection(leftPosition, this->skinMask);
+		this->leftHand.handleIntersection(this->rightHand.position, this->skinCoverage);
+		this->rightHand.handleIntersection(leftPosition, this->skinCoverage);
 		
 		// check new state
 		handCloseTogether = this->leftHand.isClose(this->rightHand.position);
@@ -372,13 +481,14 @@ void HandDetector::handleIntersections() {
 */
 void HandDetector::updateFaceMask(cv::Mat& highBlobsMask) {
 	// initialize the facemask
+	// the face mask keeps the buffer of the high blobs, the next frame gets a new one from the pool.
 	if (this->faceMask.cols == 0) {
-		highBlobsMask.copyTo(this->faceMask);
+		this->faceMask = highBlobsMask;
 		return;
 	}
 
 	cv::Scalar highArea = cv::sum(highBlobsMask);
-	double faceMaskThreshold = 0.01;
+	double faceMaskThreshold = this->parameters.faceMaskThreshold;
 
 	// init
 	if (this->faceMaskAverageArea == 0) {
@@ -388,7 +498,7 @@ void HandDetector::updateFaceMask(cv::Mat& highBlobsMask) {
 	// if it is a close enough match, update the mask. 
 	if (std::abs(highArea[0] - faceMaskAverageArea) < faceMaskAverageArea * faceMaskThreshold) {
 		this->faceMaskAverageArea = 0.8 *  this->faceMaskAverageArea + 0.2 * highArea[0];
-		highBlobsMask.copyTo(this->faceMask);
+		this->faceMask = highBlobsMask;
 	}
 	// if it is not a match, update the average slowly as a fallback mechanism. Should converge in about 200 frames.
 	else {
@@ -443,7 +553,7 @@ void HandDetector::getBothHandPositionsFromBlob(BlobInformation& blob, bool igno
 	this->leftHand.setEstimate(leftEstimate, blob, ignoreIntersection, condition);
 	this->rightHand.setEstimate(rightEstimate, blob, ignoreIntersection, condition);
 
-	//cv::circle(this->rgbSkinMask, blob.center, 5, CV_RGB(255, 0, 0), 5);
+	//this->debugSink.circle(blob.center, 5, CV_RGB(255, 0, 0), 5);
 }
 
 
@@ -481,21 +591,84 @@ void HandDetector::updateHandsFromNBlobsByPosition(std::vector<BlobInformation>&
 	this->getHandEstimateFromBlob(blobs[rightIndex], this->rightHand, ignoreIntersection);
 }
 
+/*
+* Get the amount of edges inside of every blob. Only the edges more than the erosion size inside of the blob are counted,
+* so we do not use the outer edges of the blob.
+* A pixel is inside blob L after the erosion if all labels in its erosion window are L, so the min (erode) and max (dilate)
+* of the label image are both L. This is done once for all blobs on the area they cover, in a reused buffer, followed by
+* a single pass over the edges.
+*/
+void HandDetector::getEdgeData(std::vector<BlobInformation>& blobs, cv::Mat& edges, std::vector<BlobEdgeData>& data) {
+	int kernelSize = 6;
+	data.assign(blobs.size(), BlobEdgeData());
+	if (blobs.size() == 0)
+		return;
+
+	// map the labels to the blobs and get the area they cover, with a margin for the erosion.
+	cv::Rect area = blobs[0].rect;
+	int maxLabel = 0;
+	for (int i = 0; i < blobs.size(); i++) {
+		data[i].index = i;
+		data[i].size = blobs[i].area;
+		data[i].edgeCount = 0;
+		area |= blobs[i].rect;
+		maxLabel = std::max(maxLabel, blobs[i].label);
+	}
+	area = inflateRect(area, kernelSize, this->blobLabels);
+	std::vector<int>& blobOfLabel = this->blobOfLabel;
+	blobOfLabel.assign(maxLabel + 1, -1);
+	for (int i = 0; i < blobs.size(); i++) {
+		// labels above the 16 bit range saturate, these blobs are not counted.
+		if (blobs[i].label < 65535)
+			blobOfLabel[blobs[i].label] = i;
+	}
+
+	// the scratch buffers are frame sized and allocated once, we only use the area of the blobs.
+	this->edgeLabels.create(this->blobLabels.rows, this->blobLabels.cols, CV_16U);
+	this->edgeLabelsMin.create(this->blobLabels.rows, this->blobLabels.cols, CV_16U);
+	this->edgeLabelsMax.create(this->blobLabels.rows, this->blobLabels.cols, CV_16U);
+	cv::Mat labels = this->edgeLabels(area);
+	cv::Mat labelsMin = this->edgeLabelsMin(area);
+	cv::Mat labelsMax = this->edgeLabelsMax(area);
+	this->blobLabels(area).convertTo(labels, CV_16U);
+
+	cv::Mat kernel = getCachedStructuringElement(cv::MORPH_RECT, kernelSize);
+	cv::erode(labels, labelsMin, kernel);
+	cv::dilate(labels, labelsMax, kernel);
+
+	// count the edges per blob
+	for (int y = 0; y < area.height; y++) {
+		const uchar* edgeRow = edges.ptr<uchar>(area.y + y) + area.x;
+		const ushort* minRow = labelsMin.ptr<ushort>(y);
+		const ushort* maxRow = labelsMax.ptr<ushort>(y);
+		for (int x = 0; x < area.width; x++) {
+			if (edgeRow[x] != 0 && minRow[x] == maxRow[x] && minRow[x] != 0 && minRow[x] <= maxLabel) {
+				int blob = blobOfLabel[minRow[x]];
+				if (blob >= 0)
+					data[blob].edgeCount++;
+			}
+		}
+	}
+}
+
 /*
 * We have N blobs, based on position and edgecount we estimate the location of the hands
 */
 void HandDetector::updateHandsFromNBlobsWithAnalysis(std::vector<BlobInformation>& blobs, cv::Mat& edges) {
-	std::vector<BlobEdgeData> allBlobs;
-	std::vector<BlobEdgeData> possibleHands;
+	std::vector<BlobEdgeData>& allBlobs = this->allBlobs;
+	std::vector<BlobEdgeData>& possibleHands = this->possibleHands;
+	allBlobs.clear();
+	possibleHands.clear();
 
 	int maxEdgeCount = 0;
-	int handEdgeThreshold = 200; // we assume a hand has at least some edges due to fingers, nails, shadows etc.
+	int handEdgeThreshold = this->parameters.handEdgeThreshold; // we assume a hand has at least some edges due to fingers, nails, shadows etc.
 	double averageSize = 0;
 
 	// get the data (size & edgecount) for all blobs.
+	std::vector<BlobEdgeData>& edgeData = this->edgeData;
+	this->getEdgeData(blobs, edges, edgeData);
 	for (int i = 0; i < blobs.size(); i++) {
-		BlobEdgeData data = getEdgeData(blobs[i], edges);
-		data.index = i;
+		BlobEdgeData& data = edgeData[i];
 		averageSize += data.size;
 		maxEdgeCount = std::max(maxEdgeCount, data.edgeCount);
 
@@ -541,7 +714,8 @@ void HandDetector::updateHandsFromNBlobsWithAnalysis(std::vector<BlobInformation
 	}
 	else if (possibleHands.size() > 2) {
 		// fall back to sorting by position.
-		std::vector<BlobInformation> subset;
+		std::vector<BlobInformation>& subset = this->blobSubset;
+		subset.clear();
 		for (int i = 0; i < possibleHands.size(); i++) {
 			subset.push_back(blobs[possibleHands[i].index]);
 		}
@@ -1,15 +1,10 @@
 #pragma once
 #include "MercuryCore.h"
-
-enum SearchMode {
-	FREE_SEARCH, 
-	SEARCH_DOWN, 
-	SEARCH_STRICT_LEFT, 
-	SEARCH_LEFT, 
-	SEARCH_STRICT_RIGHT,
-	SEARCH_RIGHT,
-	SEARCH_UP   
-};
+#include "CoverageMap.h"
+#include "CoverageSearch.h"
+#include "DebugSink.h"
+#include "OpticalFlowContext.h"
+#include "FramePool.h"
 
 enum BlobType {
 	BOTTOM_CLIPPED,
@@ -32,22 +27,26 @@ struct BlobEdgeData {
 
 struct BlobInformation {
 	int index;
+	int label;                      // label of the blob in HandDetector::blobLabels
+	int area;                       // in pixels
+	cv::Rect rect;                  // bounding box
 	cv::Point left;
 	cv::Point right;
 	cv::Point top;
 	cv::Point bottom;
 	cv::Point center;
 	BlobType type;
-	std::vector<cv::Point> contour;
+	std::vector<cv::Point> contour; // empty until HandDetector::getContour is called
 };
 
 class Hand {
+	friend class HandBenchmark; // the benchmarks time the private search kernels
 public:
 	double maxVelocity = 100; // 100 cm / second
 	cv::Point position;
 	cv::Point blobEstimate;
 	cv::Scalar color;
-	cv::Mat* rgbSkinMask; // for debug
+	DebugSink* debug;
 	bool estimateUpdated = false;
 	bool invalidState = false;
 	bool ignoreState = false;
@@ -63,7 +62,6 @@ public:
 	std::vector<cv::Point2f> opticalFlowPointsPrev, opticalFlowPoints;
 	std::vector<uchar> opticalFlowStatus;
 	std::vector<bool> opticalFlowSuccess;
-	cv::Mat opticalFlowErr;
 	cv::Point opticalFlowPoint;
 
 	std::vector<cv::Point> positionHistory;
@@ -71,6 +69,13 @@ public:
 
 	int historySize = 50;
 
+	// iterations of the local searches. searchEffort scales all of them, the latency scheduler lowers it.
+	int coverageSearchIterations = 5;
+	int directionSearchIterations = 20;
+	int areaSearchIterations = 10;
+	double searchEffort = 1.0;
+	CoverageSearch coverageSearch;
+
 	Hand();
 	~Hand();
 	
@@ -81,12 +86,16 @@ public:
 	// handle intersections
 	bool isClose(cv::Point& otherHandPosition, bool drawDebug = false);
 	bool isIntersecting(cv::Point& otherHandPosition);
-	void handleIntersection(cv::Point& otherHandPosition, cv::Mat& skinMask);
+	void handleIntersection(cv::Point& otherHandPosition, CoverageMap& skinCoverage);
 	void setInvalideState();
 	
 	// solve and finalize the positions. The handling of intersections is in between this
-	void solve(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask, std::vector<BlobInformation>& blobs, cv::Mat& movementMap);
-	void finalize(cv::Mat& skinMask, cv::Mat& movementMap);
+	// optical flow. The trackers of both hands are deployed first, then tracked together by the hand detector.
+	bool needsOpticalFlow();
+	void deployOpticalFlowTrackers(cv::Mat& skinMask);
+
+	void solve(CoverageMap& skinCoverage, std::vector<BlobInformation>& blobs, CoverageMap& movementCoverage);
+	void finalize(CoverageMap& skinCoverage, CoverageMap& movementCoverage);
 
 	// draw on canvas.
 	void addResultToMask(cv::Mat& canvas);
@@ -96,41 +105,47 @@ public:
 
 private:
 	SearchMode getSearchModeFromBlobs(std::vector<BlobInformation>& blobs);
-	bool improveByAreaSearch(cv::Mat& skinMask, cv::Mat& movementMap, cv::Point& position);
-	void improveByCoverage(cv::Mat& skinMask, SearchMode searchMode, int maxIterations, int colorBase = 255);
-	void improveByDirection(cv::Mat& skinMask, SearchMode searchMode, int maxIterations, int colorBase = 255);
-	void improveUsingHistory(cv::Mat& skinMask, cv::Mat& movementMap);
+	bool improveByAreaSearch(CoverageMap& skinCoverage, cv::Point& position);
+	void improveByCoverage(CoverageMap& skinCoverage, SearchMode searchMode, int maxIterations, int colorBase = 255);
+	void improveByDirection(CoverageMap& skinCoverage, SearchMode searchMode, int maxIterations, int colorBase = 255);
+	void improveUsingHistory(CoverageMap& movementCoverage);
 	void improvePreviousPoint();
 
 	// prediction
-	cv::Point getPredictedPosition(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask);
-	cv::Point getEstimateByOpticalFlow(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& skinMask, cv::Point& lastPosition);
+	cv::Point getPredictedPosition(CoverageMap& skinCoverage);
+	cv::Point getEstimateByOpticalFlow(cv::Point& lastPosition);
 	
 	// util
+	int getIterations(int iterations);
 	int getNextIndex(int index);
 	int getPreviousIndex(int index);
-	double getPointQuality(cv::Point& point, cv::Mat& skinMask, int radius = 0);
-	double getCoverage(cv::Point& pos, cv::Mat& skinMask, int radius);
+	double getPointQuality(cv::Point& point, CoverageMap& quality, int radius = 0);
+	double getCoverage(cv::Point& pos, CoverageMap& coverage, SearchSpace& space, int radius);
 	cv::Point lookAround(cv::Point start,
-		cv::Mat& skinMask,
+		CoverageMap& coverage,
 		int maxIterations,
 		int stepSize,
 		int radius, // in cm
 		SearchMode searchMode,
 		int colorBase = 255
 		);
-	double shiftPosition(
-		cv::Mat& skinMask,
-		cv::Point& newPosition,
-		cv::Point& basePosition,
-		int xOffset,
-		int yOffset,
-		int radius
-	);
 	
 
 };
 
+/*
+* The tunable thresholds of the hand detection, see HandDetector::setParameters. The parameter sweeps replay the hand
+* detection with many sets of these, see SweepRunner.
+*/
+struct HandParameters {
+	double minContourSize = 6;          // cm, blobs smaller than this squared are not hands
+	int handEdgeThreshold = 200;        // edges a blob needs to be taken as a possible hand
+	double faceMaskThreshold = 0.01;    // change of the face blob area, relative to its average, that updates the face mask
+	int coverageSearchIterations = 5;   // the local searches of both hands, see Hand
+	int directionSearchIterations = 20;
+	int areaSearchIterations = 10;
+};
+
 class HandDetector {
 public:
 	Hand leftHand;
@@ -139,25 +154,48 @@ public:
 	int centerX;
 	cv::Rect region1;
 
-	int frameWidth;
-	int frameHeight;
+	int frameWidth = 0;
+	int frameHeight = 0;
 	int fps = 25;
 	double cmInPixels;
 
 	cv::Mat skinMask;
 	cv::Mat faceMask;
-	cv::Mat rgbSkinMask;
+	std::vector<BlobInformation> blobs; // the blobs of this frame, classified by detect
+	cv::Mat blobLabels;           // CV_32S connected components of the filled skin mask of this frame
+	cv::Mat blobStats;            // per label statistics and centroids of blobLabels
+	cv::Mat blobCentroids;
+	cv::Mat edgeLabels;           // CV_16U scratch buffers for the edge counting, see getEdgeData
+	cv::Mat edgeLabelsMin;
+	cv::Mat edgeLabelsMax;
+	std::vector<int> blobOfLabel; // blob index per label, see getEdgeData
+	cv::Mat blobMaskBuffer;       // CV_8U scratch of getBlobMask, frame sized
+	std::vector<std::vector<cv::Point>> contours; // scratch of findContours in extractBlobs and getContour
+	CoverageMap skinCoverage;     // rebuilt every frame, shared by both hands
+	CoverageMap movementCoverage; // rebuilt every frame, shared by both hands
+	DebugSink debugSink; // draws the debug map. Compiles to nothing without DEBUG.
+	OpticalFlowContext opticalFlow; // pyramids of gray and grayPrev, shared by both hands
 	int faceMaskAverageArea = 0;
+	FramePool* framePool = nullptr; // scratch buffers of the detection, plain allocations if not set
+	HandParameters parameters;
 
 	HandDetector(int fps);
 	~HandDetector();
 	
 	void reset();
 	void addResultToMask(cv::Mat& canvas);
-	void detect(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& face, cv::Mat& skinMask, cv::Mat& movementMap, cv::Mat& edges, double pixelSizeInCm);
+	void extractBlobs(cv::Mat& skinMask, double minArea, std::vector<BlobInformation>& blobs, cv::Rect searchArea = cv::Rect());
+	std::vector<cv::Point>& getContour(BlobInformation& blob);
+	void drawBlob(cv::Mat& canvas, BlobInformation& blob, cv::Scalar color);
+	void getEdgeData(std::vector<BlobInformation>& blobs, cv::Mat& edges, std::vector<BlobEdgeData>& data);
+	void detect(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& face, cv::Mat& skinMask, cv::Mat& movementMap, cv::Mat& edges, double pixelSizeInCm, cv::Rect area = cv::Rect());
+	void skip();
 	void draw(cv::Mat& canvas);
 	void drawTraces(cv::Mat& canvas);
 	void show(std::string windowName = "debugMapHands");
+	void setDebugDrawing(bool enabled);
+	void setSearchEffort(double effort);
+	void setParameters(HandParameters& parameters);
 	void setVideoProperties(int frameWidth, int frameHeight);
 
 private:
@@ -169,6 +207,22 @@ private:
 	void updateHandsFromNBlobsByPosition(std::vector<BlobInformation>& blobs, bool ignoreIntersection = false);
 	void updateHandsFromNBlobsWithAnalysis(std::vector<BlobInformation>& blobs, cv::Mat& edges);
 	void handleIntersections();
+	void trackHands(cv::Mat& gray, cv::Mat& grayPrev);
+	void getExtremePoints(BlobInformation& blob);
+	cv::Mat getBlobMask(BlobInformation& blob);
+
+	/* scratch of detect and the blob analysis, kept so their capacity is reused every frame */
+	std::vector<BlobInformation> lowerBodyBlobs;
+	std::vector<BlobInformation> midBodyBlobs;
+	std::vector<BlobInformation> highBlobs;
+	std::vector<BlobInformation> blobPair;
+	std::vector<BlobInformation> blobSubset;
+	std::vector<BlobEdgeData> edgeData;
+	std::vector<BlobEdgeData> allBlobs;
+	std::vector<BlobEdgeData> possibleHands;
+	std::vector<cv::Point2f> flowPointsPrev; // the points of both hands, tracked in one call
+	std::vector<cv::Point2f> flowPoints;
+	std::vector<uchar> flowStatus;
 };
 
-double getDistance(cv::Point& p1, cv::Point& p2);
\ No newline at end of file
+double getDistance(cv::Point& p1, cv::Point& p2);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "LatencyScheduler.h"
+
+LatencyScheduler::LatencyScheduler() {}
+LatencyScheduler::~LatencyScheduler() {}
+
+void LatencyScheduler::setBudget(double budget) {
+	this->budget = budget;
+}
+
+/*
+* Use the frame time of the video as budget, 40 ms at 25 fps.
+*/
+void LatencyScheduler::setFps(int fps) {
+	this->budget = 1000.0 / std::max(1, fps);
+}
+
+/*
+* Report the processing time of a frame in ms. Returns true if the quality level changed.
+*/
+bool LatencyScheduler::update(double duration) {
+	this->latency = this->latency == 0 ? duration : (1 - this->smoothing) * this->latency + this->smoothing * duration;
+
+	// the step up to the full frame height needs the headroom for the larger frames, the time of the per pixel
+	// stages grows with the area
+	double stepUpLatency = this->headroom * this->budget;
+	int stepUpFrames = this->stepUpFrames;
+	if (this->isResolutionLevel(this->level)) {
+		double scale = std::min(1.0, double(this->reducedFrameHeight) / this->frameHeightMax);
+		stepUpLatency *= scale * scale;
+		stepUpFrames = this->resolutionStepUpFrames;
+	}
+
+	if (this->latency > this->budget) {
+		this->overBudget++;
+		this->underBudget = 0;
+	}
+	else if (this->latency < stepUpLatency) {
+		this->underBudget++;
+		this->overBudget = 0;
+	}
+	else {
+		this->overBudget = 0;
+		this->underBudget = 0;
+	}
+
+	if (this->overBudget >= this->stepDownFrames && this->level < this->maxLevel) {
+		this->setLevel(this->level + 1);
+		return true;
+	}
+	if (this->underBudget >= stepUpFrames && this->level > 0) {
+		this->setLevel(this->level - 1);
+		return true;
+	}
+	return false;
+}
+
+/*
+* Go to a level. The smoothed latency is restarted as the frames of the new level will have other timings.
+*/
+void LatencyScheduler::setLevel(int level) {
+	this->level = std::max(0, std::min(this->maxLevel, level));
+	this->latency = 0;
+	this->overBudget = 0;
+	this->underBudget = 0;
+}
+
+int LatencyScheduler::getLevel() {
+	return this->level;
+}
+
+double LatencyScheduler::getLatency() {
+	return this->latency;
+}
+
+QualitySettings LatencyScheduler::getSettings() {
+	QualitySettings settings;
+	settings.level = this->level;
+	settings.frameHeightMax = this->frameHeightMax;
+	if (this->level >= 1)
+		settings.faceDetectionInterval = 5;
+	if (this->level >= 2)
+		settings.detectEdges = false;
+	if (this->level >= 3)
+		settings.searchEffort = 0.5;
+	if (this->level >= 4)
+		settings.frameHeightMax = std::min(this->frameHeightMax, this->reducedFrameHeight);
+	if (this->level >= 5)
+		settings.framesToDrop = 1;
+	return settings;
+}
+
+void LatencyScheduler::reset() {
+	this->setLevel(0);
+}
+
+//***************************************** PRIVATE  **********************************************//
+
+/*
+* The lowest level with the reduced frame height, stepping up from it changes the frame size.
+*/
+bool LatencyScheduler::isResolutionLevel(int level) {
+	return level == 4;
+}
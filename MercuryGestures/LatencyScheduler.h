@@ -0,0 +1,61 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* What the pipeline should do at a quality level.
+*/
+struct QualitySettings {
+	int level = 0;
+	int faceDetectionInterval = 1;  // run the cascade every n frames, track the face in between
+	bool detectEdges = true;        // otherwise the edges of the last frame where they were detected are used
+	double searchEffort = 1.0;      // scale of the search iterations of the hands
+	int frameHeightMax = 400;
+	int framesToDrop = 0;           // frames to skip before reading the next one, for live feeds
+};
+
+/*
+* Keeps the per frame latency within a budget by trading quality for time. Every frame reports its processing
+* time. If the smoothed latency stays over the budget the scheduler steps down one quality level, if there is
+* enough headroom for a while it steps back up. Every level adds one degradation to the ones before it:
+*  0 full quality
+*  1 the face cascade only runs every few frames
+*  2 skip the edge detection
+*  3 fewer search iterations for the hands
+*  4 lower frame height
+*  5 drop stale frames
+* Changing the frame height restarts the face and hand tracking, so stepping back up from level 4 waits longer and
+* needs the headroom for the larger frames, otherwise the scheduler would step between 3 and 4 every few seconds.
+*/
+class LatencyScheduler {
+public:
+	double budget = 40;            // ms per frame
+	double headroom = 0.7;         // step up when the latency is below this part of the budget
+	int stepDownFrames = 5;        // frames over budget before stepping down
+	int stepUpFrames = 50;         // frames with headroom before stepping up
+	int resolutionStepUpFrames = 250; // the same for the step up to the full frame height
+	double smoothing = 0.2;        // weight of the new frame in the smoothed latency
+	int frameHeightMax = 400;      // the full quality frame height
+	int reducedFrameHeight = 300;
+	int maxLevel = 5;
+
+	LatencyScheduler();
+	~LatencyScheduler();
+
+	void setBudget(double budget);
+	void setFps(int fps);
+	bool update(double duration);
+	void setLevel(int level);
+	int getLevel();
+	double getLatency();
+	QualitySettings getSettings();
+	void reset();
+
+private:
+	int level = 0;
+	double latency = 0;
+	int overBudget = 0;
+	int underBudget = 0;
+
+	bool isResolutionLevel(int level);
+};
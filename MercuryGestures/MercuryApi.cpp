@@ -0,0 +1,179 @@
+#pragma once
+#include "MercuryCore.h"
+#include "MercuryApi.h"
+#include "Pipeline.h"
+#include <cstring>
+
+/*
+* A context is a headless pipeline on one feed.
+*/
+struct MercuryContext {
+	Pipeline pipeline;
+	PipelineResult result;
+	CapturedFrame captured;
+
+	MercuryContext(int fps) : pipeline(fps, true) {}
+};
+
+static MercuryPoint toPoint(cv::Point& point) {
+	MercuryPoint converted = { point.x, point.y };
+	return converted;
+}
+
+static MercuryRect toRect(cv::Rect& rect) {
+	MercuryRect converted = { rect.x, rect.y, rect.width, rect.height };
+	return converted;
+}
+
+/*
+* The pipeline works on the resized frame, the host gets the positions in pixels of the frame it pushed.
+*/
+static void toResult(PipelineResult& source, double scale, MercuryResult* result) {
+	result->frameIndex = source.frameIndex;
+	result->timestamp = source.timestamp;
+	result->faceDetected = source.faceDetected ? 1 : 0;
+	result->valid = source.valid ? 1 : 0;
+	result->movement = source.movementValue;
+	result->movementFiltered = source.movementFilteredValue;
+	result->ROImovement = source.ROImovementValue;
+	result->ROImovementFiltered = source.ROImovementFilteredValue;
+	cv::Point leftHand = source.leftHand * scale;
+	cv::Point rightHand = source.rightHand * scale;
+	cv::Rect face(source.face.tl() * scale, source.face.br() * scale);
+	result->leftHand = toPoint(leftHand);
+	result->rightHand = toPoint(rightHand);
+	result->face = toRect(face);
+	result->cmInPixels = source.cmInPixels * scale;
+	result->duration = source.duration;
+	result->latency = source.latency;
+
+	result->subjectCount = std::min(source.subjectCount, MERCURY_MAX_SUBJECTS);
+	for (int i = 0; i < result->subjectCount; i++) {
+		SubjectSummary& summary = source.subjects[i];
+		MercurySubject& subject = result->subjects[i];
+		cv::Point subjectLeft = summary.leftHand * scale;
+		cv::Point subjectRight = summary.rightHand * scale;
+		cv::Rect subjectFace(summary.face.tl() * scale, summary.face.br() * scale);
+		subject.id = summary.id;
+		subject.valid = summary.valid ? 1 : 0;
+		subject.face = toRect(subjectFace);
+		subject.leftHand = toPoint(subjectLeft);
+		subject.rightHand = toPoint(subjectRight);
+		subject.movement = summary.movementValue;
+		subject.ROImovement = summary.ROImovementValue;
+		subject.ROImovementFiltered = summary.ROImovementFilteredValue;
+	}
+}
+
+int mercury_api_version(void) {
+	return MERCURY_API_VERSION;
+}
+
+void mercury_default_options(MercuryOptions* options) {
+	if (options == nullptr)
+		return;
+	options->fps = 25;
+	options->frameHeight = 400;
+	options->cascadePath = nullptr;
+	options->latencyBudget = 0;
+	options->incremental = 0;
+	options->bodyRegionOnly = 0;
+	options->useOpenCL = 0;
+	options->maxSubjects = 1;
+}
+
+void mercury_default_extended_options(MercuryExtendedOptions* options) {
+	if (options == nullptr)
+		return;
+	options->size = sizeof(MercuryExtendedOptions);
+	mercury_default_options(&options->base);
+	options->fastFaceDetection = 0;
+	options->asynchronousFaceDetection = 0;
+}
+
+MercuryContext* mercury_create(const MercuryOptions* options) {
+	MercuryExtendedOptions settings;
+	mercury_default_extended_options(&settings);
+	if (options != nullptr)
+		settings.base = *options;
+	return mercury_create_extended(&settings);
+}
+
+/*
+* Only the part of the options the host knows is copied, a host built against an older header passes a smaller struct.
+*/
+MercuryContext* mercury_create_extended(const MercuryExtendedOptions* options) {
+	MercuryExtendedOptions extended;
+	mercury_default_extended_options(&extended);
+	if (options != nullptr) {
+		if (options->size < sizeof(size_t))
+			return nullptr;
+		std::memcpy(&extended, options, std::min(options->size, sizeof(MercuryExtendedOptions)));
+		extended.size = sizeof(MercuryExtendedOptions);
+	}
+	MercuryOptions& settings = extended.base;
+
+	MercuryContext* context = nullptr;
+	try {
+		context = new MercuryContext(std::max(1, settings.fps));
+		Pipeline& pipeline = context->pipeline;
+		if (settings.cascadePath != nullptr)
+			pipeline.faceDetector.face_cascade_name = settings.cascadePath;
+		if (pipeline.setup() == false) {
+			delete context;
+			return nullptr;
+		}
+		if (settings.frameHeight > 0)
+			pipeline.frameHeightMax = settings.frameHeight;
+		pipeline.setLatencyBudget(settings.latencyBudget);
+		pipeline.incremental = settings.incremental != 0;
+		pipeline.bodyRegionOnly = settings.bodyRegionOnly != 0;
+		pipeline.setOpenCL(settings.useOpenCL != 0);
+		pipeline.setMaxSubjects(settings.maxSubjects);
+		pipeline.faceDetector.setFastDetection(extended.fastFaceDetection != 0);
+		pipeline.faceDetector.setAsynchronous(extended.asynchronousFaceDetection != 0);
+	}
+	catch (std::exception& e) {
+		std::cerr << "mercury_create: " << e.what() << std::endl;
+		delete context;
+		return nullptr;
+	}
+	return context;
+}
+
+void mercury_destroy(MercuryContext* context) {
+	delete context;
+}
+
+int mercury_push_frame(MercuryContext* context, const unsigned char* bgr, int width, int height, int stride,
+	long long timestamp, MercuryResult* result) {
+	if (context == nullptr || bgr == nullptr || result == nullptr || width <= 0 || height <= 0 || stride < width * 3)
+		return MERCURY_ERROR_ARGUMENT;
+
+	// a header on the buffer of the host, the pipeline only reads it while resizing into its own buffers.
+	CapturedFrame& captured = context->captured;
+	captured.image = cv::Mat(height, width, CV_8UC3, (void*)bgr, stride);
+	captured.timestamp = timestamp != 0 ? timestamp : getTimestamp();
+	captured.dropped = 0;
+
+	try {
+		bool processed = context->pipeline.process(captured, context->result);
+		captured.image.release();
+		if (processed == false)
+			return MERCURY_ERROR_FAILED;
+	}
+	catch (std::exception& e) {
+		std::cerr << "mercury_push_frame: " << e.what() << std::endl;
+		captured.image.release();
+		return MERCURY_ERROR_FAILED;
+	}
+
+	double scale = height / double(context->pipeline.frameHeight);
+	toResult(context->result, scale, result);
+	return MERCURY_OK;
+}
+
+void mercury_reset(MercuryContext* context) {
+	if (context != nullptr)
+		context->pipeline.reset();
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+/*
+* The C interface of the mercury_core library, to embed the detectors in a capture host without a separate process.
+*
+* The host creates a context per video feed and pushes its frames in order. A frame is a borrowed BGR buffer, it is
+* only read during mercury_push_frame and not copied: the pipeline resizes it straight into its own buffers. The
+* buffer can be reused by the host as soon as the call returns. A context must only be used by one thread at a time,
+* different contexts are independent.
+*
+* This header is plain C and the structs only hold plain values, so the layout stays the same between builds. The
+* layout of MercuryOptions is that of version 1 and does not change. Later settings are only ever added at the end of
+* MercuryExtendedOptions, whose size field tells the library which of them the host knows. Check mercury_api_version
+* against MERCURY_API_VERSION.
+*/
+
+#include <stddef.h>
+
+#if defined(MERCURY_STATIC)
+#define MERCURY_API
+#elif defined(_WIN32)
+#if defined(MERCURY_BUILD_SHARED)
+#define MERCURY_API __declspec(dllexport)
+#else
+#define MERCURY_API __declspec(dllimport)
+#endif
+#else
+#define MERCURY_API __attribute__((visibility("default")))
+#endif
+
+#define MERCURY_API_VERSION 3
+
+#define MERCURY_OK 0
+#define MERCURY_ERROR_ARGUMENT -1	/* a null pointer, or a buffer that is too small for its size */
+#define MERCURY_ERROR_FAILED -2		/* the detectors failed on the frame */
+
+#define MERCURY_MAX_SUBJECTS 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct MercuryContext MercuryContext;
+
+typedef struct MercuryPoint {
+	int x;
+	int y;
+} MercuryPoint;
+
+typedef struct MercuryRect {
+	int x;
+	int y;
+	int width;
+	int height;
+} MercuryRect;
+
+/*
+* The settings of a context, see mercury_default_options for the defaults.
+*/
+typedef struct MercuryOptions {
+	int fps;					/* frame rate of the feed, the movement values are averaged over a second */
+	int frameHeight;			/* the height the frames are resized to before the detection */
+	const char* cascadePath;	/* the face cascade xml, null for the one in ./dependencies */
+	double latencyBudget;		/* ms per frame, 0 to always run at full quality */
+	int incremental;			/* only process the parts of the frame that changed */
+	int bodyRegionOnly;			/* once the face is locked only process the region the hands can be in */
+	int useOpenCL;				/* run the per pixel stages on the OpenCL device, if there is one */
+	int maxSubjects;			/* more than 1 tracks every face in the frame */
+} MercuryOptions;
+
+/*
+* The settings of version 2 and later, see mercury_create_extended. Fields the host does not know, past its size, keep
+* their defaults.
+*/
+typedef struct MercuryExtendedOptions {
+	size_t size;				/* sizeof(MercuryExtendedOptions) of the host, set by mercury_default_extended_options */
+	MercuryOptions base;
+	int fastFaceDetection;		/* run the face cascade downscaled and only at the size of the locked face (version 2) */
+	int asynchronousFaceDetection;	/* run the face cascade on a thread of the context, tracking the face in between (version 3) */
+} MercuryExtendedOptions;
+
+/*
+* The values of one subject of the multi subject mode.
+*/
+typedef struct MercurySubject {
+	int id;
+	int valid;
+	MercuryRect face;
+	MercuryPoint leftHand;
+	MercuryPoint rightHand;
+	double movement;
+	double ROImovement;
+	double ROImovementFiltered;
+} MercurySubject;
+
+/*
+* The values of a single frame. Positions are in pixels of the pushed frame.
+*/
+typedef struct MercuryResult {
+	int frameIndex;
+	long long timestamp;		/* capture time in us since the epoch */
+	int faceDetected;
+	int valid;					/* the movement and hand values have been calculated for this frame */
+	double movement;			/* skin masked movement */
+	double movementFiltered;
+	double ROImovement;			/* the value to publish to SSI */
+	double ROImovementFiltered;
+	MercuryPoint leftHand;
+	MercuryPoint rightHand;
+	MercuryRect face;
+	double cmInPixels;
+	double duration;			/* processing time in ms */
+	double latency;				/* ms from the capture of the frame to this result */
+	int subjectCount;			/* multi subject mode, the values above are those of the first subject */
+	MercurySubject subjects[MERCURY_MAX_SUBJECTS];
+} MercuryResult;
+
+MERCURY_API int mercury_api_version(void);
+MERCURY_API void mercury_default_options(MercuryOptions* options);
+MERCURY_API void mercury_default_extended_options(MercuryExtendedOptions* options);
+
+/* Returns null if the face cascade cannot be loaded. options can be null for the defaults. */
+MERCURY_API MercuryContext* mercury_create(const MercuryOptions* options);
+
+/* The same with the settings of version 2 and later. Returns null if the size of the options is not set. */
+MERCURY_API MercuryContext* mercury_create_extended(const MercuryExtendedOptions* options);
+MERCURY_API void mercury_destroy(MercuryContext* context);
+
+/*
+* Run the detectors on the next frame of the feed. stride is the size of a row in bytes, at least width * 3. timestamp
+* is the capture time in us since the epoch, 0 to use the time of the call.
+*/
+MERCURY_API int mercury_push_frame(MercuryContext* context, const unsigned char* bgr, int width, int height, int stride,
+	long long timestamp, MercuryResult* result);
+
+/* Forget the face lock and the hands, for a cut in the feed. */
+MERCURY_API void mercury_reset(MercuryContext* context);
+
+#ifdef __cplusplus
+}
+#endif
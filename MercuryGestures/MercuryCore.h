@@ -6,7 +6,11 @@
 #include <ctime>
 #include <stdio.h>
 
+// Debug drawing (see DebugSink.h) is only compiled in when DEBUG is defined. Debug configurations define it through _DEBUG,
+// other builds can turn it on with -DDEBUG (cmake -DMERCURY_DEBUG=ON).
+#if defined(_DEBUG) && !defined(DEBUG)
 #define DEBUG
+#endif
 
 // based on // https://upload.wikimedia.org/wikipedia/commons/6/61/HeadAnthropometry.JPG
 const double averageFaceWidth = 15.705; //cm (95th percentile)
@@ -50,7 +54,7 @@ int rgbBound(int color);
 /**
  * get the average value of a vector.
  */
-double getAverage(std::vector<double> data);
+double getAverage(const std::vector<double>& data);
 
 /* 
  * Join two strings together.
@@ -93,4 +97,34 @@ void fromSearchSpace(SearchSpace& space, cv::Point2f& point);
 double getDistance(cv::Point& p1, cv::Point& p2);
 void rect(cv::Mat& mat, cv::Point point, int radius, cv::Scalar color, int thickness);
 
-cv::Rect inflateRect(cv::Rect& rectangle, int inflation, cv::Mat& boundary);
\ No newline at end of file
+cv::Rect inflateRect(cv::Rect& rectangle, int inflation, cv::Mat& boundary);
+
+/*
+ * set everything of the mat outside of the area to 0.
+ */
+void clearOutside(cv::Mat& mat, cv::Rect& area);
+
+/*
+ * the expected position of the body parts based on the detected face.
+ */
+void getBodyRect(cv::Rect& detectedFace, BodyRects& body);
+
+/*
+ * get the fps from the video, defaults to 25 if the video does not report a usable value.
+ */
+int getFps(cv::VideoCapture& cap);
+
+/*
+ * the wall clock time in microseconds since the epoch, used to timestamp the frames.
+ */
+long long getTimestamp();
+
+/*
+ * open a video file, stream url or camera index.
+ */
+bool openSource(cv::VideoCapture& cap, std::string source);
+
+/*
+ * read the entries of a list file, one per line. Empty lines and # comments are skipped.
+ */
+bool readList(std::string path, std::vector<std::string>& entries);
\ No newline at end of file
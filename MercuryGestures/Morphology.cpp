@@ -0,0 +1,204 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Morphology.h"
+#include <limits>
+#include <map>
+#include <mutex>
+
+namespace {
+	template <typename T>
+	struct MaximumOf {
+		T operator()(T a, T b) const { return std::max(a, b); }
+	};
+
+	template <typename T>
+	struct MinimumOf {
+		T operator()(T a, T b) const { return std::min(a, b); }
+	};
+
+	/*
+	* The row pass on one line of length values: running values forwards and backwards through every block of the
+	* kernel size, walked block by block, then every window from the end of one block and the start of the next. The
+	* line is kept in the type of the image, bytes for masks.
+	*/
+	template <typename T, typename Combine>
+	void filterLine(const T* values, T* forward, T* backward, T* out, int length, int width, int size, Combine combine) {
+		for (int start = 0; start < length; start += size) {
+			int end = std::min(start + size, length);
+			forward[start] = values[start];
+			for (int i = start + 1; i < end; i++)
+				forward[i] = combine(forward[i - 1], values[i]);
+			backward[end - 1] = values[end - 1];
+			for (int i = end - 2; i >= start; i--)
+				backward[i] = combine(backward[i + 1], values[i]);
+		}
+		const T* windowEnd = forward + size - 1;
+		for (int x = 0; x < width; x++)
+			out[x] = combine(backward[x], windowEnd[x]);
+	}
+}
+
+cv::Mat getCachedStructuringElement(int shape, int size) {
+	static std::mutex mutex;
+	static std::map<std::pair<int, int>, cv::Mat> elements;
+	std::lock_guard<std::mutex> lock(mutex);
+	cv::Mat& element = elements[std::make_pair(shape, size)];
+	if (element.empty())
+		element = cv::getStructuringElement(shape, cv::Size(size, size));
+	return element;
+}
+
+/*
+* The part of the image the filter reads for the area. The kernel is anchored in its center like in OpenCV.
+*/
+cv::Rect getFilterSource(cv::Rect& area, int size, cv::Size imageSize) {
+	int anchor = size / 2;
+	cv::Rect source(area.x - anchor, area.y - anchor, area.width + size - 1, area.height + size - 1);
+	return source & cv::Rect(cv::Point(0, 0), imageSize);
+}
+
+Morphology::Morphology() {}
+Morphology::~Morphology() {}
+
+void Morphology::dilate(cv::Mat& input, cv::Mat& output, int size, cv::Rect area) {
+	this->filter(input, output, size, true, area);
+}
+
+void Morphology::erode(cv::Mat& input, cv::Mat& output, int size, cv::Rect area) {
+	this->filter(input, output, size, false, area);
+}
+
+/*
+* Dilate then erode, this closes the gaps in a mask. The erosion only needs the dilation around the area.
+*/
+void Morphology::close(cv::Mat& input, cv::Mat& output, int size, cv::Rect area) {
+	this->twice(input, output, size, true, area);
+}
+
+/*
+* Erode then dilate, this removes the specks from a mask.
+*/
+void Morphology::open(cv::Mat& input, cv::Mat& output, int size, cv::Rect area) {
+	this->twice(input, output, size, false, area);
+}
+
+void Morphology::twice(cv::Mat& input, cv::Mat& output, int size, bool maximumFirst, cv::Rect area) {
+	cv::Rect imageRect(0, 0, input.cols, input.rows);
+	area = area.area() == 0 ? imageRect : area & imageRect;
+	if (area.area() == 0)
+		return;
+	cv::Rect first = getFilterSource(area, size, input.size());
+	this->combined.create(input.rows, input.cols, input.type());
+	this->filter(input, this->combined, size, maximumFirst, first);
+	this->filter(this->combined, output, size, maximumFirst == false, area);
+}
+
+void Morphology::filter(cv::Mat& input, cv::Mat& output, int size, bool maximum, cv::Rect area) {
+	cv::Rect imageRect(0, 0, input.cols, input.rows);
+	area = area.area() == 0 ? imageRect : area & imageRect;
+	if (area.area() == 0)
+		return;
+	if (output.size() != input.size() || output.type() != input.type())
+		output.create(input.rows, input.cols, input.type());
+
+	if (size <= 1) {
+		if (output.data != input.data) {
+			cv::Mat target = output(area);
+			input(area).copyTo(target);
+		}
+		return;
+	}
+
+	// the row pass reads all of the input it needs before the column pass writes, so the output can be the input.
+	cv::Rect source = getFilterSource(area, size, input.size());
+	if (input.depth() == CV_16U)
+		this->filterRows<ushort>(input, source, area, size, maximum);
+	else
+		this->filterRows<uchar>(input, source, area, size, maximum);
+	this->filterColumns(output, source, area, size, maximum);
+}
+
+/*
+* Filter the rows of the source over the columns of the area. Outside of the image the border value is used, which never
+* wins: 0 for the max and the largest value for the min.
+*/
+template <typename T>
+void Morphology::filterRows(cv::Mat& input, cv::Rect& source, cv::Rect& area, int size, bool maximum) {
+	int anchor = size / 2;
+	int length = area.width + size - 1;
+	T borderValue = maximum ? 0 : std::numeric_limits<T>::max();
+	this->line.create(1, length, input.type());
+	this->lineForward.create(1, length, input.type());
+	this->lineBackward.create(1, length, input.type());
+	T* values = this->line.ptr<T>();
+	T* forward = this->lineForward.ptr<T>();
+	T* backward = this->lineBackward.ptr<T>();
+
+	this->rowPass.create(source.height, area.width, input.type());
+	// the line is the border on the left, the source columns and the border on the right
+	int first = area.x - anchor;
+	int left = std::min(length, std::max(0, -first));
+	int inside = std::max(0, std::min(length, input.cols - first) - left);
+	std::fill(values, values + left, borderValue);
+	std::fill(values + left + inside, values + length, borderValue);
+	for (int y = 0; y < source.height; y++) {
+		const T* in = input.ptr<T>(source.y + y) + first + left;
+		std::copy(in, in + inside, values + left);
+
+		T* out = this->rowPass.ptr<T>(y);
+		if (maximum)
+			filterLine(values, forward, backward, out, length, area.width, size, MaximumOf<T>());
+		else
+			filterLine(values, forward, backward, out, length, area.width, size, MinimumOf<T>());
+	}
+}
+
+/*
+* The same over the columns, on whole rows of the row pass at once.
+*/
+void Morphology::filterColumns(cv::Mat& output, cv::Rect& source, cv::Rect& area, int size, bool maximum) {
+	int anchor = size / 2;
+	int length = area.height + size - 1;
+	int type = this->rowPass.type();
+	double borderValue = maximum ? 0 : (type == CV_16U ? 65535 : 255);
+	this->border.create(1, area.width, type);
+	this->border.setTo(borderValue);
+	this->forward.create(length, area.width, type);
+	this->backward.create(length, area.width, type);
+
+	int first = area.y - anchor;
+	auto getRow = [&](int i) {
+		int y = first + i;
+		return y >= source.y && y < source.y + source.height ? this->rowPass.row(y - source.y) : this->border;
+	};
+
+	for (int i = 0; i < length; i++) {
+		cv::Mat values = getRow(i);
+		cv::Mat target = this->forward.row(i);
+		if (i % size == 0)
+			values.copyTo(target);
+		else if (maximum)
+			cv::max(this->forward.row(i - 1), values, target);
+		else
+			cv::min(this->forward.row(i - 1), values, target);
+	}
+	for (int i = length - 1; i >= 0; i--) {
+		cv::Mat values = getRow(i);
+		cv::Mat target = this->backward.row(i);
+		if (i == length - 1 || i % size == size - 1)
+			values.copyTo(target);
+		else if (maximum)
+			cv::max(this->backward.row(i + 1), values, target);
+		else
+			cv::min(this->backward.row(i + 1), values, target);
+	}
+
+	for (int y = 0; y < area.height; y++) {
+		cv::Mat target = output(cv::Rect(area.x, area.y + y, area.width, 1));
+		if (maximum)
+			cv::max(this->backward.row(y), this->forward.row(y + size - 1), target);
+		else
+			cv::min(this->backward.row(y), this->forward.row(y + size - 1), target);
+	}
+}
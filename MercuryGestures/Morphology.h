@@ -0,0 +1,51 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* Get a structuring element. They are made once per shape and size and shared by all threads.
+*/
+cv::Mat getCachedStructuringElement(int shape, int size);
+
+/*
+* The part of the image a filter of this size reads for the area.
+*/
+cv::Rect getFilterSource(cv::Rect& area, int size, cv::Size imageSize);
+
+/*
+* Dilation and erosion with a square kernel, like cv::dilate and cv::erode with a MORPH_RECT element of the same size
+* and the default anchor and border. The square is separable, so a row pass is followed by a column pass. Both are
+* van Herk/Gil-Werman: a running max (or min) forwards and backwards through blocks of the kernel size gives every
+* window with one comparison more, so the cost per pixel does not depend on the kernel size. The column pass combines
+* whole rows at a time with the vectorized cv::max and cv::min.
+*
+* With an area only that part of the output is written, and only the input around it is read. The Mat given is the
+* whole image: unlike the OpenCV filters nothing outside of a sub Mat is read. The output can be the input.
+* CV_8U masks and CV_16U label images are supported. The scratch buffers are kept, use one instance per thread.
+* The detectors still use cv::dilate and cv::erode, the bench measures this against them.
+*/
+class Morphology {
+public:
+	Morphology();
+	~Morphology();
+
+	void dilate(cv::Mat& input, cv::Mat& output, int size, cv::Rect area = cv::Rect());
+	void erode(cv::Mat& input, cv::Mat& output, int size, cv::Rect area = cv::Rect());
+	void close(cv::Mat& input, cv::Mat& output, int size, cv::Rect area = cv::Rect());
+	void open(cv::Mat& input, cv::Mat& output, int size, cv::Rect area = cv::Rect());
+
+private:
+	cv::Mat rowPass;    // the row pass, rows of the area with the margin of the column pass
+	cv::Mat forward;    // running values of the column pass
+	cv::Mat backward;
+	cv::Mat border;     // a row of the border value
+	cv::Mat combined;   // the first half of close and open
+	cv::Mat line;       // one row of the row pass with its border, in the type of the image
+	cv::Mat lineForward;
+	cv::Mat lineBackward;
+
+	void filter(cv::Mat& input, cv::Mat& output, int size, bool maximum, cv::Rect area);
+	void twice(cv::Mat& input, cv::Mat& output, int size, bool maximumFirst, cv::Rect area);
+	template <typename T> void filterRows(cv::Mat& input, cv::Rect& source, cv::Rect& area, int size, bool maximum);
+	void filterColumns(cv::Mat& output, cv::Rect& source, cv::Rect& area, int size, bool maximum);
+};
@@ -2,6 +2,7 @@
 
 #include "MercuryCore.h"
 #include "MovementDetector.h"
+#include <numeric>
 
 MovementDetector::MovementDetector(int fps) {
 	this->fps = fps;
@@ -12,31 +13,20 @@ MovementDetector::MovementDetector(int fps) {
 
 MovementDetector::~MovementDetector() {};
 
-/**
-* Calculate the movement and return a double between 0 .. 1
-* Thev value is clipped in this range and normalized using face detection.
+/*
+* Set the value from the amount of changed pixels, see MovementEngine. The filtered value is the average over the last
+* second, kept as a running sum. The sum is made again once per window so the rounding errors do not add up.
 */
-void MovementDetector::detect(cv::Mat& gray, cv::Mat& grayPrev) {
-	// get a value between 0 .. 1 to represent the amount of movement.
-	cv::Mat diff;
-	// get the amount of movement in this frame
-	cv::absdiff(gray, grayPrev, diff);
-	cv::threshold(diff, this->movementMap, 25, 255, 0);
-
-	cv::imshow("unfilteredMovement", diff);
-}
-
-void MovementDetector::mask(cv::Mat& mask) {
-	cv::bitwise_and(this->movementMap, mask, this->movementMap);
-}
-
-
-void MovementDetector::calculate(double normalizationFactor) {
-	this->value = std::min(this->maxMovement, std::max(0.0, (cv::sum(this->movementMap)[0] / 255.0) * normalizationFactor)) / maxMovement;
+void MovementDetector::update(int changedPixels, double normalizationFactor) {
+	this->value = std::min(this->maxMovement, std::max(0.0, changedPixels * normalizationFactor)) / maxMovement;
 
-	values[this->index%this->fps] = this->value;
+	int slot = this->index % this->fps;
+	this->valueSum += this->value - this->values[slot];
+	this->values[slot] = this->value;
+	if (slot == this->fps - 1)
+		this->valueSum = std::accumulate(this->values.begin(), this->values.end(), 0.0);
 
-	this->filteredValue = getAverage(values);
+	this->filteredValue = this->valueSum / this->fps;
 
 	this->index++;
 }
@@ -5,20 +5,19 @@
 
 class MovementDetector {
 public:
-	cv::Mat movementMap;
+	cv::Mat movementMap; // the skin masked movement, made by MovementEngine::maskChanges
 	int index = 0;
 	int fps = 25;
 	std::vector<double> values;
 	double maxMovement = 20000.0; // todo: determine this automatically?
 	double value;
 	double filteredValue;
+	double valueSum = 0; // of values, so the filtered value is a running average
 
 	MovementDetector(int fps);
 	~MovementDetector();
 
-	void detect(cv::Mat& gray, cv::Mat& grayPrev);
-	void mask(cv::Mat& mask);
-	void calculate(double normalizationFactor);
+	void update(int changedPixels, double normalizationFactor);
 	void show(std::string windowName = "movementMap");
 	void draw(cv::Mat& canvas);
 };
\ No newline at end of file
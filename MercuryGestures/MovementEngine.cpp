@@ -0,0 +1,185 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "MovementEngine.h"
+#include "Profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MERCURY_SSE2
+#endif
+
+/*
+* 255 where the difference of a and b is above the threshold and the mask (if any) is set. The output is optional.
+* Returns the amount of changed pixels.
+*/
+static int changeRow(const uchar* a, const uchar* b, const uchar* mask, uchar* out, int width, int threshold) {
+	int x = 0;
+	int count = 0;
+#ifdef MERCURY_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(1);
+	const __m128i all = _mm_set1_epi8(-1);
+	const __m128i limit = _mm_set1_epi8(char(std::min(255, std::max(0, threshold))));
+	__m128i sums = zero;
+	for (; x + 16 <= width; x += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + x));
+		__m128i difference = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		// above the threshold if the saturated difference - threshold is not 0
+		__m128i changed = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(difference, limit), zero), all);
+		if (mask != nullptr)
+			changed = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + x)), zero), changed);
+		if (out != nullptr)
+			_mm_storeu_si128((__m128i*)(out + x), changed);
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_and_si128(changed, ones), zero));
+	}
+	count = _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#endif
+	for (; x < width; x++) {
+		bool changed = std::abs(int(a[x]) - int(b[x])) > threshold && (mask == nullptr || mask[x] != 0);
+		if (out != nullptr)
+			out[x] = changed ? 255 : 0;
+		count += changed;
+	}
+	return count;
+}
+
+/*
+* The changes where the mask is set. The output is optional. Returns the amount of them.
+*/
+static int maskRow(const uchar* changes, const uchar* mask, uchar* out, int width) {
+	int x = 0;
+	int count = 0;
+#ifdef MERCURY_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(1);
+	__m128i sums = zero;
+	for (; x + 16 <= width; x += 16) {
+		__m128i changed = _mm_loadu_si128((const __m128i*)(changes + x));
+		changed = _mm_andnot_si128(_mm_cmpeq_epi8(changed, zero), _mm_set1_epi8(-1));
+		if (mask != nullptr)
+			changed = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + x)), zero), changed);
+		if (out != nullptr)
+			_mm_storeu_si128((__m128i*)(out + x), changed);
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_and_si128(changed, ones), zero));
+	}
+	count = _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#endif
+	for (; x < width; x++) {
+		bool changed = changes[x] != 0 && (mask == nullptr || mask[x] != 0);
+		if (out != nullptr)
+			out[x] = changed ? 255 : 0;
+		count += changed;
+	}
+	return count;
+}
+
+MovementEngine::MovementEngine() {}
+MovementEngine::~MovementEngine() {}
+
+/*
+* Make the change map, for the consumers that need all of the movement.
+*/
+void MovementEngine::detectChanges(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_MOVEMENT_DETECT);
+	cv::Rect frameRect(0, 0, gray.cols, gray.rows);
+	area = area.area() == 0 ? frameRect : area & frameRect;
+	this->changes.create(gray.rows, gray.cols, CV_8U);
+	for (int y = area.y; y < area.y + area.height; y++) {
+		changeRow(gray.ptr<uchar>(y) + area.x, grayPrev.ptr<uchar>(y) + area.x, nullptr,
+			this->changes.ptr<uchar>(y) + area.x, area.width, this->threshold);
+	}
+	if (area != frameRect)
+		clearOutside(this->changes, area);
+	this->keepDifference(gray, grayPrev, area);
+}
+
+/*
+* The same on the OpenCL device, the change map is downloaded.
+*/
+void MovementEngine::detectChanges(cv::UMat& gray, cv::UMat& grayPrev, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_MOVEMENT_DETECT);
+	cv::Rect frameRect(0, 0, gray.cols, gray.rows);
+	area = area.area() == 0 ? frameRect : area & frameRect;
+	cv::absdiff(gray(area), grayPrev(area), this->deviceDiff);
+	cv::threshold(this->deviceDiff, this->deviceChanges, this->threshold, 255, 0);
+
+	this->changes.create(gray.rows, gray.cols, CV_8U);
+	cv::Mat areaChanges = this->changes(area);
+	this->deviceChanges.copyTo(areaChanges);
+	if (area != frameRect)
+		clearOutside(this->changes, area);
+
+	if (this->keepDiff) {
+		this->diff.create(gray.rows, gray.cols, CV_8U);
+		cv::Mat areaDiff = this->diff(area);
+		this->deviceDiff.copyTo(areaDiff);
+		if (area != frameRect)
+			clearOutside(this->diff, area);
+	}
+}
+
+/*
+* The changes under the mask, straight from the gray frames: the difference, the threshold and the mask are one pass.
+* The masked changes are written to the output. Returns the amount of them.
+*/
+int MovementEngine::maskChanges(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& mask, cv::Mat& output, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_MOVEMENT_DETECT);
+	cv::Rect frameRect(0, 0, gray.cols, gray.rows);
+	area = area.area() == 0 ? frameRect : area & frameRect;
+	output.create(gray.rows, gray.cols, CV_8U);
+	int count = 0;
+	for (int y = area.y; y < area.y + area.height; y++) {
+		count += changeRow(gray.ptr<uchar>(y) + area.x, grayPrev.ptr<uchar>(y) + area.x, mask.ptr<uchar>(y) + area.x,
+			output.ptr<uchar>(y) + area.x, area.width, this->threshold);
+	}
+	if (area != frameRect)
+		clearOutside(output, area);
+	this->keepDifference(gray, grayPrev, area);
+	return count;
+}
+
+/*
+* The changes under the mask from a change map that was already made. The output can be the change map. This only
+* reads the maps, it can be called for several outputs at once.
+*/
+int MovementEngine::maskChanges(cv::Mat& changes, cv::Mat& mask, cv::Mat& output, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_MOVEMENT_DETECT);
+	cv::Rect frameRect(0, 0, changes.cols, changes.rows);
+	area = area.area() == 0 ? frameRect : area & frameRect;
+	output.create(changes.rows, changes.cols, CV_8U);
+	int count = 0;
+	for (int y = area.y; y < area.y + area.height; y++) {
+		count += maskRow(changes.ptr<uchar>(y) + area.x, mask.ptr<uchar>(y) + area.x, output.ptr<uchar>(y) + area.x,
+			area.width);
+	}
+	if (area != frameRect)
+		clearOutside(output, area);
+	return count;
+}
+
+/*
+* Count the changes under every mask in one pass over the rows, nothing is written. A null mask counts all changes.
+*/
+void MovementEngine::countChanges(cv::Mat& changes, std::vector<cv::Mat*>& masks, std::vector<int>& counts) {
+	PROFILE_SCOPE(PROFILE_MOVEMENT_CALCULATE);
+	counts.assign(masks.size(), 0);
+	for (int y = 0; y < changes.rows; y++) {
+		const uchar* row = changes.ptr<uchar>(y);
+		for (int i = 0; i < masks.size(); i++) {
+			const uchar* mask = masks[i] == nullptr ? nullptr : masks[i]->ptr<uchar>(y);
+			counts[i] += maskRow(row, mask, nullptr, changes.cols);
+		}
+	}
+}
+
+void MovementEngine::keepDifference(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& area) {
+	if (this->keepDiff == false)
+		return;
+	this->diff.create(gray.rows, gray.cols, CV_8U);
+	cv::Mat areaDiff = this->diff(area);
+	cv::absdiff(gray(area), grayPrev(area), areaDiff);
+	if (area != cv::Rect(0, 0, gray.cols, gray.rows))
+		clearOutside(this->diff, area);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* The movement of a frame for all of its consumers. A pixel changed if its gray value differs more than threshold from
+* the previous frame, like cv::threshold on the cv::absdiff. The difference is made in the same pass as the mask it is
+* needed under, and only written out as a map where a consumer asks for one. Counting the changes under several masks is
+* a single pass over the change map that writes nothing. The passes use SSE2 where it is available.
+*
+* All maps are frame sized. With an area only that part of the frame is looked at, the rest of the maps is 0.
+*/
+class MovementEngine {
+public:
+	int threshold = 25;
+	bool keepDiff = false;  // also keep the unfiltered difference, only the viewer uses it
+	cv::Mat changes;        // 255 where the pixel changed, made by detectChanges
+	cv::Mat diff;           // the unfiltered difference with keepDiff
+	cv::UMat deviceDiff;    // see detectChanges on the device
+	cv::UMat deviceChanges;
+
+	MovementEngine();
+	~MovementEngine();
+
+	void detectChanges(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect area = cv::Rect());
+	void detectChanges(cv::UMat& gray, cv::UMat& grayPrev, cv::Rect area = cv::Rect());
+	int maskChanges(cv::Mat& gray, cv::Mat& grayPrev, cv::Mat& mask, cv::Mat& output, cv::Rect area = cv::Rect());
+	int maskChanges(cv::Mat& changes, cv::Mat& mask, cv::Mat& output, cv::Rect area = cv::Rect());
+	void countChanges(cv::Mat& changes, std::vector<cv::Mat*>& masks, std::vector<int>& counts);
+
+private:
+	void keepDifference(cv::Mat& gray, cv::Mat& grayPrev, cv::Rect& area);
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "OpticalFlowContext.h"
+
+OpticalFlowContext::OpticalFlowContext() {}
+OpticalFlowContext::~OpticalFlowContext() {}
+
+/*
+* Start a new frame. The current pyramid becomes the previous one, only the pyramid of gray is built.
+* After an invalidate (or on the first frame) the pyramid of grayPrev is built as well.
+*/
+void OpticalFlowContext::update(cv::Mat& gray, cv::Mat& grayPrev) {
+	if (this->valid && this->pyramid.size() > 0 && this->pyramid[0].size() == grayPrev.size()) {
+		std::swap(this->pyramidPrev, this->pyramid);
+	}
+	else {
+		cv::buildOpticalFlowPyramid(grayPrev, this->pyramidPrev, this->window, this->maxLevel);
+	}
+	cv::buildOpticalFlowPyramid(gray, this->pyramid, this->window, this->maxLevel);
+	this->valid = true;
+}
+
+/*
+* Track the points from the previous frame to the current one. Points are in frame coordinates.
+*/
+void OpticalFlowContext::track(std::vector<cv::Point2f>& pointsPrev, std::vector<cv::Point2f>& points, std::vector<uchar>& status) {
+	points.clear();
+	status.clear();
+	if (pointsPrev.size() == 0 || this->valid == false)
+		return;
+
+	cv::calcOpticalFlowPyrLK(
+		this->pyramidPrev, this->pyramid, // 2 consecutive images
+		pointsPrev,			// input point positions in first im
+		points,				// output point positions in the 2nd
+		status,				// tracking success
+		this->error,		// tracking error
+		this->window,
+		this->maxLevel
+	);
+}
+
+void OpticalFlowContext::invalidate() {
+	this->valid = false;
+}
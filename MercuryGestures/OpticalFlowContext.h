@@ -0,0 +1,27 @@
+#pragma once
+
+#include "MercuryCore.h"
+
+/*
+* Keeps the Lucas-Kanade image pyramids of the previous and the current frame. The pyramid of a frame is built once and
+* used for the next frame as the previous pyramid. All points of a frame (both hands) are tracked in a single call.
+* The context has to be invalidated when frames are skipped, or the previous pyramid would not match grayPrev.
+*/
+class OpticalFlowContext {
+public:
+	cv::Size window = cv::Size(21, 21);  // the calcOpticalFlowPyrLK defaults
+	int maxLevel = 3;
+	std::vector<cv::Mat> pyramidPrev;
+	std::vector<cv::Mat> pyramid;
+	cv::Mat error;
+
+	OpticalFlowContext();
+	~OpticalFlowContext();
+
+	void update(cv::Mat& gray, cv::Mat& grayPrev);
+	void track(std::vector<cv::Point2f>& pointsPrev, std::vector<cv::Point2f>& points, std::vector<uchar>& status);
+	void invalidate();
+
+private:
+	bool valid = false;
+};
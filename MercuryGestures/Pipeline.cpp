@@ -0,0 +1,547 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Pipeline.h"
+#include "Profiler.h"
+#include <opencv2/core/ocl.hpp>
+
+Pipeline::Pipeline(int fps, bool headless) :
+	handDetector(fps),
+	movementDetector(fps),
+	ROImovementDetector(fps),
+	subjectTracker(fps) {
+	this->fps = fps;
+	this->headless = headless;
+	this->handDetector.setDebugDrawing(headless == false);
+	this->handDetector.framePool = &this->framePool;
+	this->subjectTracker.setDebugDrawing(headless == false);
+	this->subjectTracker.framePool = &this->framePool;
+	// only the viewer shows the unfiltered movement
+	this->movementEngine.keepDiff = headless == false;
+}
+
+Pipeline::~Pipeline() {}
+
+/*
+* Load the classifiers. Returns false if this failed.
+*/
+bool Pipeline::setup() {
+	return this->faceDetector.setup();
+}
+
+/*
+* Resize the raw frame and convert it to grayscale. This does not touch the state of the pipeline so it can run ahead
+* on another thread. Returns false if the frame is empty (end of the video).
+*/
+bool Pipeline::prepare(cv::Mat& rawFrame, PreparedFrame& prepared) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// check for end of video file.
+	if (rawFrame.empty()) {
+		return false;
+	}
+
+	// the frame has just been read, this is as close to the capture as we get.
+	prepared.timestamp = getTimestamp();
+
+	// resize image
+	int frameHeight = this->frameHeightMax;
+	double resizeFactor = frameHeight / double(rawFrame.rows);
+	cv::Size size(std::round(rawFrame.cols * resizeFactor), frameHeight);
+	if (this->useOpenCL) {
+		// the frames stay on the device. The face detection and the hand tracking need the gray frame on the host,
+		// the color frame is only downloaded for the viewer.
+		this->bindDevice();
+		rawFrame.copyTo(this->deviceRaw);
+		cv::resize(this->deviceRaw, prepared.deviceFrame, size);
+		cv::cvtColor(prepared.deviceFrame, prepared.deviceGray, CV_BGR2GRAY);
+		prepared.gray = this->framePool.acquire(size, CV_8U);
+		prepared.deviceGray.copyTo(prepared.gray);
+		if (this->headless == false) {
+			prepared.frame = this->framePool.acquire(size, CV_8UC3);
+			prepared.deviceFrame.copyTo(prepared.frame);
+		}
+	}
+	else {
+		prepared.frame = this->framePool.acquire(size, CV_8UC3);
+		cv::resize(rawFrame, prepared.frame, size);
+
+		// convert frame to grayscale
+		prepared.gray = this->framePool.acquire(size, CV_8U);
+		cv::cvtColor(prepared.frame, prepared.gray, CV_BGR2GRAY);
+	}
+
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	prepared.duration = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1000.0;
+	return true;
+}
+
+/*
+* The same for a frame of a FrameSource, the capture time and the dropped frames are taken over from it.
+*/
+bool Pipeline::prepare(CapturedFrame& captured, PreparedFrame& prepared) {
+	if (this->prepare(captured.image, prepared) == false)
+		return false;
+	prepared.timestamp = captured.timestamp;
+	prepared.dropped = captured.dropped;
+	return true;
+}
+
+/*
+* Run all detectors on a single frame, in order. The result is filled with the values for this frame.
+* Returns false if the frame is empty (end of the video).
+*/
+bool Pipeline::process(cv::Mat& rawFrame, PipelineResult& result) {
+	PreparedFrame prepared;
+	if (this->prepare(rawFrame, prepared) == false) {
+		return false;
+	}
+	this->process(prepared, result);
+	return true;
+}
+
+bool Pipeline::process(CapturedFrame& captured, PipelineResult& result) {
+	PreparedFrame prepared;
+	if (this->prepare(captured, prepared) == false) {
+		return false;
+	}
+	this->process(prepared, result);
+	return true;
+}
+
+/*
+* Run all detectors on a prepared frame. Frames have to be given in order, the detectors keep the previous frame.
+*/
+void Pipeline::process(PreparedFrame& prepared, PipelineResult& result) {
+	PROFILE_SCOPE(PROFILE_FRAME);
+	// time elapsed
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// the previous gray frame is kept in the ring, without a copy. The prepared buffers are not reused by the pool as
+	// long as the ring holds them.
+	this->frame = prepared.frame;
+	this->grayFrames.advance() = prepared.gray;
+	this->gray = this->grayFrames.current();
+	this->grayPrev = this->grayFrames.previous();
+	this->deviceFrame = prepared.deviceFrame;
+	this->deviceGrayFrames.advance() = prepared.deviceGray;
+	this->deviceGray = this->deviceGrayFrames.current();
+	this->deviceGrayPrev = this->deviceGrayFrames.previous();
+	this->frameIndex += prepared.dropped;
+	if (this->useOpenCL)
+		this->bindDevice();
+
+	// on the very first frame we initialize the classes. If the frame size changes (see frameHeightMax) the state of
+	// the detectors is in the old coordinates, so we start over.
+	if (this->gray.cols != this->frameWidth || this->gray.rows != this->frameHeight) {
+		if (this->frameWidth != 0) {
+			this->faceDetector.reset();
+			this->handDetector.reset();
+			this->subjectTracker.reset();
+			this->initialized = false;
+		}
+		this->frameWidth = this->gray.cols;
+		this->frameHeight = this->gray.rows;
+		this->faceDetector.setVideoProperties(this->frameWidth, this->frameHeight);
+		this->handDetector.setVideoProperties(this->frameWidth, this->frameHeight);
+		this->subjectTracker.setVideoProperties(this->frameWidth, this->frameHeight);
+	}
+
+	result = PipelineResult();
+	result.frameIndex = this->frameIndex;
+	result.timestamp = prepared.timestamp;
+
+	if (this->multiSubject)
+		this->processSubjects(result);
+	else
+		this->processSubject(result);
+
+	// time elapsed
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	result.duration = prepared.duration + std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1000.0;
+	result.latency = (getTimestamp() - prepared.timestamp) / 1000.0;
+
+	this->frameIndex += 1;
+
+	// adapt the quality for the next frames
+	result.qualityLevel = this->scheduler.getLevel();
+	if (this->adaptiveQuality && this->scheduler.update(result.duration)) {
+		QualitySettings settings = this->scheduler.getSettings();
+		this->applyQuality(settings);
+	}
+
+#ifdef MERCURY_PROFILING
+	Profiler::instance().setGauge(GAUGE_QUALITY_LEVEL, result.qualityLevel);
+	Profiler::instance().setGauge(GAUGE_SMOOTHED_LATENCY, this->scheduler.getLatency());
+	Profiler::instance().dumpIfDue();
+#endif
+}
+
+/*
+* Process the video feed until it ends. Every frame result is given to the publish callback.
+* Returns the amount of frames processed.
+*/
+int Pipeline::run(FrameSource& source, std::function<void(PipelineResult&)> publish) {
+	CapturedFrame captured;
+	PipelineResult result;
+	int processed = 0;
+	source.setTargetHeight(this->frameHeightMax);
+	source.start();
+	for (;;) {
+		// the frames the quality level asks to drop are skipped without decoding them
+		if (source.read(captured, this->framesToDrop) == false || this->process(captured, result) == false) {
+			break;
+		}
+		publish(result);
+		processed++;
+	}
+	return processed;
+}
+
+/*
+* The single subject steps of process: the face lock, the shared maps, the hands and the movement.
+*/
+void Pipeline::processSubject(PipelineResult& result) {
+	// start detection of edges, face and skin
+	bool faceDetected = this->faceDetector.detect(this->gray);
+	double pixelSizeInCm = this->faceDetector.pixelSizeInCm;
+	if (faceDetected) {
+		auto face = &(this->faceDetector.face.rect);
+
+		// once the face is locked only the body region is processed, the detectors leave the rest of their maps 0.
+		cv::Rect area(0, 0, this->frameWidth, this->frameHeight);
+		if (this->bodyRegionOnly && this->faceDetector.faceLocked)
+			area = this->getBodyArea();
+		bool areaChanged = area != this->processingArea;
+		this->processingArea = area;
+
+		// in incremental mode the movement since the last frame tells which parts of the frame have to be processed
+		// again. If nothing changed the skin, edge and hand results of the last processed frame are kept.
+		bool idle = false;
+		bool changesReady = false;
+		std::vector<cv::Rect>* regions = nullptr;
+		if (this->incremental && this->initialized) {
+			this->detectChanges(area);
+			changesReady = true;
+			this->changeMap.update(this->movementEngine.changes);
+			idle = this->changeMap.isIdle() && areaChanged == false;
+			if (this->changeMap.isPartial() && areaChanged == false) {
+				this->areaRegions.clear();
+				for (auto& region : this->changeMap.dirtyRects) {
+					cv::Rect inside = region & area;
+					if (inside.area() > 0)
+						this->areaRegions.push_back(inside);
+				}
+				regions = &this->areaRegions;
+			}
+		}
+		else if (this->incremental) {
+			this->changeMap.reset(this->gray.size());
+		}
+
+		// the skin and edge detection only depend on the current frame, the edges can be found next to the skin.
+		if (idle == false)
+			this->detectShared(face, area, pixelSizeInCm, regions);
+
+		if (this->initialized) {
+			cv::Mat temporalSkinMask = this->skinDetector.getMergedMap();
+			this->roiMask.create(temporalSkinMask.rows, temporalSkinMask.cols, temporalSkinMask.type());
+			this->roiMask.setTo(0);
+
+			// get an initial motion estimate based on the temporal skin mask alone. This is used
+			// in the hand detection. Without a change map the difference is made in the same pass as the mask.
+			int skinChanges = 0;
+			if (this->useOpenCL && changesReady == false) {
+				this->detectChanges(area);
+				changesReady = true;
+			}
+			if (changesReady)
+				skinChanges = this->movementEngine.maskChanges(this->movementEngine.changes, temporalSkinMask, this->movementDetector.movementMap);
+			else
+				skinChanges = this->movementEngine.maskChanges(this->gray, this->grayPrev, temporalSkinMask, this->movementDetector.movementMap, area);
+			this->movementDetector.update(skinChanges, this->faceDetector.normalizationFactor);
+
+			if (idle) {
+				this->handDetector.skip();
+			}
+			else {
+				this->handDetector.detect(
+					this->gray, this->grayPrev,
+					*face,
+					this->skinDetector.skinMask,
+					this->movementDetector.movementMap,
+					this->edgeDetector.detectedEdges,
+					pixelSizeInCm,
+					area
+				);
+			}
+
+			// create the ROI map with just the hands and the face. This would reduce the difference
+			// between long and short sleeves.
+			this->handDetector.addResultToMask(this->roiMask);
+			this->faceDetector.addResultToMask(this->roiMask);
+
+			// detect movent only within the ROI areas. That is the skin masked movement under the ROI mask, so the
+			// difference is not made again.
+			this->movementMasks.assign(1, &this->roiMask);
+			this->movementEngine.countChanges(this->movementDetector.movementMap, this->movementMasks, this->movementCounts);
+			this->ROImovementDetector.update(this->movementCounts[0], this->faceDetector.normalizationFactor);
+
+			result.valid = true;
+			result.movementValue = this->movementDetector.value;
+			result.movementFilteredValue = this->movementDetector.filteredValue;
+			result.ROImovementValue = this->ROImovementDetector.value;
+			result.ROImovementFilteredValue = this->ROImovementDetector.filteredValue;
+			result.leftHand = this->handDetector.leftHand.position;
+			result.rightHand = this->handDetector.rightHand.position;
+			result.cmInPixels = this->handDetector.cmInPixels;
+			result.processingArea = area;
+			addBlobSummaries(this->handDetector.blobs, result);
+		}
+		if (this->incremental && idle == false)
+			this->changeMap.markProcessed(regions == nullptr);
+		result.faceDetected = true;
+		result.face = *face;
+		this->initialized = true;
+	}
+	else {
+		this->faceDetector.clearFace();
+		this->handDetector.reset();
+		this->initialized = false;
+	}
+}
+
+/*
+* The multi subject steps of process. The cascade, the skin, edge and movement maps are made once for all subjects, the
+* subjects are then processed on their own body regions, see SubjectTracker. The result has the values of every subject,
+* the single subject values are those of the first (oldest) subject. There are no partial updates in this mode.
+*/
+void Pipeline::processSubjects(PipelineResult& result) {
+	if (this->subjectTracker.detect(this->faceDetector, this->gray) == false) {
+		this->initialized = false;
+		return;
+	}
+
+	Subject& primary = *this->subjectTracker.subjects[0];
+	cv::Rect* face = &primary.faceDetector.face.rect;
+	cv::Rect area(0, 0, this->frameWidth, this->frameHeight);
+	if (this->bodyRegionOnly)
+		area = this->subjectTracker.getBodyArea() & area;
+	this->processingArea = area;
+
+	// the skin model is sampled from the face of the first subject. The subjects that were there on the last frame
+	// need the movement, there are none on the first frame with a face.
+	this->detectShared(face, area, primary.faceDetector.pixelSizeInCm, nullptr);
+	if (this->initialized)
+		this->detectChanges(area);
+
+	SubjectFrame frame;
+	frame.gray = this->gray;
+	frame.grayPrev = this->grayPrev;
+	frame.skinMask = this->skinDetector.skinMask;
+	frame.temporalSkinMask = this->skinDetector.getMergedMap();
+	frame.edges = this->edgeDetector.detectedEdges;
+	frame.changes = this->movementEngine.changes;
+	frame.movementEngine = &this->movementEngine;
+	this->subjectTracker.parallel = this->concurrentDetectors;
+	this->subjectTracker.process(frame);
+
+	this->subjectTracker.getSummaries(result.subjects, result.subjectCount);
+	SubjectSummary& first = result.subjects[0];
+	result.faceDetected = true;
+	result.face = first.face;
+	result.valid = first.valid;
+	if (first.valid) {
+		result.movementValue = first.movementValue;
+		result.movementFilteredValue = primary.movementDetector.filteredValue;
+		result.ROImovementValue = first.ROImovementValue;
+		result.ROImovementFilteredValue = first.ROImovementFilteredValue;
+		result.leftHand = first.leftHand;
+		result.rightHand = first.rightHand;
+		result.cmInPixels = primary.handDetector.cmInPixels;
+		result.processingArea = area;
+		addBlobSummaries(primary.handDetector.blobs, result);
+	}
+	this->initialized = true;
+}
+
+/*
+* Runs two independent tasks, for cv::parallel_for_ over cv::Range(0, 2). The threads of the OpenCV pool are kept
+* between the frames, and the tasks are held by reference so nothing is allocated per frame.
+*/
+template<typename First, typename Second>
+class PairLoopBody : public cv::ParallelLoopBody {
+public:
+	PairLoopBody(First& first, Second& second) : first(first), second(second) {}
+
+	void operator()(const cv::Range& range) const {
+		for (int i = range.start; i < range.end; i++) {
+			if (i == 0)
+				this->first();
+			else
+				this->second();
+		}
+	}
+
+private:
+	First& first;
+	Second& second;
+};
+
+template<typename First, typename Second>
+void runConcurrently(First& first, Second& second) {
+	cv::parallel_for_(cv::Range(0, 2), PairLoopBody<First, Second>(first, second));
+}
+
+/*
+* The skin and the edge maps, next to each other on the OpenCV thread pool if the detectors may run concurrently. Only
+* the area is processed, or the regions of it if they are given.
+*/
+void Pipeline::detectShared(cv::Rect* face, cv::Rect& area, double pixelSizeInCm, std::vector<cv::Rect>* regions) {
+	bool edgesDue = this->detectEdges || this->edgeDetector.detectedEdges.size() != this->gray.size();
+	auto detectEdges = [this, regions, area] {
+		if (regions != nullptr)
+			this->edgeDetector.detectRegions(this->gray, *regions);
+		else
+			this->edgeDetector.detect(this->gray, area);
+	};
+	if (this->useOpenCL) {
+		// the device runs the stages one after the other anyway. There are no partial updates on the device.
+		this->skinDetector.detect(*face, this->deviceFrame, this->initialized, area);
+		if (edgesDue)
+			this->edgeDetector.detect(this->deviceGray, area);
+	}
+	else if (this->concurrentDetectors && edgesDue) {
+		auto detectSkin = [this, face, pixelSizeInCm, regions, area] {
+			this->skinDetector.detect(*face, this->frame, this->initialized, (3.0 / pixelSizeInCm) * 4, regions, area);
+		};
+		runConcurrently(detectSkin, detectEdges);
+	}
+	else {
+		this->skinDetector.detect(*face, this->frame, this->initialized, (3.0 / pixelSizeInCm) * 4, regions, area);
+		if (edgesDue)
+			detectEdges();
+	}
+}
+
+void Pipeline::reset() {
+	this->faceDetector.reset();
+	this->handDetector.reset();
+	this->subjectTracker.reset();
+	this->initialized = false;
+	this->frameIndex = 0;
+}
+
+/*
+* Keep the processing time per frame within the budget (in ms) by lowering the quality when needed, see
+* LatencyScheduler. A budget of 0 turns this off and goes back to full quality.
+*/
+void Pipeline::setLatencyBudget(double budget) {
+	if (this->adaptiveQuality == false)
+		this->scheduler.frameHeightMax = this->frameHeightMax;
+	this->adaptiveQuality = budget > 0;
+	if (this->adaptiveQuality)
+		this->scheduler.setBudget(budget);
+	this->scheduler.reset();
+	QualitySettings settings = this->scheduler.getSettings();
+	this->applyQuality(settings);
+}
+
+void Pipeline::applyQuality(QualitySettings& settings) {
+	this->faceDetector.detectionInterval = settings.faceDetectionInterval;
+	this->detectEdges = settings.detectEdges;
+	this->handDetector.setSearchEffort(settings.searchEffort);
+	this->subjectTracker.setSearchEffort(settings.searchEffort);
+	this->frameHeightMax = settings.frameHeightMax;
+	this->framesToDrop = settings.framesToDrop;
+}
+
+/*
+* Track up to this many people at once, see SubjectTracker. With 1 (the default) the single subject steps are used.
+*/
+void Pipeline::setMaxSubjects(int subjects) {
+	this->multiSubject = subjects > 1;
+	this->subjectTracker.maxSubjects = std::max(1, subjects);
+	this->subjectTracker.reset();
+	this->initialized = false;
+}
+
+/*
+* Run the per pixel stages (resize, color conversion, skin, edges and movement) on the OpenCL device through the
+* transparent API. Only the results the hand tracking needs are downloaded. Returns false, and stays on the cpu, if
+* OpenCL is asked for but there is no usable device.
+*/
+bool Pipeline::setOpenCL(bool enabled) {
+	this->useOpenCL = enabled && cv::ocl::haveOpenCL();
+	this->deviceGrayFrames.reset();
+	this->initialized = false;
+	return this->useOpenCL == enabled;
+}
+
+/*
+* The transparent API is switched on per thread, and prepare can run on another thread than process.
+*/
+void Pipeline::bindDevice() {
+	if (cv::ocl::useOpenCL() == false)
+		cv::ocl::setUseOpenCL(true);
+}
+
+void Pipeline::detectChanges(cv::Rect& area) {
+	if (this->useOpenCL)
+		this->movementEngine.detectChanges(this->deviceGray, this->deviceGrayPrev, area);
+	else
+		this->movementEngine.detectChanges(this->gray, this->grayPrev, area);
+}
+
+/*
+* The body region of the face detector, grown to the tiles of the change map. The face rect moves a little every frame,
+* aligned to the tiles the region only changes when the face really moved. A changed region is processed as a whole.
+*/
+cv::Rect Pipeline::getBodyArea() {
+	cv::Rect region = this->faceDetector.getBodyRegion();
+	int tile = this->changeMap.tileSize;
+	int left = (region.x / tile) * tile;
+	int top = (region.y / tile) * tile;
+	int right = std::min(this->frameWidth, ((region.x + region.width + tile - 1) / tile) * tile);
+	int bottom = std::min(this->frameHeight, ((region.y + region.height + tile - 1) / tile) * tile);
+	return cv::Rect(left, top, right - left, bottom - top);
+}
+
+/*
+* Keep the largest blobs in the result, sorted by area. The result has room for maxResultBlobs.
+*/
+void addBlobSummaries(std::vector<BlobInformation>& blobs, PipelineResult& result) {
+	result.blobCount = 0;
+	for (auto& blob : blobs) {
+		int index = result.blobCount;
+		while (index > 0 && result.blobs[index - 1].area < blob.area) {
+			if (index < maxResultBlobs)
+				result.blobs[index] = result.blobs[index - 1];
+			index--;
+		}
+		if (index >= maxResultBlobs)
+			continue;
+
+		BlobSummary& summary = result.blobs[index];
+		summary.rect = blob.rect;
+		summary.center = blob.center;
+		summary.area = blob.area;
+		summary.type = blob.type;
+		result.blobCount = std::min(result.blobCount + 1, maxResultBlobs);
+	}
+}
+
+/*
+* The results are written as csv, one line per frame.
+*/
+void writeResultHeader(std::ostream& out) {
+	out << "frame,faceDetected,valid,movement,ROImovement,ROImovementFiltered,leftX,leftY,rightX,rightY,faceX,faceY,faceWidth,faceHeight,ms,latencyMs" << std::endl;
+}
+
+void writeResult(std::ostream& out, PipelineResult& result) {
+	out << result.frameIndex << "," << result.faceDetected << "," << result.valid << ","
+		<< result.movementValue << "," << result.ROImovementValue << "," << result.ROImovementFilteredValue << ","
+		<< result.leftHand.x << "," << result.leftHand.y << "," << result.rightHand.x << "," << result.rightHand.y << ","
+		<< result.face.x << "," << result.face.y << "," << result.face.width << "," << result.face.height << ","
+		<< result.duration << "," << result.latency << "\n";
+}
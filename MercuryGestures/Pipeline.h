@@ -0,0 +1,147 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "FaceDetector.h"
+#include "EdgeDetector.h"
+#include "MovementDetector.h"
+#include "MovementEngine.h"
+#include "SkinDetector.h"
+#include "HandDetector.h"
+#include "FramePool.h"
+#include "LatencyScheduler.h"
+#include "ChangeMap.h"
+#include "FrameRing.h"
+#include "FrameSource.h"
+#include "SubjectTracker.h"
+#include <atomic>
+#include <functional>
+
+/*
+* A frame after the stateless preparation step. This can be made ahead of time on another thread.
+*/
+struct PreparedFrame {
+	cv::Mat frame;		// resized input frame
+	cv::Mat gray;
+	cv::UMat deviceFrame;	// the same on the OpenCL device, see Pipeline::useOpenCL. Then frame is only there for the viewer.
+	cv::UMat deviceGray;
+	long long timestamp = 0;	// capture time in us since the epoch
+	int dropped = 0;		// stale frames skipped before this one
+	double duration = 0;	// preparation time in ms
+};
+
+/*
+* Summary of a skin blob of the hand detection.
+*/
+struct BlobSummary {
+	cv::Rect rect;
+	cv::Point center;
+	int area = 0;
+	BlobType type = OTHER;
+};
+
+const int maxResultBlobs = 4;
+
+/*
+* Everything we publish about a single frame.
+*/
+struct PipelineResult {
+	int frameIndex = 0;
+	long long timestamp = 0;				// capture time in us since the epoch
+	bool faceDetected = false;
+	bool valid = false;						// the movement and hand values have been calculated for this frame
+	double movementValue = 0;				// skin masked movement
+	double movementFilteredValue = 0;
+	double ROImovementValue = 0;			// THIS IS THE VALUE TO PUBLISH TO SSI
+	double ROImovementFilteredValue = 0;
+	cv::Point leftHand;
+	cv::Point rightHand;
+	cv::Rect face;
+	double cmInPixels = 0;
+	cv::Rect processingArea;				// the part of the frame the detectors ran on, see Pipeline::bodyRegionOnly
+	int blobCount = 0;						// the largest blobs, by area
+	BlobSummary blobs[maxResultBlobs];
+	int qualityLevel = 0;					// see LatencyScheduler
+	double duration = 0;					// processing time in ms
+	double latency = 0;						// ms from the capture of the frame to this result
+	int subjectCount = 0;					// multi subject mode, the values above are those of the first subject
+	SubjectSummary subjects[maxResultSubjects];
+};
+
+/*
+* The pipeline owns the detectors and runs them on a video feed. It does not use any HighGUI calls, the GUI in main.cpp
+* is a viewer on top of this. In headless mode the detectors do not draw their debug canvases either.
+*/
+class Pipeline {
+public:
+	SkinDetector  skinDetector;
+	EdgeDetector  edgeDetector;
+	HandDetector  handDetector;
+	MovementDetector movementDetector;
+	MovementDetector ROImovementDetector;
+	MovementEngine movementEngine; // the frame difference, shared by both movement detectors
+	FaceDetector  faceDetector;
+	SubjectTracker subjectTracker;   // the subjects of the multi subject mode, faceDetector only runs the cascade then
+	FramePool     framePool; // the per frame buffers, see prepare. Also used by the hand detector.
+
+	cv::Mat frame; // resized input frame
+	cv::Mat gray;
+	cv::Mat grayPrev;
+	cv::Mat roiMask;
+	cv::UMat deviceFrame;
+	cv::UMat deviceGray;
+	cv::UMat deviceGrayPrev;
+	FrameRing<cv::Mat> grayFrames;        // the last gray frames, gray and grayPrev are headers on these
+	FrameRing<cv::UMat> deviceGrayFrames;
+	cv::UMat deviceRaw;                   // upload buffer of the raw frame, only used by the thread that prepares
+
+	int fps = 25;
+	std::atomic<int> frameHeightMax{ 400 };	// read by prepare, which can run on another thread
+	int frameWidth = 0;
+	int frameHeight = 0;
+	int frameIndex = 0;
+	bool initialized = false;
+	bool headless = true;
+	bool concurrentDetectors = true; // run the edge detection next to the skin detection, on the OpenCV thread pool
+	bool detectEdges = true;         // if false the edges of the last frame where they were detected are reused
+	bool adaptiveQuality = false;    // let the scheduler trade quality for latency, see setLatencyBudget
+	LatencyScheduler scheduler;
+	bool incremental = false;        // only process the parts of the frame that changed, see changeMap
+	ChangeMap changeMap;
+	bool bodyRegionOnly = false;     // once the face is locked only process the region the hands can be in, see getBodyArea
+	cv::Rect processingArea;
+	std::vector<cv::Rect> areaRegions; // the changed regions within the processing area
+	std::atomic<int> framesToDrop{ 0 };
+	bool useOpenCL = false;          // run the per pixel stages on the OpenCL device, see setOpenCL
+	bool multiSubject = false;       // track every face in the frame, see setMaxSubjects
+
+	Pipeline(int fps, bool headless = true);
+	~Pipeline();
+
+	bool setup();
+	bool prepare(cv::Mat& rawFrame, PreparedFrame& prepared);
+	bool prepare(CapturedFrame& captured, PreparedFrame& prepared);
+	bool process(cv::Mat& rawFrame, PipelineResult& result);
+	bool process(CapturedFrame& captured, PipelineResult& result);
+	void process(PreparedFrame& prepared, PipelineResult& result);
+	int run(FrameSource& source, std::function<void(PipelineResult&)> publish);
+	void reset();
+	void setLatencyBudget(double budget);
+	void applyQuality(QualitySettings& settings);
+	bool setOpenCL(bool enabled);
+	void setMaxSubjects(int subjects);
+	cv::Rect getBodyArea();
+
+private:
+	void bindDevice();
+	std::vector<cv::Mat*> movementMasks;
+	std::vector<int> movementCounts;
+
+	void detectChanges(cv::Rect& area);
+	void processSubject(PipelineResult& result);
+	void processSubjects(PipelineResult& result);
+	void detectShared(cv::Rect* face, cv::Rect& area, double pixelSizeInCm, std::vector<cv::Rect>* regions);
+};
+
+void addBlobSummaries(std::vector<BlobInformation>& blobs, PipelineResult& result);
+void writeResultHeader(std::ostream& out);
+void writeResult(std::ostream& out, PipelineResult& result);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "PipelineExecutor.h"
+#include <thread>
+
+PipelineExecutor::PipelineExecutor(Pipeline& pipeline, int queueSize) : pipeline(pipeline) {
+	this->queueSize = queueSize;
+}
+
+PipelineExecutor::~PipelineExecutor() {}
+
+/*
+* Process the video feed until it ends. Decoding of the next frames overlaps with the detection of the current one.
+* Returns the amount of frames processed.
+*/
+int PipelineExecutor::run(FrameSource& source, std::function<void(PipelineResult&)> publish) {
+	BoundedQueue<PreparedFrame> preparedFrames(this->queueSize);
+	BoundedQueue<PipelineResult> results(this->queueSize);
+	source.setTargetHeight(this->pipeline.frameHeightMax);
+	source.start();
+
+	std::thread decoder([&] {
+		CapturedFrame captured;
+		for (;;) {
+			PreparedFrame prepared;
+			if (source.read(captured, this->pipeline.framesToDrop) == false)
+				break;
+			if (this->pipeline.prepare(captured, prepared) == false)
+				break;
+			if (preparedFrames.push(std::move(prepared)) == false)
+				break;
+		}
+		preparedFrames.close();
+	});
+
+	std::thread detector([&] {
+		PreparedFrame prepared;
+		while (preparedFrames.pop(prepared)) {
+			PipelineResult result;
+			this->pipeline.process(prepared, result);
+			if (results.push(std::move(result)) == false)
+				break;
+		}
+		results.close();
+		preparedFrames.close(); // unblock the decoder if we stopped early
+	});
+
+	int processed = 0;
+	PipelineResult result;
+	while (results.pop(result)) {
+		publish(result);
+		processed++;
+	}
+
+	decoder.join();
+	detector.join();
+	return processed;
+}
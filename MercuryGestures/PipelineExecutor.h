@@ -0,0 +1,24 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Pipeline.h"
+#include "BoundedQueue.h"
+
+/*
+* Runs a pipeline as three stages on their own threads, connected by bounded queues:
+* - decode: read the frame from the source and prepare it (resize, grayscale). A live source captures on a thread of
+*   its own before this, see FrameSource.
+* - detect: run the detectors on the prepared frame
+* - publish: hand the result to the callback, this is done on the calling thread
+* Every stage is a single thread and the queues are FIFO so the frame order is kept, the detectors depend on it.
+*/
+class PipelineExecutor {
+public:
+	Pipeline& pipeline;
+	int queueSize = 4;
+
+	PipelineExecutor(Pipeline& pipeline, int queueSize = 4);
+	~PipelineExecutor();
+
+	int run(FrameSource& source, std::function<void(PipelineResult&)> publish);
+};
@@ -0,0 +1,306 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Profiler.h"
+#include <fstream>
+
+const char* getProfileStageName(ProfileStage stage) {
+	switch (stage) {
+		case PROFILE_FRAME:              return "frame";
+		case PROFILE_FACE:               return "face";
+		case PROFILE_SKIN:               return "skin";
+		case PROFILE_EDGES:              return "edges";
+		case PROFILE_MOVEMENT_DETECT:    return "movementDetect";
+		case PROFILE_MOVEMENT_CALCULATE: return "movementCalculate";
+		case PROFILE_HANDS:              return "hands";
+		case PROFILE_CONTOURS:           return "contours";
+		case PROFILE_HAND_SOLVE:         return "handSolve";
+		case PROFILE_OPTICAL_FLOW:       return "opticalFlow";
+		case PROFILE_LOOK_AROUND:        return "lookAround";
+		default:                         return "unknown";
+	}
+}
+
+const char* getProfileGaugeName(ProfileGauge gauge) {
+	switch (gauge) {
+		case GAUGE_QUALITY_LEVEL:        return "qualityLevel";
+		case GAUGE_SMOOTHED_LATENCY:     return "smoothedLatencyMs";
+		default:                         return "unknown";
+	}
+}
+
+/*
+* The bucket a duration falls in. Bucket 0 is below 1 us, after that every bucket is 1/8th of a power of two wide.
+*/
+int getProfileBucket(uint64_t microseconds) {
+	if (microseconds == 0)
+		return 0;
+	int bucket = 1 + int(std::log2(double(microseconds)) * PROFILE_BUCKETS_PER_OCTAVE);
+	return std::min(bucket, PROFILE_BUCKET_COUNT - 1);
+}
+
+/*
+* The upper bound of a bucket in microseconds.
+*/
+double getProfileBucketLimit(int bucket) {
+	if (bucket == 0)
+		return 1;
+	return std::pow(2.0, double(bucket) / PROFILE_BUCKETS_PER_OCTAVE);
+}
+
+
+
+StageHistogram::StageHistogram() {
+	this->reset();
+}
+
+void StageHistogram::record(uint64_t microseconds) {
+	// only the owning thread writes, so the max does not need a compare exchange.
+	this->buckets[getProfileBucket(microseconds)].fetch_add(1, std::memory_order_relaxed);
+	this->count.fetch_add(1, std::memory_order_relaxed);
+	this->totalMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+	if (microseconds > this->maxMicroseconds.load(std::memory_order_relaxed))
+		this->maxMicroseconds.store(microseconds, std::memory_order_relaxed);
+}
+
+void StageHistogram::reset() {
+	for (int i = 0; i < PROFILE_BUCKET_COUNT; i++)
+		this->buckets[i].store(0, std::memory_order_relaxed);
+	this->count.store(0, std::memory_order_relaxed);
+	this->totalMicroseconds.store(0, std::memory_order_relaxed);
+	this->maxMicroseconds.store(0, std::memory_order_relaxed);
+}
+
+
+ThreadProfile::ThreadProfile() {
+	this->generation = 0;
+}
+
+
+
+Profiler::Profiler() {
+	this->enabled = false;
+	this->periodicInterval = 0;
+	this->nextDump = 0;
+	this->generation = 0;
+	for (int i = 0; i < PROFILE_GAUGE_COUNT; i++) {
+		this->gauges[i] = 0;
+		this->gaugeMaxima[i] = 0;
+	}
+}
+
+Profiler& Profiler::instance() {
+	static Profiler profiler;
+	return profiler;
+}
+
+void Profiler::setEnabled(bool enabled) {
+	this->enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Profiler::isEnabled() {
+	return this->enabled.load(std::memory_order_relaxed);
+}
+
+/*
+* Every thread gets its own set of histograms the first time it records something.
+*/
+ThreadProfile& Profiler::getThreadProfile() {
+	thread_local ThreadProfile* profile = nullptr;
+	if (profile == nullptr) {
+		profile = new ThreadProfile();
+		std::lock_guard<std::mutex> lock(this->registryMutex);
+		this->threadProfiles.push_back(profile);
+	}
+	return *profile;
+}
+
+/*
+* Record on the histogram of the calling thread. After a reset the thread clears its histograms first, so only the
+* owner ever writes them.
+*/
+void Profiler::record(ProfileStage stage, uint64_t microseconds) {
+	ThreadProfile& profile = this->getThreadProfile();
+	uint64_t generation = this->generation.load(std::memory_order_acquire);
+	if (profile.generation.load(std::memory_order_relaxed) != generation) {
+		for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+			profile.stages[i].reset();
+		profile.generation.store(generation, std::memory_order_release);
+	}
+	profile.stages[stage].record(microseconds);
+}
+
+/*
+* Set a gauge. With many pipelines in one process the last one to set it wins, the maximum is over all of them.
+*/
+void Profiler::setGauge(ProfileGauge gauge, double value) {
+	if (this->isEnabled() == false)
+		return;
+	this->gauges[gauge].store(value, std::memory_order_relaxed);
+	double max = this->gaugeMaxima[gauge].load(std::memory_order_relaxed);
+	while (value > max && this->gaugeMaxima[gauge].compare_exchange_weak(max, value, std::memory_order_relaxed) == false) {}
+}
+
+/*
+* Merge the histograms of all threads. Percentiles are the upper bound of the bucket they fall in (within ~9%). Threads
+* that did not record since the last reset still have the old histograms, they are left out.
+*/
+void Profiler::getStatistics(ProfileStage stage, StageStatistics& statistics) {
+	std::vector<uint64_t> buckets(PROFILE_BUCKET_COUNT, 0);
+	uint64_t count = 0;
+	uint64_t total = 0;
+	uint64_t max = 0;
+	{
+		uint64_t generation = this->generation.load(std::memory_order_acquire);
+		std::lock_guard<std::mutex> lock(this->registryMutex);
+		for (auto profile : this->threadProfiles) {
+			if (profile->generation.load(std::memory_order_acquire) != generation)
+				continue;
+			StageHistogram& histogram = profile->stages[stage];
+			for (int i = 0; i < PROFILE_BUCKET_COUNT; i++)
+				buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+			count += histogram.count.load(std::memory_order_relaxed);
+			total += histogram.totalMicroseconds.load(std::memory_order_relaxed);
+			max = std::max(max, histogram.maxMicroseconds.load(std::memory_order_relaxed));
+		}
+	}
+
+	statistics = StageStatistics();
+	statistics.count = count;
+	if (count == 0)
+		return;
+
+	statistics.mean = total / double(count) / 1000.0;
+	statistics.max = max / 1000.0;
+
+	double quantiles[3] = { 0.5, 0.95, 0.99 };
+	double* results[3] = { &statistics.p50, &statistics.p95, &statistics.p99 };
+	uint64_t cumulative = 0;
+	int quantile = 0;
+	for (int i = 0; i < PROFILE_BUCKET_COUNT && quantile < 3; i++) {
+		cumulative += buckets[i];
+		while (quantile < 3 && cumulative >= quantiles[quantile] * count) {
+			*results[quantile] = std::min(getProfileBucketLimit(i), double(max)) / 1000.0;
+			quantile++;
+		}
+	}
+}
+
+/*
+* Start over. This can be called from any thread, the histograms are cleared by their owners, see record.
+*/
+void Profiler::reset() {
+	this->generation.fetch_add(1, std::memory_order_acq_rel);
+	for (int i = 0; i < PROFILE_GAUGE_COUNT; i++) {
+		this->gauges[i] = 0;
+		this->gaugeMaxima[i] = 0;
+	}
+}
+
+void Profiler::writeCsv(std::ostream& out) {
+	out << "stage,count,meanMs,p50Ms,p95Ms,p99Ms,maxMs" << std::endl;
+	for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+		ProfileStage stage = ProfileStage(i);
+		StageStatistics statistics;
+		this->getStatistics(stage, statistics);
+		out << getProfileStageName(stage) << "," << statistics.count << "," << statistics.mean << ","
+			<< statistics.p50 << "," << statistics.p95 << "," << statistics.p99 << "," << statistics.max << std::endl;
+	}
+
+	// the gauges follow as a second table
+	out << std::endl << "gauge,value,max" << std::endl;
+	for (int i = 0; i < PROFILE_GAUGE_COUNT; i++) {
+		out << getProfileGaugeName(ProfileGauge(i)) << "," << this->gauges[i].load() << "," << this->gaugeMaxima[i].load() << std::endl;
+	}
+}
+
+void Profiler::writeJson(std::ostream& out) {
+	out << "{" << std::endl;
+	for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+		ProfileStage stage = ProfileStage(i);
+		StageStatistics statistics;
+		this->getStatistics(stage, statistics);
+		out << "  \"" << getProfileStageName(stage) << "\": {\"count\": " << statistics.count
+			<< ", \"meanMs\": " << statistics.mean << ", \"p50Ms\": " << statistics.p50
+			<< ", \"p95Ms\": " << statistics.p95 << ", \"p99Ms\": " << statistics.p99
+			<< ", \"maxMs\": " << statistics.max << "}," << std::endl;
+	}
+	out << "  \"gauges\": {" << std::endl;
+	for (int i = 0; i < PROFILE_GAUGE_COUNT; i++) {
+		out << "    \"" << getProfileGaugeName(ProfileGauge(i)) << "\": {\"value\": " << this->gauges[i].load()
+			<< ", \"max\": " << this->gaugeMaxima[i].load() << "}" << (i + 1 < PROFILE_GAUGE_COUNT ? "," : "") << std::endl;
+	}
+	out << "  }" << std::endl;
+	out << "}" << std::endl;
+}
+
+/*
+* Write the statistics to a file, json if the path ends with .json, csv otherwise.
+*/
+bool Profiler::dump(std::string path) {
+	std::lock_guard<std::mutex> lock(this->dumpMutex);
+	std::ofstream out(path);
+	if (!out.is_open()) {
+		std::cerr << "Cannot write the profile: " << path << std::endl;
+		return false;
+	}
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	if (json)
+		this->writeJson(out);
+	else
+		this->writeCsv(out);
+	return true;
+}
+
+/*
+* Dump to the path every intervalSeconds, checked in dumpIfDue. An interval of 0 turns this off.
+*/
+void Profiler::setPeriodicDump(std::string path, double intervalSeconds) {
+	std::lock_guard<std::mutex> lock(this->dumpMutex);
+	this->periodicPath = path;
+	this->periodicInterval = intervalSeconds;
+	this->nextDump = 0;
+}
+
+void Profiler::dumpIfDue() {
+	double interval = this->periodicInterval.load(std::memory_order_relaxed);
+	if (interval <= 0 || this->isEnabled() == false)
+		return;
+
+	long long now = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	long long due = this->nextDump.load();
+	if (now < due)
+		return;
+
+	// only one thread wins the dump
+	if (this->nextDump.compare_exchange_strong(due, now + (long long)(interval * 1000)) == false)
+		return;
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(this->dumpMutex);
+		path = this->periodicPath;
+	}
+	this->dump(path);
+}
+
+
+
+ProfileTimer::ProfileTimer(ProfileStage stage) {
+	this->stage = stage;
+	this->running = Profiler::instance().isEnabled();
+	if (this->running)
+		this->start = std::chrono::high_resolution_clock::now();
+}
+
+ProfileTimer::~ProfileTimer() {
+	this->stop();
+}
+
+void ProfileTimer::stop() {
+	if (this->running == false)
+		return;
+	this->running = false;
+	auto elapsed = std::chrono::high_resolution_clock::now() - this->start;
+	Profiler::instance().record(this->stage, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
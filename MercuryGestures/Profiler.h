@@ -0,0 +1,138 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include <atomic>
+#include <mutex>
+
+/*
+* Per stage latency instrumentation. The stages are timed with a scoped timer which feeds a histogram of the thread
+* it runs on. Recording only does relaxed atomic adds on counters owned by that thread, no locks are taken. The dump
+* merges the histograms of all threads and reports the percentiles per stage. A reset only starts a new generation,
+* every thread clears its own histograms when it records the next time.
+*
+* The timers are only compiled in when MERCURY_PROFILING is defined. When compiled in they can be switched on and off
+* at runtime, a disabled timer costs one relaxed atomic load.
+*/
+enum ProfileStage {
+	PROFILE_FRAME = 0,
+	PROFILE_FACE,
+	PROFILE_SKIN,
+	PROFILE_EDGES,
+	PROFILE_MOVEMENT_DETECT,
+	PROFILE_MOVEMENT_CALCULATE,
+	PROFILE_HANDS,
+	PROFILE_CONTOURS,
+	PROFILE_HAND_SOLVE,
+	PROFILE_OPTICAL_FLOW,
+	PROFILE_LOOK_AROUND,
+	PROFILE_STAGE_COUNT
+};
+
+const char* getProfileStageName(ProfileStage stage);
+
+/*
+* Values that are reported as they are instead of timed, the last and the highest value are kept.
+*/
+enum ProfileGauge {
+	GAUGE_QUALITY_LEVEL = 0,
+	GAUGE_SMOOTHED_LATENCY,
+	PROFILE_GAUGE_COUNT
+};
+
+const char* getProfileGaugeName(ProfileGauge gauge);
+
+// 8 buckets per power of two microseconds, up to 2^28 us (~4.5 minutes).
+const int PROFILE_BUCKETS_PER_OCTAVE = 8;
+const int PROFILE_BUCKET_COUNT = 1 + 28 * PROFILE_BUCKETS_PER_OCTAVE;
+
+/*
+* Histogram of a single stage on a single thread. Only the owning thread writes.
+*/
+struct StageHistogram {
+	std::atomic<uint32_t> buckets[PROFILE_BUCKET_COUNT];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> totalMicroseconds;
+	std::atomic<uint64_t> maxMicroseconds;
+
+	StageHistogram();
+	void record(uint64_t microseconds);
+	void reset();
+};
+
+struct ThreadProfile {
+	StageHistogram stages[PROFILE_STAGE_COUNT];
+	std::atomic<uint64_t> generation; // the reset the histograms were cleared for, see Profiler::reset
+
+	ThreadProfile();
+};
+
+/*
+* The merged statistics of one stage, times in ms.
+*/
+struct StageStatistics {
+	uint64_t count = 0;
+	double mean = 0;
+	double p50 = 0;
+	double p95 = 0;
+	double p99 = 0;
+	double max = 0;
+};
+
+class Profiler {
+public:
+	static Profiler& instance();
+
+	std::atomic<bool> enabled;
+
+	void setEnabled(bool enabled);
+	bool isEnabled();
+	void record(ProfileStage stage, uint64_t microseconds);
+	void setGauge(ProfileGauge gauge, double value);
+	void getStatistics(ProfileStage stage, StageStatistics& statistics);
+	void reset();
+
+	void writeCsv(std::ostream& out);
+	void writeJson(std::ostream& out);
+	bool dump(std::string path);
+	void setPeriodicDump(std::string path, double intervalSeconds);
+	void dumpIfDue();
+
+private:
+	std::mutex registryMutex;
+	std::vector<ThreadProfile*> threadProfiles; // never freed, threads can end before the dump
+	std::mutex dumpMutex;
+	std::string periodicPath;           // guarded by dumpMutex
+	std::atomic<double> periodicInterval;
+	std::atomic<long long> nextDump;
+	std::atomic<uint64_t> generation;   // counts the resets
+	std::atomic<double> gauges[PROFILE_GAUGE_COUNT];
+	std::atomic<double> gaugeMaxima[PROFILE_GAUGE_COUNT];
+
+	Profiler();
+	ThreadProfile& getThreadProfile();
+};
+
+/*
+* Time the lifetime of this object, or until stop() is called.
+*/
+class ProfileTimer {
+public:
+	ProfileTimer(ProfileStage stage);
+	~ProfileTimer();
+	void stop();
+
+private:
+	ProfileStage stage;
+	bool running;
+	std::chrono::high_resolution_clock::time_point start;
+};
+
+#ifdef MERCURY_PROFILING
+#define PROFILE_SCOPE(stage) ProfileTimer profileScopeTimer(stage)
+#define PROFILE_BEGIN(timer, stage) ProfileTimer timer(stage)
+#define PROFILE_END(timer) timer.stop()
+#else
+#define PROFILE_SCOPE(stage)
+#define PROFILE_BEGIN(timer, stage)
+#define PROFILE_END(timer)
+#endif
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "PublishSinks.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+#else
+typedef int SocketHandle;
+#endif
+
+StreamSink::StreamSink(std::ostream& out, bool writeHeader) : out(out) {
+	if (writeHeader)
+		this->out << getRecordHeader();
+}
+
+void StreamSink::write(const PublishRecord& record) {
+	char line[256];
+	int length = formatRecord(record, line, sizeof(line));
+	this->out.write(line, length);
+}
+
+void StreamSink::flush() {
+	this->out.flush();
+}
+
+
+UdpSink::UdpSink() {
+#ifdef _WIN32
+	WSADATA data;
+	WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+UdpSink::~UdpSink() {
+	this->close();
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+/*
+* Resolve the host and create the socket. Returns false if either failed.
+*/
+bool UdpSink::open(std::string host, int port) {
+	this->close();
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	addrinfo* resolved = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &resolved) != 0 || resolved == nullptr) {
+		std::cerr << "Cannot resolve the publish host: " << host << std::endl;
+		return false;
+	}
+
+	SocketHandle handle = socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+#ifdef _WIN32
+	bool valid = handle != INVALID_SOCKET;
+#else
+	bool valid = handle >= 0;
+#endif
+	if (valid) {
+		this->socketHandle = intptr_t(handle);
+		const char* address = reinterpret_cast<const char*>(resolved->ai_addr);
+		this->address.assign(address, address + resolved->ai_addrlen);
+	}
+	else {
+		std::cerr << "Cannot create the publish socket" << std::endl;
+	}
+	freeaddrinfo(resolved);
+	return valid;
+}
+
+void UdpSink::close() {
+	if (this->socketHandle == -1)
+		return;
+#ifdef _WIN32
+	closesocket(SocketHandle(this->socketHandle));
+#else
+	::close(SocketHandle(this->socketHandle));
+#endif
+	this->socketHandle = -1;
+}
+
+void UdpSink::write(const PublishRecord& record) {
+	if (this->socketHandle == -1)
+		return;
+	char line[256];
+	int length = formatRecord(record, line, sizeof(line));
+	auto sent = sendto(SocketHandle(this->socketHandle), line, length, 0,
+		reinterpret_cast<const sockaddr*>(this->address.data()), int(this->address.size()));
+	if (sent != length)
+		this->failed++;
+}
+
+long long UdpSink::getFailedCount() {
+	return this->failed;
+}
+
+
+std::unique_ptr<PublishSink> createSink(std::string target) {
+	if (target == "stdout")
+		return std::unique_ptr<PublishSink>(new StreamSink(std::cout));
+
+	std::string prefix = "udp://";
+	size_t colon = target.find_last_of(':');
+	if (target.compare(0, prefix.size(), prefix) == 0 && colon != std::string::npos && colon > prefix.size()) {
+		std::string host = target.substr(prefix.size(), colon - prefix.size());
+		int port = std::atoi(target.substr(colon + 1).c_str());
+		std::unique_ptr<UdpSink> sink(new UdpSink());
+		if (port > 0 && sink->open(host, port))
+			return std::move(sink);
+		return nullptr;
+	}
+
+	std::cerr << "Unknown publish target: " << target << " (use stdout or udp://host:port)" << std::endl;
+	return nullptr;
+}
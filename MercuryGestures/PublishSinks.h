@@ -0,0 +1,42 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "ResultPublisher.h"
+
+/*
+* Write the records as csv lines to a stream (stdout or a file).
+*/
+class StreamSink : public PublishSink {
+public:
+	StreamSink(std::ostream& out, bool writeHeader = true);
+	void write(const PublishRecord& record);
+	void flush();
+
+private:
+	std::ostream& out;
+};
+
+/*
+* Send every record as a csv line in its own UDP datagram. There is no connection, if nobody listens the records
+* are lost, which is what we want for a live value.
+*/
+class UdpSink : public PublishSink {
+public:
+	UdpSink();
+	~UdpSink();
+
+	bool open(std::string host, int port);
+	void close();
+	void write(const PublishRecord& record);
+	long long getFailedCount();
+
+private:
+	intptr_t socketHandle = -1;
+	std::vector<char> address; // the resolved sockaddr
+	long long failed = 0;
+};
+
+/*
+* Make a sink from a target description: "stdout" or "udp://host:port". Returns nullptr if the target is invalid.
+*/
+std::unique_ptr<PublishSink> createSink(std::string target);
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "ResultFile.h"
+#include <cstddef>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	const char resultFileMagic[8] = { 'M', 'G', 'R', 'E', 'S', 'U', 'L', 'T' };
+
+	void addColumn(std::vector<ResultFileColumn>& columns, std::string name, ResultColumnType type, size_t offset) {
+		ResultFileColumn column = {};
+		std::strncpy(column.name, name.c_str(), sizeof(column.name) - 1);
+		column.type = type;
+		column.offset = uint32_t(offset);
+		columns.push_back(column);
+	}
+
+	int16_t clamp16(int value) {
+		return int16_t(std::max(-32768, std::min(32767, value)));
+	}
+
+	// bytes of a value of the column type, 0 for a type we do not know
+	size_t getColumnTypeSize(uint32_t type) {
+		switch (type) {
+		case COLUMN_UINT8:   return 1;
+		case COLUMN_INT16:   return 2;
+		case COLUMN_INT32:   return 4;
+		case COLUMN_INT64:   return 8;
+		case COLUMN_FLOAT32: return 4;
+		}
+		return 0;
+	}
+}
+
+void toResultFileRecord(PipelineResult& result, ResultFileRecord& record) {
+	std::memset(&record, 0, sizeof(record));
+	record.frameIndex = result.frameIndex;
+	record.faceDetected = result.faceDetected;
+	record.valid = result.valid;
+	record.blobCount = result.blobCount;
+	record.timestamp = result.timestamp;
+	record.movement = float(result.movementValue);
+	record.movementFiltered = float(result.movementFilteredValue);
+	record.ROImovement = float(result.ROImovementValue);
+	record.ROImovementFiltered = float(result.ROImovementFilteredValue);
+	record.cmInPixels = float(result.cmInPixels);
+	record.leftX = clamp16(result.leftHand.x);
+	record.leftY = clamp16(result.leftHand.y);
+	record.rightX = clamp16(result.rightHand.x);
+	record.rightY = clamp16(result.rightHand.y);
+	record.faceX = clamp16(result.face.x);
+	record.faceY = clamp16(result.face.y);
+	record.faceWidth = clamp16(result.face.width);
+	record.faceHeight = clamp16(result.face.height);
+	record.duration = float(result.duration);
+	for (int i = 0; i < result.blobCount; i++) {
+		BlobSummary& blob = result.blobs[i];
+		ResultFileBlob& out = record.blobs[i];
+		out.x = clamp16(blob.rect.x);
+		out.y = clamp16(blob.rect.y);
+		out.width = clamp16(blob.rect.width);
+		out.height = clamp16(blob.rect.height);
+		out.centerX = clamp16(blob.center.x);
+		out.centerY = clamp16(blob.center.y);
+		out.area = blob.area;
+		out.type = uint8_t(blob.type);
+	}
+}
+
+/*
+* The column table of the current record layout.
+*/
+std::vector<ResultFileColumn> getResultFileColumns() {
+	std::vector<ResultFileColumn> columns;
+	addColumn(columns, "frame", COLUMN_INT32, offsetof(ResultFileRecord, frameIndex));
+	addColumn(columns, "faceDetected", COLUMN_UINT8, offsetof(ResultFileRecord, faceDetected));
+	addColumn(columns, "valid", COLUMN_UINT8, offsetof(ResultFileRecord, valid));
+	addColumn(columns, "blobCount", COLUMN_UINT8, offsetof(ResultFileRecord, blobCount));
+	addColumn(columns, "timestamp", COLUMN_INT64, offsetof(ResultFileRecord, timestamp));
+	addColumn(columns, "movement", COLUMN_FLOAT32, offsetof(ResultFileRecord, movement));
+	addColumn(columns, "movementFiltered", COLUMN_FLOAT32, offsetof(ResultFileRecord, movementFiltered));
+	addColumn(columns, "ROImovement", COLUMN_FLOAT32, offsetof(ResultFileRecord, ROImovement));
+	addColumn(columns, "ROImovementFiltered", COLUMN_FLOAT32, offsetof(ResultFileRecord, ROImovementFiltered));
+	addColumn(columns, "cmInPixels", COLUMN_FLOAT32, offsetof(ResultFileRecord, cmInPixels));
+	addColumn(columns, "leftX", COLUMN_INT16, offsetof(ResultFileRecord, leftX));
+	addColumn(columns, "leftY", COLUMN_INT16, offsetof(ResultFileRecord, leftY));
+	addColumn(columns, "rightX", COLUMN_INT16, offsetof(ResultFileRecord, rightX));
+	addColumn(columns, "rightY", COLUMN_INT16, offsetof(ResultFileRecord, rightY));
+	addColumn(columns, "faceX", COLUMN_INT16, offsetof(ResultFileRecord, faceX));
+	addColumn(columns, "faceY", COLUMN_INT16, offsetof(ResultFileRecord, faceY));
+	addColumn(columns, "faceWidth", COLUMN_INT16, offsetof(ResultFileRecord, faceWidth));
+	addColumn(columns, "faceHeight", COLUMN_INT16, offsetof(ResultFileRecord, faceHeight));
+	addColumn(columns, "ms", COLUMN_FLOAT32, offsetof(ResultFileRecord, duration));
+	for (int i = 0; i < maxResultBlobs; i++) {
+		std::string prefix = joinString("blob", i);
+		size_t base = offsetof(ResultFileRecord, blobs) + i * sizeof(ResultFileBlob);
+		addColumn(columns, prefix + "X", COLUMN_INT16, base + offsetof(ResultFileBlob, x));
+		addColumn(columns, prefix + "Y", COLUMN_INT16, base + offsetof(ResultFileBlob, y));
+		addColumn(columns, prefix + "Width", COLUMN_INT16, base + offsetof(ResultFileBlob, width));
+		addColumn(columns, prefix + "Height", COLUMN_INT16, base + offsetof(ResultFileBlob, height));
+		addColumn(columns, prefix + "CenterX", COLUMN_INT16, base + offsetof(ResultFileBlob, centerX));
+		addColumn(columns, prefix + "CenterY", COLUMN_INT16, base + offsetof(ResultFileBlob, centerY));
+		addColumn(columns, prefix + "Area", COLUMN_INT32, base + offsetof(ResultFileBlob, area));
+		addColumn(columns, prefix + "Type", COLUMN_UINT8, base + offsetof(ResultFileBlob, type));
+	}
+	return columns;
+}
+
+
+ResultFileWriter::ResultFileWriter() {}
+
+ResultFileWriter::~ResultFileWriter() {
+	this->close();
+}
+
+/*
+* Create the file and write the header and column table.
+*/
+bool ResultFileWriter::open(std::string path, double fps) {
+	this->close();
+	this->out.open(path, std::ios::binary | std::ios::trunc);
+	if (!this->out.is_open())
+		return false;
+
+	std::vector<ResultFileColumn> columns = getResultFileColumns();
+	std::memset(&this->header, 0, sizeof(this->header));
+	std::memcpy(this->header.magic, resultFileMagic, sizeof(resultFileMagic));
+	this->header.version = resultFileVersion;
+	this->header.headerSize = sizeof(ResultFileHeader) + columns.size() * sizeof(ResultFileColumn);
+	this->header.recordSize = sizeof(ResultFileRecord);
+	this->header.columnCount = columns.size();
+	this->header.fps = fps;
+	this->cmInPixelsSum = 0;
+	this->validFrames = 0;
+
+	this->out.write(reinterpret_cast<const char*>(&this->header), sizeof(this->header));
+	this->out.write(reinterpret_cast<const char*>(columns.data()), columns.size() * sizeof(ResultFileColumn));
+	return this->out.good();
+}
+
+/*
+* The frame size is only known after the first frame, like the totals it is written to the header on close.
+*/
+void ResultFileWriter::setFrameSize(int frameWidth, int frameHeight) {
+	this->header.frameWidth = frameWidth;
+	this->header.frameHeight = frameHeight;
+}
+
+/*
+* Append the record of a frame. Returns false if the file could not be written.
+*/
+bool ResultFileWriter::write(PipelineResult& result) {
+	if (result.valid) {
+		this->cmInPixelsSum += result.cmInPixels;
+		this->validFrames++;
+	}
+	ResultFileRecord record;
+	toResultFileRecord(result, record);
+	this->out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+	this->header.recordCount++;
+	return this->out.good();
+}
+
+/*
+* Fill in the totals in the header and close the file. Returns false if any write failed, also those of earlier frames.
+*/
+bool ResultFileWriter::close() {
+	if (!this->out.is_open())
+		return true;
+	this->header.cmInPixels = this->validFrames > 0 ? this->cmInPixelsSum / this->validFrames : 0;
+	this->out.seekp(0);
+	this->out.write(reinterpret_cast<const char*>(&this->header), sizeof(this->header));
+	this->out.close();
+	return this->out.good();
+}
+
+bool ResultFileWriter::isOpen() {
+	return this->out.is_open();
+}
+
+
+ResultFileReader::ResultFileReader() {}
+
+ResultFileReader::~ResultFileReader() {
+	this->close();
+}
+
+/*
+* Map the file and check the header and the column table. Returns false if the file cannot be mapped, is not a result
+* file of a version we can read, or has a column that does not fit in the record.
+*/
+bool ResultFileReader::open(std::string path) {
+	this->close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	this->fileHandle = intptr_t(file);
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) == FALSE || fileSize.QuadPart < sizeof(ResultFileHeader)) {
+		this->close();
+		return false;
+	}
+	this->size = size_t(fileSize.QuadPart);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		this->close();
+		return false;
+	}
+	this->mappingHandle = intptr_t(mapping);
+	this->data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+	this->fileHandle = file;
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || fileStat.st_size < off_t(sizeof(ResultFileHeader))) {
+		this->close();
+		return false;
+	}
+	this->size = size_t(fileStat.st_size);
+	void* mapped = mmap(nullptr, this->size, PROT_READ, MAP_SHARED, file, 0);
+	this->data = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+#endif
+	if (this->data == nullptr) {
+		this->close();
+		return false;
+	}
+
+	this->header = reinterpret_cast<const ResultFileHeader*>(this->data);
+	if (std::memcmp(this->header->magic, resultFileMagic, sizeof(resultFileMagic)) != 0 ||
+		this->header->version != resultFileVersion ||
+		this->header->recordSize == 0 ||
+		this->header->headerSize > this->size ||
+		this->header->headerSize < sizeof(ResultFileHeader) + uint64_t(this->header->columnCount) * sizeof(ResultFileColumn)) {
+		std::cerr << "Not a readable result file: " << path << std::endl;
+		this->close();
+		return false;
+	}
+	this->columns = reinterpret_cast<const ResultFileColumn*>(this->data + sizeof(ResultFileHeader));
+
+	// getValue and findColumn trust the table, so every column has to lie within the record and have a name
+	for (uint32_t i = 0; i < this->header->columnCount; i++) {
+		const ResultFileColumn& column = this->columns[i];
+		size_t typeSize = getColumnTypeSize(column.type);
+		if (typeSize == 0 || uint64_t(column.offset) + typeSize > this->header->recordSize ||
+			std::memchr(column.name, 0, sizeof(column.name)) == nullptr) {
+			std::cerr << "Invalid column " << i << " in the result file: " << path << std::endl;
+			this->close();
+			return false;
+		}
+	}
+	// a file that is still being written (or was cut short) ends in a partial record, which we leave out.
+	this->recordCount = (this->size - this->header->headerSize) / this->header->recordSize;
+	return true;
+}
+
+void ResultFileReader::close() {
+#ifdef _WIN32
+	if (this->data != nullptr)
+		UnmapViewOfFile(this->data);
+	if (this->mappingHandle != 0)
+		CloseHandle(HANDLE(this->mappingHandle));
+	if (this->fileHandle != -1)
+		CloseHandle(HANDLE(this->fileHandle));
+#else
+	if (this->data != nullptr)
+		munmap(const_cast<char*>(this->data), this->size);
+	if (this->fileHandle != -1)
+		::close(int(this->fileHandle));
+#endif
+	this->data = nullptr;
+	this->size = 0;
+	this->fileHandle = -1;
+	this->mappingHandle = 0;
+	this->header = nullptr;
+	this->columns = nullptr;
+	this->recordCount = 0;
+}
+
+const ResultFileHeader& ResultFileReader::getHeader() {
+	return *this->header;
+}
+
+int64_t ResultFileReader::getRecordCount() {
+	return this->recordCount;
+}
+
+/*
+* The record in place. This needs the layout of this build, check getHeader().recordSize, or use getValue.
+*/
+const ResultFileRecord& ResultFileReader::getRecord(int64_t index) {
+	return *reinterpret_cast<const ResultFileRecord*>(this->data + this->header->headerSize + index * this->header->recordSize);
+}
+
+int ResultFileReader::getColumnCount() {
+	return this->header->columnCount;
+}
+
+const ResultFileColumn& ResultFileReader::getColumn(int index) {
+	return this->columns[index];
+}
+
+/*
+* Get a column by name from the table of the file, nullptr if the file does not have it.
+*/
+const ResultFileColumn* ResultFileReader::findColumn(std::string name) {
+	for (uint32_t i = 0; i < this->header->columnCount; i++) {
+		if (name == this->columns[i].name)
+			return &this->columns[i];
+	}
+	return nullptr;
+}
+
+/*
+* Read a value through the column table. This works for files written with another record layout as well. The columns
+* are checked on open, an index outside of the records gives 0.
+*/
+double ResultFileReader::getValue(int64_t index, const ResultFileColumn& column) {
+	if (index < 0 || index >= this->recordCount)
+		return 0;
+	const char* field = this->data + this->header->headerSize + index * this->header->recordSize + column.offset;
+	switch (column.type) {
+	case COLUMN_UINT8:   return *reinterpret_cast<const uint8_t*>(field);
+	case COLUMN_INT16:   { int16_t value; std::memcpy(&value, field, sizeof(value)); return value; }
+	case COLUMN_INT32:   { int32_t value; std::memcpy(&value, field, sizeof(value)); return value; }
+	case COLUMN_INT64:   { int64_t value; std::memcpy(&value, field, sizeof(value)); return double(value); }
+	case COLUMN_FLOAT32: { float value; std::memcpy(&value, field, sizeof(value)); return value; }
+	}
+	return 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Pipeline.h"
+#include <cstdint>
+#include <fstream>
+
+/*
+* A binary file with the results of every frame of a video, for the offline analysis of large corpora.
+*
+* The file is a header, a table describing the columns and then one fixed size record per frame. Records are only
+* appended, so a file that was cut short is still readable up to the last complete record. The column table gives
+* the name, type and offset of every field in the record, so readers can scan a single column with the record size as
+* stride without knowing this struct. All values are little endian.
+*/
+
+const uint32_t resultFileVersion = 1;
+
+enum ResultColumnType {
+	COLUMN_UINT8,
+	COLUMN_INT16,
+	COLUMN_INT32,
+	COLUMN_INT64,
+	COLUMN_FLOAT32
+};
+
+struct ResultFileHeader {
+	char magic[8];          // "MGRESULT"
+	uint32_t version;
+	uint32_t headerSize;    // header and column table, the records start here
+	uint32_t recordSize;
+	uint32_t columnCount;
+	double fps;
+	int32_t frameWidth;
+	int32_t frameHeight;
+	double cmInPixels;      // average over the valid frames, written on close
+	int64_t recordCount;    // written on close, readers use the file size
+	uint8_t reserved[16];
+};
+
+struct ResultFileColumn {
+	char name[24];
+	uint32_t type;          // ResultColumnType
+	uint32_t offset;        // in the record
+};
+
+struct ResultFileBlob {
+	int16_t x, y, width, height;
+	int16_t centerX, centerY;
+	int32_t area;
+	uint8_t type;           // BlobType
+	uint8_t padding[3];
+};
+
+struct ResultFileRecord {
+	int32_t frameIndex;
+	uint8_t faceDetected;
+	uint8_t valid;
+	uint8_t blobCount;
+	uint8_t padding;
+	int64_t timestamp;      // capture time in us since the epoch
+	float movement;
+	float movementFiltered;
+	float ROImovement;
+	float ROImovementFiltered;
+	float cmInPixels;
+	int16_t leftX, leftY;
+	int16_t rightX, rightY;
+	int16_t faceX, faceY, faceWidth, faceHeight;
+	float duration;         // processing time in ms
+	ResultFileBlob blobs[maxResultBlobs];
+};
+
+static_assert(sizeof(ResultFileHeader) == 72, "the result file header has to be packed");
+static_assert(sizeof(ResultFileRecord) == 56 + 20 * maxResultBlobs, "the result file record has to be packed");
+
+void toResultFileRecord(PipelineResult& result, ResultFileRecord& record);
+std::vector<ResultFileColumn> getResultFileColumns();
+
+/*
+* Append the results of a video to a result file.
+*/
+class ResultFileWriter {
+public:
+	ResultFileWriter();
+	~ResultFileWriter();
+
+	bool open(std::string path, double fps);
+	void setFrameSize(int frameWidth, int frameHeight);
+	bool write(PipelineResult& result);
+	bool close();
+	bool isOpen();
+
+private:
+	std::ofstream out;
+	ResultFileHeader header;
+	double cmInPixelsSum = 0;
+	int validFrames = 0;
+};
+
+/*
+* Read a result file through a memory map. Nothing is parsed, the records are used in place.
+*/
+class ResultFileReader {
+public:
+	ResultFileReader();
+	~ResultFileReader();
+
+	bool open(std::string path);
+	void close();
+
+	const ResultFileHeader& getHeader();
+	int64_t getRecordCount();
+	const ResultFileRecord& getRecord(int64_t index);
+	int getColumnCount();
+	const ResultFileColumn& getColumn(int index);
+	const ResultFileColumn* findColumn(std::string name);
+	double getValue(int64_t index, const ResultFileColumn& column);
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+	intptr_t fileHandle = -1;
+	intptr_t mappingHandle = 0;
+	const ResultFileHeader* header = nullptr;
+	const ResultFileColumn* columns = nullptr;
+	int64_t recordCount = 0;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "ResultPublisher.h"
+
+PublishRecord toPublishRecord(PipelineResult& result, int stream) {
+	PublishRecord record;
+	record.stream = stream;
+	record.frameIndex = result.frameIndex;
+	record.timestamp = result.timestamp;
+	record.faceDetected = result.faceDetected;
+	record.valid = result.valid;
+	record.movementValue = result.movementValue;
+	record.movementFilteredValue = result.movementFilteredValue;
+	record.ROImovementValue = result.ROImovementValue;
+	record.ROImovementFilteredValue = result.ROImovementFilteredValue;
+	record.leftX = result.leftHand.x;
+	record.leftY = result.leftHand.y;
+	record.rightX = result.rightHand.x;
+	record.rightY = result.rightHand.y;
+	record.faceX = result.face.x;
+	record.faceY = result.face.y;
+	record.faceWidth = result.face.width;
+	record.faceHeight = result.face.height;
+	return record;
+}
+
+const char* getRecordHeader() {
+	return "stream,frame,timestamp,faceDetected,valid,movement,movementFiltered,ROImovement,ROImovementFiltered,"
+		"leftX,leftY,rightX,rightY,faceX,faceY,faceWidth,faceHeight\n";
+}
+
+int formatRecord(const PublishRecord& record, char* buffer, int size) {
+	int length = snprintf(buffer, size, "%d,%d,%lld,%d,%d,%.6g,%.6g,%.6g,%.6g,%d,%d,%d,%d,%d,%d,%d,%d\n",
+		record.stream, record.frameIndex, record.timestamp, int(record.faceDetected), int(record.valid),
+		record.movementValue, record.movementFilteredValue, record.ROImovementValue, record.ROImovementFilteredValue,
+		record.leftX, record.leftY, record.rightX, record.rightY,
+		record.faceX, record.faceY, record.faceWidth, record.faceHeight);
+	return length > 0 && length < size ? length : 0;
+}
+
+
+ResultPublisher::ResultPublisher(int capacity) : ring(capacity) {
+	this->waiting = false;
+	this->running = false;
+	this->published = 0;
+	this->dropped = 0;
+}
+
+ResultPublisher::~ResultPublisher() {
+	this->stop();
+}
+
+/*
+* Sinks have to be added before start().
+*/
+void ResultPublisher::addSink(std::unique_ptr<PublishSink> sink) {
+	this->sinks.push_back(std::move(sink));
+}
+
+void ResultPublisher::start() {
+	if (this->running)
+		return;
+	this->running = true;
+	this->thread = std::thread(&ResultPublisher::loop, this);
+}
+
+/*
+* Write the records still in the ring and stop the publisher thread.
+*/
+void ResultPublisher::stop() {
+	if (this->running == false)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(this->wakeMutex);
+		this->running = false;
+		this->wake.notify_one();
+	}
+	this->thread.join();
+}
+
+bool ResultPublisher::publish(PipelineResult& result, int stream) {
+	return this->publish(toPublishRecord(result, stream));
+}
+
+bool ResultPublisher::publish(const PublishRecord& record) {
+	if (this->ring.tryPush(record) == false) {
+		this->dropped++;
+		return false;
+	}
+	this->published++;
+
+	// only wake the publisher thread if it is asleep, while it is busy this costs nothing.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (this->waiting) {
+		std::lock_guard<std::mutex> lock(this->wakeMutex);
+		this->wake.notify_one();
+	}
+	return true;
+}
+
+long long ResultPublisher::getPublishedCount() {
+	return this->published;
+}
+
+long long ResultPublisher::getDroppedCount() {
+	return this->dropped;
+}
+
+void ResultPublisher::loop() {
+	PublishRecord record;
+	for (;;) {
+		bool wrote = false;
+		while (this->ring.tryPop(record)) {
+			for (auto& sink : this->sinks)
+				sink->write(record);
+			wrote = true;
+		}
+		if (wrote) {
+			for (auto& sink : this->sinks)
+				sink->flush();
+		}
+
+		std::unique_lock<std::mutex> lock(this->wakeMutex);
+		this->waiting = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		this->wake.wait(lock, [this] { return this->running == false || this->ring.empty() == false; });
+		this->waiting = false;
+		if (this->running == false && this->ring.empty())
+			return;
+	}
+}
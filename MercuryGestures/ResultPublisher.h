@@ -0,0 +1,79 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Pipeline.h"
+#include "SpscRing.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+* The published values of a single frame. This is a plain struct so it can be copied through the ring cheaply.
+*/
+struct PublishRecord {
+	int stream = 0;
+	int frameIndex = 0;
+	long long timestamp = 0;		// capture time in us since the epoch
+	bool faceDetected = false;
+	bool valid = false;
+	double movementValue = 0;
+	double movementFilteredValue = 0;
+	double ROImovementValue = 0;	// the value for SSI
+	double ROImovementFilteredValue = 0;
+	int leftX = 0, leftY = 0;
+	int rightX = 0, rightY = 0;
+	int faceX = 0, faceY = 0, faceWidth = 0, faceHeight = 0;
+};
+
+PublishRecord toPublishRecord(PipelineResult& result, int stream = 0);
+
+/*
+* Format a record as a single csv line (with newline) into the buffer. Returns the length, or 0 if it does not fit.
+*/
+int formatRecord(const PublishRecord& record, char* buffer, int size);
+const char* getRecordHeader();
+
+/*
+* A destination of the records. Sinks are only called from the publisher thread, so they may block.
+*/
+class PublishSink {
+public:
+	virtual ~PublishSink() {}
+	virtual void write(const PublishRecord& record) = 0;
+	virtual void flush() {}
+};
+
+/*
+* Hands the records from the detection thread to the sinks. publish copies the record into a lock free ring and
+* returns, the publisher thread writes it to all sinks. If the sinks cannot keep up the ring fills and new records are
+* dropped (and counted), the detection thread never waits for I/O.
+* publish must always be called from the same thread (or under a lock).
+*/
+class ResultPublisher {
+public:
+	ResultPublisher(int capacity = 1024);
+	~ResultPublisher();
+
+	void addSink(std::unique_ptr<PublishSink> sink);
+	void start();
+	void stop();
+	bool publish(PipelineResult& result, int stream = 0);
+	bool publish(const PublishRecord& record);
+	long long getPublishedCount();
+	long long getDroppedCount();
+
+private:
+	SpscRing<PublishRecord> ring;
+	std::vector<std::unique_ptr<PublishSink>> sinks;
+	std::thread thread;
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	std::atomic<bool> waiting;
+	std::atomic<bool> running;
+	std::atomic<long long> published;
+	std::atomic<long long> dropped;
+
+	void loop();
+};
@@ -1,72 +1,343 @@
 #pragma once
 #include "MercuryCore.h"
 #include "SkinDetector.h"
+#include "Profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MERCURY_SSE2
+#endif
 
 SkinDetector::SkinDetector() {}
 SkinDetector::~SkinDetector() {}
 
-/**
-* Get the average color of the skin based on the face.
+/*
+* Only the inner part of the face is used for the skin color, centerFocus of both width and height. This is to ensure
+* we only get skin.
 */
-cv::Scalar SkinDetector::getAverageAreaColor(cv::Rect&area, cv::Mat& frame, bool refine, double centerFocus) {
-	// we only use the inner area, 0.25 -- 0.75 of both width and height. This is to ensure we only get skin
+cv::Rect SkinDetector::getInnerArea(cv::Rect& area, cv::Size frameSize, double centerFocus) {
 	int x = area.x + 0.5*area.width - 0.5*area.width  * centerFocus;
 	int y = area.y + 0.5*area.height - 0.5*area.height * centerFocus;
 	int width = area.width   * centerFocus;
 	int height = area.height * centerFocus;
+	return cv::Rect(x, y, width, height) & cv::Rect(cv::Point(0, 0), frameSize);
+}
 
-	// setup a mask for the mean operation
-	cv::Mat mask = cv::Mat::zeros(frame.rows, frame.cols, CV_8U); // all 0
-	mask(cv::Rect(x, y, width, height)) = 255;
+/**
+* Get the average YCrCb color of the skin based on the face. Only the face area of the BGR frame is converted.
+*/
+cv::Scalar SkinDetector::getAverageAreaColor(cv::Rect&area, cv::Mat& frame, bool refine, double centerFocus) {
+	cv::Rect inner = this->getInnerArea(area, frame.size(), centerFocus);
+	if (inner.area() == 0)
+		return cv::Scalar(0, 0, 0);
+
+	cv::Mat innerFrame = frame(inner);
+	return this->getAverageColor(innerFrame, inner, refine, frame.size());
+}
+
+/*
+* The same for a frame on the device, only the inner face area is downloaded.
+*/
+cv::Scalar SkinDetector::getAverageAreaColor(cv::Rect&area, cv::UMat& frame, bool refine, double centerFocus) {
+	cv::Rect inner = this->getInnerArea(area, frame.size(), centerFocus);
+	if (inner.area() == 0)
+		return cv::Scalar(0, 0, 0);
+
+	frame(inner).copyTo(this->faceFrame);
+	return this->getAverageColor(this->faceFrame, inner, refine, frame.size());
+}
+
+cv::Scalar SkinDetector::getAverageColor(cv::Mat& innerFrame, cv::Rect& inner, bool refine, cv::Size frameSize) {
+	cv::cvtColor(innerFrame, this->faceColors, cv::COLOR_BGR2YCrCb);
 
 	// refining assumes the first skinmap has been created and we will use it to remove the outliers
-	if (refine) {
-		cv::bitwise_and(this->skinMask, mask, mask);
+	if (refine && this->previousSkinMask.size() == frameSize) {
+		return cv::mean(this->faceColors, this->previousSkinMask(inner));
 	}
 
 	// get the mean color
-	cv::Scalar bgrColor = cv::mean(frame, mask);
-	return bgrColor;
+	return cv::mean(this->faceColors);
 }
 
-/**
-* this uses the face area to detect the skin tone of the user (assuming no Burkah). This skin tone is searched for in YCrCb space.
-* The aim is to find the hands and/or arms.
+/*
+* The skin color ranges around the average face color.
 */
-void SkinDetector::detect(cv::Rect& face, cv::Mat& frame, bool refine, int noiseRemovalThreshold) {
-	// keep track of the previous mask
-	this->skinMask.copyTo(this->previousSkinMask);
-	
-	cv::Mat mask;
-	cv::cvtColor(frame, mask, cv::COLOR_BGR2YCrCb);
-
-	auto color = this->getAverageAreaColor(face, mask, refine);
-
-	// color ranges
+bool SkinDetector::updateBounds(cv::Scalar& color) {
 	int Y_MIN = rgbBound(color[0] - 100);  // 0
 	int Y_MAX = rgbBound(color[0] + 100);  // 255
 	int Cr_MIN = rgbBound(color[1] - 10);  // 133
 	int Cr_MAX = rgbBound(color[1] + 20);  // 173
 	int Cb_MIN = rgbBound(color[2] - 30);  // 77
 	int Cb_MAX = rgbBound(color[2] + 10);  // 127
+	return this->updateLookupTable(Y_MIN, Y_MAX, Cr_MIN, Cr_MAX, Cb_MIN, Cb_MAX);
+}
+
+/*
+* Rebuild the lookup table if the bounds changed. Every entry holds a bit per channel: 1 if the value is in the Y range,
+* 2 for the Cr range and 4 for the Cb range. Returns true if the table changed.
+*/
+bool SkinDetector::updateLookupTable(int yMin, int yMax, int crMin, int crMax, int cbMin, int cbMax) {
+	int bounds[6] = { yMin, yMax, crMin, crMax, cbMin, cbMax };
+	if (std::equal(bounds, bounds + 6, this->lookupBounds))
+		return false;
+	std::copy(bounds, bounds + 6, this->lookupBounds);
+
+	for (int i = 0; i < 256; i++) {
+		uchar bits = 0;
+		if (i >= yMin  && i <= yMax)  bits |= 1;
+		if (i >= crMin && i <= crMax) bits |= 2;
+		if (i >= cbMin && i <= cbMax) bits |= 4;
+		this->lookupTable[i] = bits;
+	}
+	return true;
+}
+
+namespace {
+	const int parallelClassifyArea = 160 * 120; // smaller parts, like the changed regions, are classified in one pass
+
+	const int shift = 14;
+	const int round = 1 << (shift - 1);
+	const int delta = 128 << shift;
+	const int cR = 4899, cG = 9617, cB = 1868; // 0.299, 0.587, 0.114
+	const int cCr = 11682, cCb = 9241;         // 0.713, 0.564
+
+#ifdef MERCURY_SSE2
+	/*
+	* Split 32 BGR pixels into 16 byte vectors of a channel: channels[0] and [1] hold B, [2] and [3] G and [4] and [5] R.
+	* Each of the 5 rounds of unpacking interleaves the first half of the vectors with the second half.
+	*/
+	inline void deinterleave(const uchar* bgr, __m128i* channels) {
+		for (int i = 0; i < 6; i++)
+			channels[i] = _mm_loadu_si128((const __m128i*)(bgr + 16 * i));
+		for (int pass = 0; pass < 5; pass++) {
+			__m128i unpacked[6];
+			for (int i = 0; i < 3; i++) {
+				unpacked[2 * i] = _mm_unpacklo_epi8(channels[i], channels[i + 3]);
+				unpacked[2 * i + 1] = _mm_unpackhi_epi8(channels[i], channels[i + 3]);
+			}
+			for (int i = 0; i < 6; i++)
+				channels[i] = unpacked[i];
+		}
+	}
+
+	/*
+	* Y, Cr and Cb of 8 pixels in 16 bit lanes, in the fixed point arithmetic of classifyPixel. Cr and Cb are not clamped,
+	* the saturating pack to bytes does that.
+	*/
+	inline void toYCrCb(__m128i b, __m128i g, __m128i r, __m128i& Y, __m128i& Cr, __m128i& Cb) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128i coefficientsBG = _mm_set1_epi32((cG << 16) | cB);
+		const __m128i coefficientsR = _mm_set1_epi32((round << 16) | cR); // r * cR + 1 * round
+		const __m128i coefficientCr = _mm_set1_epi32(cCr);
+		const __m128i coefficientCb = _mm_set1_epi32(cCb);
+		const __m128i offset = _mm_set1_epi32(delta + round);
+
+		__m128i yLow = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b, g), coefficientsBG), _mm_madd_epi16(_mm_unpacklo_epi16(r, one), coefficientsR));
+		__m128i yHigh = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b, g), coefficientsBG), _mm_madd_epi16(_mm_unpackhi_epi16(r, one), coefficientsR));
+		Y = _mm_packs_epi32(_mm_srai_epi32(yLow, shift), _mm_srai_epi32(yHigh, shift));
+
+		__m128i rY = _mm_sub_epi16(r, Y);
+		__m128i bY = _mm_sub_epi16(b, Y);
+		__m128i crLow = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(rY, zero), coefficientCr), offset);
+		__m128i crHigh = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(rY, zero), coefficientCr), offset);
+		__m128i cbLow = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(bY, zero), coefficientCb), offset);
+		__m128i cbHigh = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(bY, zero), coefficientCb), offset);
+		Cr = _mm_packs_epi32(_mm_srai_epi32(crLow, shift), _mm_srai_epi32(crHigh, shift));
+		Cb = _mm_packs_epi32(_mm_srai_epi32(cbLow, shift), _mm_srai_epi32(cbHigh, shift));
+	}
+
+	/*
+	* 0xFF for the bytes of value within [min, max].
+	*/
+	inline __m128i inRangeVector(__m128i value, __m128i min, __m128i max) {
+		return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(value, min), value), _mm_cmpeq_epi8(_mm_min_epu8(value, max), value));
+	}
+
+	/*
+	* Classify 16 pixels of B, G and R bytes, the vector form of the table test against the bounds it was built for.
+	*/
+	inline __m128i classifyVector(__m128i b, __m128i g, __m128i r, const int* bounds) {
+		const __m128i zero = _mm_setzero_si128();
+		__m128i Y[2], Cr[2], Cb[2];
+		toYCrCb(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(r, zero), Y[0], Cr[0], Cb[0]);
+		toYCrCb(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(r, zero), Y[1], Cr[1], Cb[1]);
+
+		__m128i skin = inRangeVector(_mm_packus_epi16(Y[0], Y[1]), _mm_set1_epi8(char(bounds[0])), _mm_set1_epi8(char(bounds[1])));
+		skin = _mm_and_si128(skin, inRangeVector(_mm_packus_epi16(Cr[0], Cr[1]), _mm_set1_epi8(char(bounds[2])), _mm_set1_epi8(char(bounds[3]))));
+		return _mm_and_si128(skin, inRangeVector(_mm_packus_epi16(Cb[0], Cb[1]), _mm_set1_epi8(char(bounds[4])), _mm_set1_epi8(char(bounds[5]))));
+	}
+#endif
+
+	/*
+	* The conversion to YCrCb is done per pixel in the fixed point arithmetic cvtColor uses (14 bit coefficients), so
+	* the result is the same as cvtColor + inRange without the intermediate 3 channel image.
+	*/
+	inline uchar classifyPixel(const uchar* bgr, const uchar* table) {
+		int b = bgr[0], g = bgr[1], r = bgr[2];
+		int Y = (b * cB + g * cG + r * cR + round) >> shift;
+		int Cr = std::min(255, std::max(0, ((r - Y) * cCr + delta + round) >> shift));
+		int Cb = std::min(255, std::max(0, ((b - Y) * cCb + delta + round) >> shift));
+		uchar bits = (table[Y] & 1) | (table[Cr] & 2) | (table[Cb] & 4);
+		return bits == 7 ? 255 : 0;
+	}
+
+	/*
+	* Classify the rows [start, end) of the frame. With SSE2 32 pixels are classified at a time, the rest of the row
+	* per pixel.
+	*/
+	void classifyRows(const cv::Mat& frame, cv::Mat& mask, const uchar* table, const int* bounds, int start, int end) {
+		for (int row = start; row < end; row++) {
+			const uchar* bgr = frame.ptr<uchar>(row);
+			uchar* out = mask.ptr<uchar>(row);
+			int col = 0;
+#ifdef MERCURY_SSE2
+			for (; col + 32 <= frame.cols; col += 32) {
+				__m128i channels[6];
+				deinterleave(bgr + 3 * col, channels);
+				_mm_storeu_si128((__m128i*)(out + col), classifyVector(channels[0], channels[2], channels[4], bounds));
+				_mm_storeu_si128((__m128i*)(out + col + 16), classifyVector(channels[1], channels[3], channels[5], bounds));
+			}
+#endif
+			for (; col < frame.cols; col++)
+				out[col] = classifyPixel(bgr + 3 * col, table);
+		}
+	}
+
+	/*
+	* Classifies a range of the rows, for cv::parallel_for_. The rows only write their own row of the mask.
+	*/
+	class ClassifyLoopBody : public cv::ParallelLoopBody {
+	public:
+		ClassifyLoopBody(const cv::Mat& frame, cv::Mat& mask, const uchar* table, const int* bounds) : frame(frame), mask(mask), table(table), bounds(bounds) {}
+
+		void operator()(const cv::Range& range) const {
+			classifyRows(this->frame, this->mask, this->table, this->bounds, range.start, range.end);
+		}
+
+	private:
+		const cv::Mat& frame;
+		cv::Mat& mask;
+		const uchar* table;
+		const int* bounds;
+	};
+}
+
+/*
+* Classify the BGR frame directly with the lookup table, see classifyRows. Frames and areas of at least
+* parallelClassifyArea pixels are split in bands of rows over the threads of OpenCV. This is not used by detect until the
+* bench shows it beats cvtColor + inRange, see convertAndClassify.
+*/
+void SkinDetector::classify(cv::Mat& frame, cv::Mat& mask) {
+	mask.create(frame.rows, frame.cols, CV_8U);
+	if (frame.rows * frame.cols < parallelClassifyArea) {
+		classifyRows(frame, mask, this->lookupTable, this->lookupBounds, 0, frame.rows);
+		return;
+	}
+	ClassifyLoopBody body(frame, mask, this->lookupTable, this->lookupBounds);
+	cv::parallel_for_(cv::Range(0, frame.rows), body);
+}
+
+/*
+* The classification detect uses: the conversion to YCrCb and inRange of OpenCV, with the bounds of the lookup table.
+*/
+void SkinDetector::convertAndClassify(cv::Mat& frame, cv::Mat& mask) {
+	int* bounds = this->lookupBounds;
+	cv::cvtColor(frame, this->frameColors, cv::COLOR_BGR2YCrCb);
+	cv::inRange(this->frameColors, cv::Scalar(bounds[0], bounds[2], bounds[4]), cv::Scalar(bounds[1], bounds[3], bounds[5]), mask);
+}
+
+/**
+* this uses the face area to detect the skin tone of the user (assuming no Burkah). This skin tone is searched for in YCrCb space.
+* The aim is to find the hands and/or arms.
+* With regions only those parts of the mask are classified again, as long as the skin tone did not change. With an area
+* only that part of the frame is classified and the rest of the mask is 0. Returns true if the whole area was classified.
+*/
+bool SkinDetector::detect(cv::Rect& face, cv::Mat& frame, bool refine, int noiseRemovalThreshold, std::vector<cv::Rect>* regions, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_SKIN);
+	// keep track of the previous mask
+	this->nextMask(frame.size());
+
+	auto color = this->getAverageAreaColor(face, frame, refine);
+
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	area = area.area() == 0 ? frameRect : area & frameRect;
 
 	//filter the image in YCrCb color space
-	cv::inRange(mask, cv::Scalar(Y_MIN, Cr_MIN, Cb_MIN), cv::Scalar(Y_MAX, Cr_MAX, Cb_MAX), this->skinMask);
+	bool tableChanged = this->updateBounds(color);
+	if (regions != nullptr && tableChanged == false && this->previousSkinMask.size() == frame.size() && area == this->classifiedArea) {
+		// the mask is the old buffer of the ring, outside of the regions the previous mask is still valid
+		this->previousSkinMask.copyTo(this->skinMask);
+		for (auto& region : *regions) {
+			cv::Mat regionFrame = frame(region);
+			cv::Mat regionMask = this->skinMask(region);
+			this->convertAndClassify(regionFrame, regionMask);
+		}
+		return false;
+	}
+	this->classifiedArea = area;
+	if (area == frameRect) {
+		this->convertAndClassify(frame, this->skinMask);
+		return true;
+	}
+	cv::Mat areaFrame = frame(area);
+	cv::Mat areaMask = this->skinMask(area);
+	this->convertAndClassify(areaFrame, areaMask);
+	clearOutside(this->skinMask, area);
+	return true;
+}
+
+
+/*
+* Classify a frame on the OpenCL device, see Pipeline::useOpenCL. This is the full conversion to YCrCb and inRange, which
+* gives the same mask as the lookup table. Only the face area and the mask are moved to the host. Partial updates are
+* not done on the device, the whole area is classified every frame.
+*/
+bool SkinDetector::detect(cv::Rect& face, cv::UMat& frame, bool refine, cv::Rect area) {
+	PROFILE_SCOPE(PROFILE_SKIN);
+	this->nextMask(frame.size());
+
+	auto color = this->getAverageAreaColor(face, frame, refine);
+	this->updateBounds(color);
+	int* bounds = this->lookupBounds;
+
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	area = area.area() == 0 ? frameRect : area & frameRect;
+	this->classifiedArea = area;
+
+	cv::cvtColor(frame(area), this->deviceColors, cv::COLOR_BGR2YCrCb);
+	cv::inRange(this->deviceColors, cv::Scalar(bounds[0], bounds[2], bounds[4]), cv::Scalar(bounds[1], bounds[3], bounds[5]), this->deviceMask);
+
+	cv::Mat areaMask = this->skinMask(area);
+	this->deviceMask.copyTo(areaMask);
+	if (area != frameRect)
+		clearOutside(this->skinMask, area);
+	return true;
 }
 
+/*
+* Move on to the mask of the next frame. This swaps the buffers of the ring instead of copying the mask, skinMask is the
+* buffer of the oldest frame and is overwritten.
+*/
+void SkinDetector::nextMask(cv::Size size) {
+	cv::Mat& mask = this->masks.advance();
+	mask.create(size, CV_8U);
+	this->previousSkinMask = this->masks.previous();
+	this->skinMask = mask;
+}
 
 /*
-get a mask made up of the current and the previous skinmask.
+get a mask made up of the current and the previous skinmask. The buffer is reused every frame, so it is only valid until
+the next call.
 */
-cv::Mat SkinDetector::getMergedMap() {
+cv::Mat& SkinDetector::getMergedMap() {
 	if (this->previousSkinMask.cols == this->skinMask.cols) {
-		cv::Mat mergedMap;
-		cv::bitwise_or(this->skinMask, this->previousSkinMask, mergedMap);
-		return mergedMap;
+		cv::bitwise_or(this->skinMask, this->previousSkinMask, this->mergedMap);
 	}
 	else {
-		return this->skinMask;
+		this->skinMask.copyTo(this->mergedMap);
 	}
+	return this->mergedMap;
 }
 
 void SkinDetector::show(std::string windowName) {
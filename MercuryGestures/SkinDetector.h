@@ -1,17 +1,42 @@
 #pragma once
 
 #include "MercuryCore.h"
+#include "FrameRing.h"
 
 class SkinDetector {
 public:
-	cv::Mat skinMask;
+	cv::Mat skinMask;          // the buffers of these are in the ring, see nextMask
 	cv::Mat previousSkinMask;
+	cv::Mat faceColors; // YCrCb of the inner face area
+	cv::Mat mergedMap;  // see getMergedMap
+	cv::Mat faceFrame;  // the inner face area downloaded from the device
+	cv::Mat frameColors; // YCrCb of the classified area, see convertAndClassify
+	cv::UMat deviceColors;
+	cv::UMat deviceMask;
 
 
 	SkinDetector();
 	~SkinDetector();
 	cv::Scalar getAverageAreaColor(cv::Rect&area, cv::Mat& frame, bool refine, double centerFocus = 0.6);
-	void detect(cv::Rect& face, cv::Mat& frame, bool refine, int noiseRemovalThreshold = 80);
+	cv::Scalar getAverageAreaColor(cv::Rect&area, cv::UMat& frame, bool refine, double centerFocus = 0.6);
+	bool detect(cv::Rect& face, cv::Mat& frame, bool refine, int noiseRemovalThreshold = 80, std::vector<cv::Rect>* regions = nullptr, cv::Rect area = cv::Rect());
+	bool detect(cv::Rect& face, cv::UMat& frame, bool refine, cv::Rect area = cv::Rect());
 	void show(std::string windowName = "skinMask");
-	cv::Mat getMergedMap();
+	cv::Mat& getMergedMap();
+
+private:
+	friend class SkinBenchmark; // the benchmarks time the classification against cvtColor + inRange
+	uchar lookupTable[256];
+	int lookupBounds[6] = { -1, -1, -1, -1, -1, -1 }; // the bounds the lookup table was built for
+	cv::Rect classifiedArea; // the part of the frame the mask was classified in, the rest is 0
+
+	cv::Rect getInnerArea(cv::Rect& area, cv::Size frameSize, double centerFocus);
+	cv::Scalar getAverageColor(cv::Mat& innerFrame, cv::Rect& inner, bool refine, cv::Size frameSize);
+	FrameRing<cv::Mat> masks;
+
+	void nextMask(cv::Size size);
+	bool updateBounds(cv::Scalar& color);
+	bool updateLookupTable(int yMin, int yMax, int crMin, int crMax, int cbMin, int cbMax);
+	void classify(cv::Mat& frame, cv::Mat& mask);
+	void convertAndClassify(cv::Mat& frame, cv::Mat& mask);
 };
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+/*
+* A lock free ring buffer for exactly one producer thread and one consumer thread. Neither side ever blocks:
+* tryPush fails when the ring is full and tryPop fails when it is empty. The capacity is rounded up to a power of two.
+*/
+template <typename T>
+class SpscRing {
+public:
+	SpscRing(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		this->items.resize(size);
+		this->mask = size - 1;
+		this->head = 0;
+		this->tail = 0;
+	}
+
+	bool tryPush(const T& item) {
+		size_t head = this->head.load(std::memory_order_relaxed);
+		if (head - this->tail.load(std::memory_order_acquire) > this->mask)
+			return false;
+		this->items[head & this->mask] = item;
+		this->head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool tryPop(T& item) {
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		if (tail == this->head.load(std::memory_order_acquire))
+			return false;
+		item = this->items[tail & this->mask];
+		this->tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() {
+		return this->tail.load(std::memory_order_acquire) == this->head.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() {
+		return this->mask + 1;
+	}
+
+private:
+	std::vector<T> items;
+	size_t mask;
+	// head is written by the producer, tail by the consumer. Keep them on their own cache lines.
+	char padding0[64];
+	std::atomic<size_t> head;
+	char padding1[64];
+	std::atomic<size_t> tail;
+	char padding2[64];
+};
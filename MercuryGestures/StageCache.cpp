@@ -0,0 +1,293 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "StageCache.h"
+#include <cstring>
+#include <sstream>
+
+namespace {
+	const char stageCacheMagic[8] = { 'M', 'G', 'S', 'T', 'A', 'G', 'E', 'S' };
+	const size_t keySampleSize = 1 << 20; // bytes hashed at the start and at the end of the video
+
+	// 64 bit FNV-1a
+	const uint64_t hashBasis = 14695981039346656037ull;
+	const uint64_t hashPrime = 1099511628211ull;
+
+	uint64_t hashBytes(uint64_t hash, const char* data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash ^= uint8_t(data[i]);
+			hash *= hashPrime;
+		}
+		return hash;
+	}
+
+	int16_t clamp16(int value) {
+		return int16_t(std::max(-32768, std::min(32767, value)));
+	}
+
+	void writeLength(std::vector<uint8_t>& encoded, uint64_t length) {
+		while (length >= 0x80) {
+			encoded.push_back(uint8_t(length | 0x80));
+			length >>= 7;
+		}
+		encoded.push_back(uint8_t(length));
+	}
+}
+
+/*
+* The key of the stages of a video. Hashing a whole video takes as long as decoding it, so only its size and the
+* first and last MB are hashed, with the settings of the pipeline that change the upstream stages. Returns 0 if the
+* video cannot be read, like a camera or a stream.
+*/
+uint64_t getStageCacheKey(std::string videoPath, Pipeline& pipeline) {
+	std::ifstream video(videoPath, std::ios::binary | std::ios::ate);
+	if (!video.is_open())
+		return 0;
+	long long size = video.tellg();
+	if (size <= 0)
+		return 0;
+
+	std::vector<char> sample(std::min<long long>(size, keySampleSize));
+	uint64_t hash = hashBasis;
+	hash = hashBytes(hash, reinterpret_cast<const char*>(&size), sizeof(size));
+	video.seekg(0);
+	video.read(sample.data(), sample.size());
+	hash = hashBytes(hash, sample.data(), video.gcount());
+	video.seekg(size - sample.size());
+	video.read(sample.data(), sample.size());
+	hash = hashBytes(hash, sample.data(), video.gcount());
+
+	FaceDetector& face = pipeline.faceDetector;
+	std::ostringstream settings;
+	settings << stageCacheVersion << " " << pipeline.fps << " " << pipeline.frameHeightMax << " "
+		<< pipeline.bodyRegionOnly << " " << pipeline.movementEngine.threshold << " "
+		<< face.face_cascade_name << " " << face.detectionInterval << " " << face.asynchronous << " "
+		<< face.detectionScale << " " << face.lockedScale;
+	std::string text = settings.str();
+	return hashBytes(hash, text.data(), text.size());
+}
+
+/*
+* Run length encode a CV_8U mask: the value of a run and then its length, 7 bits per byte. Runs continue over the
+* ends of the rows.
+*/
+void encodeMask(cv::Mat& mask, std::vector<uint8_t>& encoded) {
+	encoded.clear();
+	uint8_t value = 0;
+	uint64_t length = 0;
+	for (int y = 0; y < mask.rows; y++) {
+		const uchar* row = mask.ptr<uchar>(y);
+		for (int x = 0; x < mask.cols; x++) {
+			if (row[x] == value) {
+				length++;
+				continue;
+			}
+			if (length > 0) {
+				encoded.push_back(value);
+				writeLength(encoded, length);
+			}
+			value = row[x];
+			length = 1;
+		}
+	}
+	if (length > 0) {
+		encoded.push_back(value);
+		writeLength(encoded, length);
+	}
+}
+
+/*
+* Decode a mask made by encodeMask into mask, which has to be allocated with the size it was encoded with.
+* Returns false if the data does not fill the mask exactly.
+*/
+bool decodeMask(const uint8_t* data, size_t size, cv::Mat& mask) {
+	size_t position = 0;
+	int y = 0;
+	int x = 0;
+	while (position < size) {
+		uint8_t value = data[position++];
+		uint64_t length = 0;
+		for (int shift = 0;; shift += 7) {
+			if (position >= size || shift > 56)
+				return false;
+			uint8_t byte = data[position++];
+			length |= uint64_t(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				break;
+		}
+		while (length > 0) {
+			if (y >= mask.rows)
+				return false;
+			int count = int(std::min<uint64_t>(length, mask.cols - x));
+			std::memset(mask.ptr<uchar>(y) + x, value, count);
+			x += count;
+			length -= count;
+			if (x == mask.cols) {
+				x = 0;
+				y++;
+			}
+		}
+	}
+	return y == mask.rows && x == 0;
+}
+
+
+StageCacheWriter::StageCacheWriter() {}
+
+StageCacheWriter::~StageCacheWriter() {
+	this->close();
+}
+
+bool StageCacheWriter::open(std::string path, uint64_t key, double fps, int frameHeightMax) {
+	this->close();
+	this->out.open(path, std::ios::binary | std::ios::trunc);
+	if (!this->out.is_open())
+		return false;
+
+	std::memset(&this->header, 0, sizeof(this->header));
+	std::memcpy(this->header.magic, stageCacheMagic, sizeof(stageCacheMagic));
+	this->header.version = stageCacheVersion;
+	this->header.headerSize = sizeof(StageCacheHeader);
+	this->header.key = key;
+	this->header.fps = fps;
+	this->header.frameHeightMax = frameHeightMax;
+	this->out.write(reinterpret_cast<const char*>(&this->header), sizeof(this->header));
+	return this->out.good();
+}
+
+/*
+* Record the stages of the frame the pipeline just processed. The maps are still those the hand detection got.
+* Returns false if the file could not be written.
+*/
+bool StageCacheWriter::write(Pipeline& pipeline, PipelineResult& result) {
+	this->header.frameWidth = pipeline.frameWidth;
+	this->header.frameHeight = pipeline.frameHeight;
+
+	StageCacheRecord record;
+	std::memset(&record, 0, sizeof(record));
+	record.frameIndex = result.frameIndex;
+	record.faceDetected = result.faceDetected;
+	record.valid = result.valid;
+	record.timestamp = result.timestamp;
+	record.faceX = clamp16(result.face.x);
+	record.faceY = clamp16(result.face.y);
+	record.faceWidth = clamp16(result.face.width);
+	record.faceHeight = clamp16(result.face.height);
+	record.areaX = clamp16(result.processingArea.x);
+	record.areaY = clamp16(result.processingArea.y);
+	record.areaWidth = clamp16(result.processingArea.width);
+	record.areaHeight = clamp16(result.processingArea.height);
+	record.pixelSizeInCm = pipeline.faceDetector.pixelSizeInCm;
+	record.normalizationFactor = pipeline.faceDetector.normalizationFactor;
+	record.movement = result.movementValue;
+	record.movementFiltered = result.movementFilteredValue;
+
+	if (result.valid == false) {
+		this->out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		this->header.recordCount++;
+		return this->out.good();
+	}
+
+	// the masks are encoded one after the other, the sizes go in the record in front of them
+	cv::Mat* masks[STAGE_MASK_COUNT] = {
+		&pipeline.skinDetector.skinMask,
+		&pipeline.movementDetector.movementMap,
+		&pipeline.edgeDetector.detectedEdges
+	};
+	for (int i = 0; i < STAGE_MASK_COUNT; i++) {
+		encodeMask(*masks[i], this->encoded[i]);
+		record.maskSizes[i] = this->encoded[i].size();
+	}
+	this->out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+	for (int i = 0; i < STAGE_MASK_COUNT; i++)
+		this->out.write(reinterpret_cast<const char*>(this->encoded[i].data()), this->encoded[i].size());
+	this->header.recordCount++;
+	return this->out.good();
+}
+
+/*
+* Fill in the record count and close the file. Returns false if any write failed, also those of earlier frames.
+*/
+bool StageCacheWriter::close() {
+	if (!this->out.is_open())
+		return true;
+	this->out.seekp(0);
+	this->out.write(reinterpret_cast<const char*>(&this->header), sizeof(this->header));
+	this->out.close();
+	return this->out.good();
+}
+
+bool StageCacheWriter::isOpen() {
+	return this->out.is_open();
+}
+
+
+StageCacheReader::StageCacheReader() {}
+
+StageCacheReader::~StageCacheReader() {
+	this->close();
+}
+
+/*
+* Returns false if there is no cache, or if it was made with another key or version.
+*/
+bool StageCacheReader::open(std::string path, uint64_t key) {
+	this->close();
+	this->in.open(path, std::ios::binary);
+	if (!this->in.is_open())
+		return false;
+	this->in.read(reinterpret_cast<char*>(&this->header), sizeof(this->header));
+	if (this->in.gcount() != sizeof(this->header) ||
+		std::memcmp(this->header.magic, stageCacheMagic, sizeof(stageCacheMagic)) != 0 ||
+		this->header.version != stageCacheVersion || this->header.key != key ||
+		this->header.frameWidth <= 0 || this->header.frameHeight <= 0) {
+		this->close();
+		return false;
+	}
+	this->in.seekg(this->header.headerSize);
+	return true;
+}
+
+/*
+* The next frame. The masks are allocated once and decoded into, so they are only valid until the next read.
+* Returns false at the end or on a record that was cut short.
+*/
+bool StageCacheReader::read(StageFrame& frame) {
+	StageCacheRecord record;
+	this->in.read(reinterpret_cast<char*>(&record), sizeof(record));
+	if (this->in.gcount() != sizeof(record))
+		return false;
+
+	frame.frameIndex = record.frameIndex;
+	frame.timestamp = record.timestamp;
+	frame.faceDetected = record.faceDetected != 0;
+	frame.valid = record.valid != 0;
+	frame.face = cv::Rect(record.faceX, record.faceY, record.faceWidth, record.faceHeight);
+	frame.area = cv::Rect(record.areaX, record.areaY, record.areaWidth, record.areaHeight);
+	frame.pixelSizeInCm = record.pixelSizeInCm;
+	frame.normalizationFactor = record.normalizationFactor;
+	frame.movementValue = record.movement;
+	frame.movementFilteredValue = record.movementFiltered;
+	if (frame.valid == false)
+		return true;
+
+	for (int i = 0; i < STAGE_MASK_COUNT; i++) {
+		this->encoded.resize(record.maskSizes[i]);
+		this->in.read(reinterpret_cast<char*>(this->encoded.data()), this->encoded.size());
+		if (this->in.gcount() != std::streamsize(this->encoded.size()))
+			return false;
+		frame.masks[i].create(this->header.frameHeight, this->header.frameWidth, CV_8U);
+		if (decodeMask(this->encoded.data(), this->encoded.size(), frame.masks[i]) == false)
+			return false;
+	}
+	return true;
+}
+
+void StageCacheReader::close() {
+	if (this->in.is_open())
+		this->in.close();
+}
+
+const StageCacheHeader& StageCacheReader::getHeader() {
+	return this->header;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Pipeline.h"
+#include <cstdint>
+#include <fstream>
+
+/*
+* A file with the outputs of the upstream stages for every frame of a video: the face lock, the skin mask, the skin
+* masked movement and the edges. None of these depend on the parameters of the hand detection, so a parameter sweep
+* records them once and then only replays the hand detection, see SweepRunner.
+*
+* The file is a header and then one record per frame, each followed by its masks. The masks are run length encoded,
+* they are mostly long runs of 0 and 255. The key in the header is a hash of the video and of the upstream settings, a
+* cache made from another video or with other settings is not used. Records are only appended, so a file that was cut
+* short is still readable up to the last complete record. All values are little endian.
+*/
+
+const uint32_t stageCacheVersion = 1;   // part of the key, bump this when an upstream stage changes its output
+
+enum StageMask {
+	STAGE_SKIN,         // SkinDetector::skinMask
+	STAGE_MOVEMENT,     // MovementDetector::movementMap, the skin masked movement
+	STAGE_EDGES,        // EdgeDetector::detectedEdges
+	STAGE_MASK_COUNT
+};
+
+struct StageCacheHeader {
+	char magic[8];          // "MGSTAGES"
+	uint32_t version;
+	uint32_t headerSize;    // the records start here
+	uint64_t key;           // see getStageCacheKey
+	double fps;
+	int32_t frameWidth;     // of the resized frames the stages ran on
+	int32_t frameHeight;
+	int32_t frameHeightMax; // the pipeline setting, the replay resizes the decoded frames the same way
+	uint32_t padding;
+	int64_t recordCount;    // written on close, readers stop at the end of the file
+	uint8_t reserved[16];
+};
+
+struct StageCacheRecord {
+	int32_t frameIndex;
+	uint8_t faceDetected;
+	uint8_t valid;          // the hand detection ran on this frame, only then the masks follow the record
+	uint8_t padding[2];
+	int64_t timestamp;      // capture time in us since the epoch
+	int16_t faceX, faceY, faceWidth, faceHeight;
+	int16_t areaX, areaY, areaWidth, areaHeight;
+	double pixelSizeInCm;   // as given to the hand detection
+	double normalizationFactor;
+	double movement;        // the skin masked movement, it does not depend on the hands
+	double movementFiltered;
+	uint32_t maskSizes[STAGE_MASK_COUNT]; // bytes of the encoded masks
+	uint32_t padding2;
+};
+
+static_assert(sizeof(StageCacheHeader) == 72, "the stage cache header has to be packed");
+static_assert(sizeof(StageCacheRecord) == 80, "the stage cache record has to be packed");
+
+/*
+* The stages of one frame, decoded.
+*/
+struct StageFrame {
+	int frameIndex = 0;
+	long long timestamp = 0;
+	bool faceDetected = false;
+	bool valid = false;
+	cv::Rect face;
+	cv::Rect area;
+	double pixelSizeInCm = 0;
+	double normalizationFactor = 1;
+	double movementValue = 0;
+	double movementFilteredValue = 0;
+	cv::Mat masks[STAGE_MASK_COUNT];
+};
+
+uint64_t getStageCacheKey(std::string videoPath, Pipeline& pipeline);
+void encodeMask(cv::Mat& mask, std::vector<uint8_t>& encoded);
+bool decodeMask(const uint8_t* data, size_t size, cv::Mat& mask);
+
+/*
+* Record the stages of a pipeline run, one write per processed frame.
+*/
+class StageCacheWriter {
+public:
+	StageCacheWriter();
+	~StageCacheWriter();
+
+	bool open(std::string path, uint64_t key, double fps, int frameHeightMax);
+	bool write(Pipeline& pipeline, PipelineResult& result);
+	bool close();
+	bool isOpen();
+
+private:
+	std::ofstream out;
+	StageCacheHeader header;
+	std::vector<uint8_t> encoded[STAGE_MASK_COUNT];
+};
+
+/*
+* Read the frames of a stage cache in order.
+*/
+class StageCacheReader {
+public:
+	StageCacheReader();
+	~StageCacheReader();
+
+	bool open(std::string path, uint64_t key);
+	bool read(StageFrame& frame);
+	void close();
+	const StageCacheHeader& getHeader();
+
+private:
+	std::ifstream in;
+	StageCacheHeader header;
+	std::vector<uint8_t> encoded;
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "StreamManager.h"
+
+StreamManager::StreamManager(int workers) : pool(workers) {}
+
+StreamManager::~StreamManager() {
+	this->stop();
+	this->pool.stop();
+	// the capture threads call back into the manager, they have to end before it does
+	for (auto& stream : this->streams)
+		stream->source.stop();
+}
+
+/*
+* Parse the cascade xml once, all stream pipelines are set up from the cascade cache.
+*/
+bool StreamManager::loadCascade() {
+	return CascadeCache::instance().load(this->cascadeName);
+}
+
+/*
+* Open the source and set up a pipeline for it. Returns the id of the stream or -1 if the source cannot be used.
+* Streams added after start() are started right away.
+*/
+int StreamManager::addStream(std::string source) {
+	if (this->loadCascade() == false)
+		return -1;
+
+	std::unique_ptr<Stream> stream(new Stream());
+	if (stream->source.open(source) == false) {
+		std::cerr << "Cannot open the video source: " << source << std::endl;
+		return -1;
+	}
+
+	// the streams share the cores, so the pipelines do not start threads of their own.
+	stream->pipeline.reset(new Pipeline(stream->source.getFps(), true));
+	stream->pipeline->concurrentDetectors = false;
+	stream->pipeline->setLatencyBudget(this->latencyBudget);
+	stream->pipeline->incremental = this->incremental;
+	stream->pipeline->bodyRegionOnly = this->bodyRegionOnly;
+	stream->pipeline->setOpenCL(this->useOpenCL);
+	stream->pipeline->setMaxSubjects(this->maxSubjects);
+	stream->pipeline->faceDetector.face_cascade_name = this->cascadeName;
+	stream->pipeline->faceDetector.setFastDetection(this->fastFaceDetection);
+	stream->pipeline->faceDetector.setAsynchronous(this->asynchronousFaceDetection);
+	if (stream->pipeline->setup() == false)
+		return -1;
+	// a live stream is captured on a thread of its own, a step then takes the newest frame instead of the oldest.
+	Stream* raw = stream.get();
+	stream->source.setTargetHeight(stream->pipeline->frameHeightMax);
+	stream->source.onFrame = [this, raw] { this->frameArrived(raw); };
+	stream->source.start();
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	stream->status.id = this->streams.size();
+	stream->status.source = source;
+	this->streams.push_back(std::move(stream));
+	Stream* added = this->streams.back().get();
+	if (this->started && this->stopping == false)
+		this->schedule(added);
+	return added->status.id;
+}
+
+void StreamManager::start() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->started = true;
+	this->stopping = false;
+	for (auto& stream : this->streams) {
+		if (stream->scheduled == false && stream->ended == false)
+			this->schedule(stream.get());
+	}
+}
+
+/*
+* Stop all streams after their current frame. Blocks until no frame is in flight.
+*/
+void StreamManager::stop() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+		// the streams that wait for a frame have none in flight
+		for (auto& stream : this->streams) {
+			if (stream->waiting) {
+				stream->waiting = false;
+				stream->scheduled = false;
+				stream->status.running = false;
+			}
+		}
+	}
+	this->wait();
+}
+
+/*
+* Block until all streams have ended (or are stopped).
+*/
+void StreamManager::wait() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->idle.wait(lock, [this] {
+		for (auto& stream : this->streams) {
+			if (stream->scheduled)
+				return false;
+		}
+		return true;
+	});
+}
+
+int StreamManager::getStreamCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->streams.size();
+}
+
+bool StreamManager::getStatus(int id, StreamStatus& status) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (id < 0 || id >= this->streams.size())
+		return false;
+	status = this->streams[id]->status;
+	return true;
+}
+
+std::vector<StreamStatus> StreamManager::getStatus() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	std::vector<StreamStatus> statuses;
+	for (auto& stream : this->streams)
+		statuses.push_back(stream->status);
+	return statuses;
+}
+
+/*
+* The published movement value (ROI masked) of the last frame of the stream, 0 if there is none.
+*/
+double StreamManager::getMovementValue(int id) {
+	StreamStatus status;
+	if (this->getStatus(id, status) == false || status.result.valid == false)
+		return 0;
+	return status.result.ROImovementValue;
+}
+
+/*
+* Queue the next frame of the stream. Has to be called with the lock held.
+*/
+void StreamManager::schedule(Stream* stream) {
+	stream->scheduled = true;
+	stream->status.running = true;
+	this->pool.submit([this, stream] { this->step(stream); });
+}
+
+/*
+* Process one frame of the stream. Only one step per stream is queued at any time, so the stream itself needs no lock.
+* If a live source has no frame yet the stream waits for the capture thread instead, see frameArrived.
+*/
+void StreamManager::step(Stream* stream) {
+	if (stream->source.hasFrame() == false) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->stopping) {
+			stream->scheduled = false;
+			stream->status.running = false;
+			this->idle.notify_all();
+			return;
+		}
+		stream->waiting = true;
+		// the frame can have arrived before waiting was set, frameArrived did not see it then
+		if (stream->source.hasFrame()) {
+			stream->waiting = false;
+			this->pool.submit([this, stream] { this->step(stream); });
+		}
+		return;
+	}
+
+	PipelineResult result;
+	bool processed = stream->source.read(stream->captured, stream->pipeline->framesToDrop) &&
+		stream->pipeline->process(stream->captured, result);
+	if (processed && this->publish)
+		this->publish(stream->status.id, result);
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (processed) {
+		stream->status.frames++;
+		stream->status.result = result;
+	}
+	if (processed == false || this->stopping) {
+		stream->scheduled = false;
+		stream->ended = processed == false;
+		stream->status.running = false;
+		this->idle.notify_all();
+		return;
+	}
+	this->pool.submit([this, stream] { this->step(stream); });
+}
+
+/*
+* Called on the capture thread of a stream when it has a frame or has ended. Queues the step the stream waits for.
+*/
+void StreamManager::frameArrived(Stream* stream) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (stream->waiting == false)
+		return;
+	stream->waiting = false;
+	this->pool.submit([this, stream] { this->step(stream); });
+}
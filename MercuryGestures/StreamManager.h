@@ -0,0 +1,78 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "Pipeline.h"
+#include "WorkStealingPool.h"
+#include <memory>
+
+/*
+* What the manager publishes about a stream.
+*/
+struct StreamStatus {
+	int id = 0;
+	std::string source;
+	bool running = false;
+	long long frames = 0;
+	PipelineResult result;   // result of the last processed frame
+};
+
+/*
+* Serve many video feeds (files, cameras or stream urls) from one process. Every stream has its own pipeline and so
+* its own face, skin, movement and hand state. The cascade is parsed once and shared, see CascadeCache.
+*
+* The frames of all streams are processed on one work stealing pool. A stream has at most one frame in flight: the
+* task for a frame reads it, processes it and then queues the task for the next frame at the back of the queue. This
+* keeps the frame order that the detectors depend on and lets the streams take turns, a slow stream only delays itself.
+* A live stream that has no new frame yet does not hold a worker waiting for it: its step returns and the capture
+* thread of the source queues the next step when the frame arrives.
+*/
+class StreamManager {
+public:
+	std::string cascadeName = "./dependencies/haarcascade_frontalface_alt.xml";
+	double latencyBudget = 0;      // ms per frame for the streams added after this is set, 0 is full quality
+	bool incremental = false;      // see Pipeline::incremental
+	bool bodyRegionOnly = false;   // see Pipeline::bodyRegionOnly
+	bool useOpenCL = false;        // see Pipeline::setOpenCL
+	int maxSubjects = 1;           // see Pipeline::setMaxSubjects
+	bool fastFaceDetection = false; // see FaceDetector::setFastDetection
+	bool asynchronousFaceDetection = false; // see FaceDetector::setAsynchronous
+
+	// called on a worker thread after every frame. Calls for one stream are in order, calls for different
+	// streams can be concurrent.
+	std::function<void(int, PipelineResult&)> publish;
+
+	StreamManager(int workers);
+	~StreamManager();
+
+	bool loadCascade();
+	int addStream(std::string source);
+	void start();
+	void stop();
+	void wait();
+	int getStreamCount();
+	bool getStatus(int id, StreamStatus& status);
+	std::vector<StreamStatus> getStatus();
+	double getMovementValue(int id);
+
+private:
+	struct Stream {
+		StreamStatus status;
+		FrameSource source;
+		CapturedFrame captured;
+		std::unique_ptr<Pipeline> pipeline;
+		bool scheduled = false;    // a step of this stream is queued or running, or it waits for a frame
+		bool waiting = false;      // the next step is queued by the capture thread, see frameArrived
+		bool ended = false;        // the source has no more frames
+	};
+
+	WorkStealingPool pool;
+	std::vector<std::unique_ptr<Stream>> streams;
+	std::mutex mutex;              // guards the stream list and the status of all streams
+	std::condition_variable idle;
+	bool started = false;
+	bool stopping = false;
+
+	void schedule(Stream* stream);
+	void step(Stream* stream);
+	void frameArrived(Stream* stream);
+};
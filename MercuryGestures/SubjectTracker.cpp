@@ -0,0 +1,274 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "SubjectTracker.h"
+#include "Profiler.h"
+
+Subject::Subject(int id, int fps) :
+	handDetector(fps),
+	movementDetector(fps),
+	ROImovementDetector(fps) {
+	this->id = id;
+}
+
+Subject::~Subject() {}
+
+/*
+* Processes a range of the subjects of a frame, for cv::parallel_for_.
+*/
+class SubjectLoopBody : public cv::ParallelLoopBody {
+public:
+	SubjectLoopBody(SubjectTracker& tracker, SubjectFrame& frame) : tracker(tracker), frame(frame) {}
+
+	void operator()(const cv::Range& range) const {
+		for (int i = range.start; i < range.end; i++)
+			this->tracker.processSubject(*this->tracker.subjects[i], this->frame);
+	}
+
+private:
+	SubjectTracker& tracker;
+	SubjectFrame& frame;
+};
+
+SubjectTracker::SubjectTracker(int fps) {
+	this->fps = fps;
+}
+
+SubjectTracker::~SubjectTracker() {}
+
+/*
+* Update the faces of all subjects. On the frames the cascade runs its faces are matched to the subjects, on the others
+* every subject follows its face with the template. Returns true if there is at least one subject.
+*/
+bool SubjectTracker::detect(FaceDetector& cascade, cv::Mat& gray) {
+	PROFILE_SCOPE(PROFILE_FACE);
+	this->framesSinceDetection += 1;
+	std::vector<bool> present(this->subjects.size(), false);
+
+	if (this->isDetectionDue(cascade)) {
+		this->framesSinceDetection = 0;
+		cascade.detectFaces(gray, this->faces);
+		this->assigned.assign(this->faces.size(), false);
+
+		// the oldest subjects choose first, each takes the closest face within the distance the state machine accepts
+		float movementThreshold = cascade.faceAreaThresholdFactor * this->frameWidth;
+		for (int i = 0; i < this->subjects.size(); i++) {
+			FaceDetector& face = this->subjects[i]->faceDetector;
+			int closest = -1;
+			double closestDistance = 0;
+			for (int j = 0; j < this->faces.size(); j++) {
+				int dx = std::abs(getCenterX(this->faces[j]) - face.faceCenterX);
+				int dy = std::abs(getCenterY(this->faces[j]) - face.faceCenterY);
+				if (this->assigned[j] || dx >= movementThreshold || dy >= movementThreshold)
+					continue;
+				double distance = dx * dx + dy * dy;
+				if (closest == -1 || distance < closestDistance) {
+					closest = j;
+					closestDistance = distance;
+				}
+			}
+
+			FaceData reading;
+			reading.count = closest == -1 ? 0 : 1;
+			if (closest != -1) {
+				reading.rect = this->faces[closest];
+				this->assigned[closest] = true;
+			}
+			present[i] = face.apply(closest != -1, reading, gray);
+		}
+
+		// the faces no subject took are new subjects
+		for (int j = 0; j < this->faces.size() && this->subjects.size() < this->maxSubjects; j++) {
+			if (this->assigned[j])
+				continue;
+			Subject* subject = this->addSubject();
+			FaceData reading;
+			reading.count = 1;
+			reading.rect = this->faces[j];
+			present.push_back(subject->faceDetector.apply(true, reading, gray));
+		}
+	}
+	else {
+		for (int i = 0; i < this->subjects.size(); i++)
+			present[i] = this->subjects[i]->faceDetector.follow(gray);
+	}
+
+	// drop the subjects that lost their face
+	int kept = 0;
+	for (int i = 0; i < this->subjects.size(); i++) {
+		if (present[i])
+			this->subjects[kept++] = std::move(this->subjects[i]);
+	}
+	this->subjects.resize(kept);
+	return kept > 0;
+}
+
+/*
+* Run the hands and the movement of all subjects on the shared maps of the frame.
+*/
+void SubjectTracker::process(SubjectFrame& frame) {
+	PROFILE_SCOPE(PROFILE_HANDS);
+	int count = this->subjects.size();
+	if (this->parallel && count > 1)
+		cv::parallel_for_(cv::Range(0, count), SubjectLoopBody(*this, frame));
+	else
+		SubjectLoopBody(*this, frame)(cv::Range(0, count));
+}
+
+/*
+* The single subject steps of Pipeline::process within the body region of the subject. Only the subject itself is
+* written, so the subjects can run at the same time.
+*/
+void SubjectTracker::processSubject(Subject& subject, SubjectFrame& frame) {
+	FaceDetector& face = subject.faceDetector;
+	subject.area = face.getBodyRegion();
+	subject.valid = subject.initialized;
+	if (subject.initialized == false) {
+		subject.initialized = true;
+		return;
+	}
+
+	// the skin of the body region, the faces of the others in it would be taken for hands
+	cv::Size size = frame.gray.size();
+	subject.skinMask.create(size, CV_8U);
+	cv::Mat areaSkin = subject.skinMask(subject.area);
+	frame.skinMask(subject.area).copyTo(areaSkin);
+	clearOutside(subject.skinMask, subject.area);
+
+	// the skin masked movement in the body region, also without the other faces
+	frame.movementEngine->maskChanges(frame.changes, frame.temporalSkinMask, subject.movementDetector.movementMap, subject.area);
+	for (auto& other : this->subjects) {
+		if (other.get() == &subject)
+			continue;
+		cv::Rect otherFace = inflateRect(other->faceDetector.face.rect, 10, subject.skinMask);
+		cv::rectangle(subject.skinMask, otherFace, 0, CV_FILLED);
+		cv::rectangle(subject.movementDetector.movementMap, otherFace, 0, CV_FILLED);
+	}
+
+	subject.handDetector.detect(
+		frame.gray, frame.grayPrev,
+		face.face.rect,
+		subject.skinMask,
+		subject.movementDetector.movementMap,
+		frame.edges,
+		face.pixelSizeInCm,
+		subject.area
+	);
+
+	subject.roiMask.create(size, CV_8U);
+	subject.roiMask.setTo(0);
+	subject.handDetector.addResultToMask(subject.roiMask);
+	face.addResultToMask(subject.roiMask);
+
+	// both movement values in one pass over the body region
+	cv::Mat areaMovement = subject.movementDetector.movementMap(subject.area);
+	cv::Mat areaROI = subject.roiMask(subject.area);
+	subject.masks.assign(1, nullptr);
+	subject.masks.push_back(&areaROI);
+	frame.movementEngine->countChanges(areaMovement, subject.masks, subject.counts);
+	subject.movementDetector.update(subject.counts[0], face.normalizationFactor);
+	subject.ROImovementDetector.update(subject.counts[1], face.normalizationFactor);
+}
+
+/*
+* The union of the body regions of all subjects, the part of the frame the shared maps are needed in.
+*/
+cv::Rect SubjectTracker::getBodyArea() {
+	cv::Rect area;
+	for (auto& subject : this->subjects) {
+		cv::Rect region = subject->faceDetector.getBodyRegion();
+		area = area.area() == 0 ? region : area | region;
+	}
+	return area;
+}
+
+void SubjectTracker::setVideoProperties(int frameWidth, int frameHeight) {
+	this->frameWidth = frameWidth;
+	this->frameHeight = frameHeight;
+	for (auto& subject : this->subjects) {
+		subject->faceDetector.setVideoProperties(frameWidth, frameHeight);
+		subject->handDetector.setVideoProperties(frameWidth, frameHeight);
+	}
+}
+
+void SubjectTracker::setDebugDrawing(bool enabled) {
+	this->debugDrawing = enabled;
+	for (auto& subject : this->subjects)
+		subject->handDetector.setDebugDrawing(enabled);
+}
+
+void SubjectTracker::setSearchEffort(double effort) {
+	this->searchEffort = effort;
+	for (auto& subject : this->subjects)
+		subject->handDetector.setSearchEffort(effort);
+}
+
+/*
+* The results of the subjects, the oldest first. At most maxResultSubjects are given.
+*/
+void SubjectTracker::getSummaries(SubjectSummary* summaries, int& count) {
+	count = std::min(int(this->subjects.size()), maxResultSubjects);
+	for (int i = 0; i < count; i++) {
+		Subject& subject = *this->subjects[i];
+		SubjectSummary& summary = summaries[i];
+		summary = SubjectSummary();
+		summary.id = subject.id;
+		summary.valid = subject.valid;
+		summary.face = subject.faceDetector.face.rect;
+		summary.area = subject.area;
+		if (subject.valid) {
+			summary.leftHand = subject.handDetector.leftHand.position;
+			summary.rightHand = subject.handDetector.rightHand.position;
+			summary.movementValue = subject.movementDetector.value;
+			summary.ROImovementValue = subject.ROImovementDetector.value;
+			summary.ROImovementFilteredValue = subject.ROImovementDetector.filteredValue;
+		}
+	}
+}
+
+void SubjectTracker::draw(cv::Mat& canvas) {
+	for (auto& subject : this->subjects) {
+		subject->faceDetector.draw(canvas);
+		if (subject->valid) {
+			subject->handDetector.draw(canvas);
+			subject->handDetector.drawTraces(canvas);
+		}
+		cv::putText(canvas, joinString("#", subject->id), subject->faceDetector.face.rect.tl() + cv::Point(0, -5),
+			CV_FONT_HERSHEY_PLAIN, 1, CV_RGB(0, 255, 0));
+	}
+}
+
+void SubjectTracker::reset() {
+	this->subjects.clear();
+	this->framesSinceDetection = 0;
+}
+
+
+//***************************************** PRIVATE  **********************************************//
+
+
+/*
+* The cascade runs as long as a subject asks for it (not locked yet or drifted), when there is no subject at all and
+* every discoveryInterval frames to find the people that came in.
+*/
+bool SubjectTracker::isDetectionDue(FaceDetector& cascade) {
+	if (this->subjects.size() == 0 || this->framesSinceDetection >= this->discoveryInterval)
+		return true;
+	for (auto& subject : this->subjects) {
+		subject->faceDetector.detectionInterval = cascade.detectionInterval;
+		if (subject->faceDetector.isDetectionDue())
+			return true;
+	}
+	return false;
+}
+
+Subject* SubjectTracker::addSubject() {
+	std::unique_ptr<Subject> subject(new Subject(this->nextId++, this->fps));
+	subject->faceDetector.setVideoProperties(this->frameWidth, this->frameHeight);
+	subject->handDetector.setVideoProperties(this->frameWidth, this->frameHeight);
+	subject->handDetector.setDebugDrawing(this->debugDrawing);
+	subject->handDetector.setSearchEffort(this->searchEffort);
+	subject->handDetector.framePool = this->framePool;
+	this->subjects.push_back(std::move(subject));
+	return this->subjects.back().get();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "FaceDetector.h"
+#include "HandDetector.h"
+#include "MovementDetector.h"
+#include "MovementEngine.h"
+#include "FramePool.h"
+#include <memory>
+
+const int maxResultSubjects = 4;
+
+/*
+* The values of one subject of the multi subject mode in a frame result.
+*/
+struct SubjectSummary {
+	int id = 0;
+	bool valid = false;					// the movement and hand values have been calculated for this frame
+	cv::Rect face;
+	cv::Rect area;						// the body region the hands of this subject were searched in
+	cv::Point leftHand;
+	cv::Point rightHand;
+	double movementValue = 0;
+	double ROImovementValue = 0;
+	double ROImovementFilteredValue = 0;
+};
+
+/*
+* A person in the frame with the face lock, the hands and the movement of its own.
+*/
+class Subject {
+public:
+	int id = 0;
+	FaceDetector faceDetector;        // only the state machine is used, the cascade is run by the tracker
+	HandDetector handDetector;
+	MovementDetector movementDetector;
+	MovementDetector ROImovementDetector;
+	cv::Mat skinMask;                 // the skin in the body region, without the faces of the others
+	cv::Mat roiMask;
+	cv::Rect area;                    // the body region, see FaceDetector::getBodyRegion
+	bool initialized = false;         // the subject was there on the last frame
+	bool valid = false;
+	std::vector<cv::Mat*> masks;
+	std::vector<int> counts;
+
+	Subject(int id, int fps);
+	~Subject();
+};
+
+/*
+* The maps of a frame that all subjects share. They are made once per frame and only read by the subjects.
+*/
+struct SubjectFrame {
+	cv::Mat gray;
+	cv::Mat grayPrev;
+	cv::Mat skinMask;
+	cv::Mat temporalSkinMask;
+	cv::Mat edges;
+	cv::Mat changes;
+	MovementEngine* movementEngine = nullptr;
+};
+
+/*
+* Tracks up to maxSubjects people at once. The cascade is run once per frame for all of them, the faces it finds are
+* matched to the subjects by distance and every subject runs the face lock state machine of a FaceDetector on its own
+* reading. Faces that match no subject start a new one, subjects that lose their face are dropped.
+*
+* The skin, edge and movement maps are shared, see SubjectFrame. The rest of the work of a subject only depends on its
+* own state and its body region, so the subjects of a frame are processed in parallel.
+*/
+class SubjectTracker {
+public:
+	int maxSubjects = 4;
+	int discoveryInterval = 25;       // frames between cascade runs that look for new subjects once all are locked
+	bool parallel = true;             // process the subjects on the OpenCV thread pool
+	std::vector<std::unique_ptr<Subject>> subjects;  // the oldest first
+	FramePool* framePool = nullptr;
+
+	SubjectTracker(int fps);
+	~SubjectTracker();
+
+	bool detect(FaceDetector& cascade, cv::Mat& gray);
+	void process(SubjectFrame& frame);
+	void processSubject(Subject& subject, SubjectFrame& frame);
+	cv::Rect getBodyArea();
+	void setVideoProperties(int frameWidth, int frameHeight);
+	void setDebugDrawing(bool enabled);
+	void setSearchEffort(double effort);
+	void getSummaries(SubjectSummary* summaries, int& count);
+	void draw(cv::Mat& canvas);
+	void reset();
+
+private:
+	int fps = 25;
+	int frameWidth = 0;
+	int frameHeight = 0;
+	int nextId = 0;
+	int framesSinceDetection = 0;
+	bool debugDrawing = false;
+	double searchEffort = 1.0;
+	std::vector<cv::Rect> faces;
+	std::vector<bool> assigned;
+
+	bool isDetectionDue(FaceDetector& cascade);
+	Subject* addSubject();
+};
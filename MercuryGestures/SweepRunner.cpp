@@ -0,0 +1,387 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "SweepRunner.h"
+#include "ResultFile.h"
+#include <cstdio>
+#include <memory>
+#include <sstream>
+
+namespace {
+	std::string getVideoName(std::string videoPath) {
+		size_t slash = videoPath.find_last_of("/\\");
+		std::string name = slash == std::string::npos ? videoPath : videoPath.substr(slash + 1);
+		size_t dot = name.find_last_of('.');
+		if (dot != std::string::npos && dot > 0)
+			name = name.substr(0, dot);
+		return name;
+	}
+
+	void writeParameterHeader(std::ostream& out) {
+		out << "set,minContourSize,handEdgeThreshold,faceMaskThreshold,coverageSearchIterations,directionSearchIterations,areaSearchIterations" << std::endl;
+	}
+
+	void writeParameterSet(std::ostream& out, int index, HandParameters& parameters) {
+		out << index << "," << parameters.minContourSize << "," << parameters.handEdgeThreshold << ","
+			<< parameters.faceMaskThreshold << "," << parameters.coverageSearchIterations << ","
+			<< parameters.directionSearchIterations << "," << parameters.areaSearchIterations << std::endl;
+	}
+}
+
+/*
+* The replay of one parameter set: the steps of Pipeline::processSubject after the shared maps, with a hand detector
+* of its own. Only the job itself is written, so the jobs of a frame can run at the same time.
+*/
+class SweepJob {
+public:
+	FramePool framePool;
+	HandDetector handDetector;
+	MovementDetector ROImovementDetector;
+	MovementEngine movementEngine;
+	cv::Mat roiMask;
+	std::vector<cv::Mat*> masks;
+	std::vector<int> counts;
+	PipelineResult result;
+	std::ofstream output;
+	ResultFileWriter binaryOutput;
+
+	SweepJob(HandParameters& parameters, int fps) : handDetector(fps), ROImovementDetector(fps) {
+		this->handDetector.setDebugDrawing(false);
+		this->handDetector.framePool = &this->framePool;
+		this->handDetector.setParameters(parameters);
+	}
+
+	void replay(StageFrame& frame, cv::Mat& gray, cv::Mat& grayPrev) {
+		auto start = std::chrono::high_resolution_clock::now();
+		PipelineResult& result = this->result;
+		result = PipelineResult();
+		result.frameIndex = frame.frameIndex;
+		result.timestamp = frame.timestamp;
+		if (frame.faceDetected == false) {
+			this->handDetector.reset();
+			return;
+		}
+		result.faceDetected = true;
+		result.face = frame.face;
+		if (frame.valid == false)
+			return;
+
+		// the frame is shared by all jobs, the detector gets its own copy of the rect
+		cv::Rect face = frame.face;
+		cv::Mat& movementMap = frame.masks[STAGE_MOVEMENT];
+		this->handDetector.detect(gray, grayPrev, face,
+			frame.masks[STAGE_SKIN], movementMap, frame.masks[STAGE_EDGES],
+			frame.pixelSizeInCm, frame.area);
+
+		// the ROI map of the hands and the face, see Pipeline::processSubject
+		this->roiMask.create(movementMap.rows, movementMap.cols, movementMap.type());
+		this->roiMask.setTo(0);
+		this->handDetector.addResultToMask(this->roiMask);
+		cv::rectangle(this->roiMask, inflateRect(face, 10, this->roiMask), 255, CV_FILLED);
+		this->masks.assign(1, &this->roiMask);
+		this->movementEngine.countChanges(movementMap, this->masks, this->counts);
+		this->ROImovementDetector.update(this->counts[0], frame.normalizationFactor);
+
+		result.valid = true;
+		result.movementValue = frame.movementValue;
+		result.movementFilteredValue = frame.movementFilteredValue;
+		result.ROImovementValue = this->ROImovementDetector.value;
+		result.ROImovementFilteredValue = this->ROImovementDetector.filteredValue;
+		result.leftHand = this->handDetector.leftHand.position;
+		result.rightHand = this->handDetector.rightHand.position;
+		result.cmInPixels = this->handDetector.cmInPixels;
+		result.processingArea = frame.area;
+		addBlobSummaries(this->handDetector.blobs, result);
+		auto elapsed = std::chrono::high_resolution_clock::now() - start;
+		result.duration = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1000.0;
+	}
+};
+
+/*
+* Replays a range of the parameter sets on a frame, for cv::parallel_for_.
+*/
+class SweepLoopBody : public cv::ParallelLoopBody {
+public:
+	SweepLoopBody(std::vector<std::unique_ptr<SweepJob>>& jobs, StageFrame& frame, cv::Mat& gray, cv::Mat& grayPrev) :
+		jobs(jobs), frame(frame), gray(gray), grayPrev(grayPrev) {}
+
+	void operator()(const cv::Range& range) const {
+		for (int i = range.start; i < range.end; i++)
+			this->jobs[i]->replay(this->frame, this->gray, this->grayPrev);
+	}
+
+private:
+	std::vector<std::unique_ptr<SweepJob>>& jobs;
+	StageFrame& frame;
+	cv::Mat& gray;
+	cv::Mat& grayPrev;
+};
+
+SweepRunner::SweepRunner() {}
+
+SweepRunner::~SweepRunner() {}
+
+/*
+* The manifest is a text file with one video path per line, like that of the BatchProcessor.
+*/
+bool SweepRunner::loadManifest(std::string manifestPath) {
+	return readList(manifestPath, this->videos);
+}
+
+bool SweepRunner::loadParameters(std::string parametersPath) {
+	std::vector<std::string> lines;
+	if (readList(parametersPath, lines) == false)
+		return false;
+	for (auto& line : lines) {
+		HandParameters parameters;
+		if (parseHandParameters(line, parameters) == false)
+			return false;
+		this->parameterSets.push_back(parameters);
+	}
+	return this->parameterSets.size() > 0;
+}
+
+/*
+* Record the videos that have no stage cache for the current settings yet, then replay all parameter sets on every
+* video. Blocks until all videos are done.
+*/
+SweepSummary SweepRunner::run() {
+	SweepSummary summary;
+	summary.videos = this->videos.size();
+	summary.parameterSets = this->parameterSets.size();
+	if (this->parameterSets.empty() || this->writeParameters() == false) {
+		summary.failed = summary.videos;
+		return summary;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (auto& videoPath : this->videos) {
+		FrameSource source;
+		if (source.open(videoPath) == false) {
+			std::cerr << "Cannot open the video file: " << videoPath << std::endl;
+			summary.failed++;
+			continue;
+		}
+		Pipeline pipeline(source.getFps(), true);
+		this->setupPipeline(pipeline);
+		uint64_t key = getStageCacheKey(videoPath, pipeline);
+		if (key == 0) {
+			std::cerr << "Cannot read the video file: " << videoPath << std::endl;
+			summary.failed++;
+			continue;
+		}
+
+		std::string cachePath = this->getCachePath(videoPath, key);
+		StageCacheReader cache;
+		if (cache.open(cachePath, key) == false) {
+			auto recordStart = std::chrono::high_resolution_clock::now();
+			if (this->record(source, pipeline, cachePath, key) == false) {
+				summary.failed++;
+				continue;
+			}
+			auto recordElapsed = std::chrono::high_resolution_clock::now() - recordStart;
+			summary.recordSeconds += std::chrono::duration_cast<std::chrono::milliseconds>(recordElapsed).count() / 1000.0;
+			summary.recorded++;
+		}
+		cache.close();
+		source.release();
+
+		long long frames = this->replay(videoPath, cachePath, key);
+		if (frames < 0) {
+			summary.failed++;
+			continue;
+		}
+		summary.frames += frames * this->parameterSets.size();
+		std::cerr << videoPath << ": " << frames << " frames x " << this->parameterSets.size() << " parameter sets" << std::endl;
+	}
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	summary.seconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 1000.0;
+	return summary;
+}
+
+/*
+* The cache of a video is named after the video and the key, caches made with other settings stay next to it.
+*/
+std::string SweepRunner::getCachePath(std::string videoPath, uint64_t key) {
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+	return this->cacheDirectory + "/" + getVideoName(videoPath) + "-" + hex + ".msc";
+}
+
+std::string SweepRunner::getOutputPath(std::string videoPath, int parameterSet) {
+	return this->outputDirectory + "/" + getVideoName(videoPath) + "-" + std::to_string(parameterSet) + (this->binaryOutput ? ".mgr" : ".csv");
+}
+
+//***************************************** PRIVATE  **********************************************//
+
+/*
+* The settings of the upstream stages. These are part of the cache key, the replay does not depend on anything else.
+* The cache is made at full quality, single subject and without partial updates.
+*/
+void SweepRunner::setupPipeline(Pipeline& pipeline) {
+	pipeline.faceDetector.face_cascade_name = this->cascadeName;
+	pipeline.faceDetector.setFastDetection(this->fastFaceDetection);
+	pipeline.bodyRegionOnly = this->bodyRegionOnly;
+}
+
+/*
+* Run the whole pipeline on the video and record its stages. The cache is written next to its final path and only
+* moved there when complete, so a run that was stopped or failed to write does not leave a short cache behind.
+*/
+bool SweepRunner::record(FrameSource& source, Pipeline& pipeline, std::string cachePath, uint64_t key) {
+	if (pipeline.setup() == false)
+		return false;
+	std::string partialPath = cachePath + ".part";
+	StageCacheWriter writer;
+	if (writer.open(partialPath, key, source.getFps(), pipeline.frameHeightMax) == false) {
+		std::cerr << "Cannot write the stage cache: " << partialPath << std::endl;
+		return false;
+	}
+	// the run cannot be stopped from the callback, the writes after a failed one do nothing
+	bool written = true;
+	pipeline.run(source, [&writer, &pipeline, &written](PipelineResult& result) {
+		written = writer.write(pipeline, result) && written;
+	});
+	written = writer.close() && written;
+	if (written == false) {
+		std::cerr << "Cannot write the stage cache: " << partialPath << std::endl;
+		std::remove(partialPath.c_str());
+		return false;
+	}
+
+	std::remove(cachePath.c_str());
+	if (std::rename(partialPath.c_str(), cachePath.c_str()) != 0) {
+		std::cerr << "Cannot write the stage cache: " << cachePath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/*
+* Replay all parameter sets on the video from its cache. The frames are decoded again for the optical flow of the
+* hands, that is the only upstream work left. Returns the amount of frames, or -1 if the replay could not start, did
+* not get through all recorded frames or could not write the results.
+*/
+long long SweepRunner::replay(std::string videoPath, std::string cachePath, uint64_t key) {
+	StageCacheReader cache;
+	FrameSource source;
+	if (cache.open(cachePath, key) == false || source.open(videoPath) == false) {
+		std::cerr << "Cannot replay the stage cache: " << cachePath << std::endl;
+		return -1;
+	}
+	const StageCacheHeader& header = cache.getHeader();
+	int fps = int(std::round(header.fps));
+
+	std::vector<std::unique_ptr<SweepJob>> jobs;
+	for (int i = 0; i < int(this->parameterSets.size()); i++) {
+		std::unique_ptr<SweepJob> job(new SweepJob(this->parameterSets[i], fps));
+		// the frame size the stages were recorded at, like Pipeline::process sets it on the first frame
+		job->handDetector.setVideoProperties(header.frameWidth, header.frameHeight);
+		std::string outputPath = this->getOutputPath(videoPath, i);
+		bool opened = this->binaryOutput ? job->binaryOutput.open(outputPath, header.fps) : (job->output.open(outputPath), job->output.is_open());
+		if (opened == false) {
+			std::cerr << "Cannot write the results: " << outputPath << std::endl;
+			return -1;
+		}
+		if (this->binaryOutput)
+			job->binaryOutput.setFrameSize(header.frameWidth, header.frameHeight);
+		else
+			writeResultHeader(job->output);
+		jobs.push_back(std::move(job));
+	}
+
+	// only the resizing of prepare is used, so the frames match those the stages were recorded on
+	Pipeline preparer(fps, true);
+	preparer.frameHeightMax = header.frameHeightMax;
+	CapturedFrame captured;
+	PreparedFrame prepared;
+	StageFrame frame;
+	cv::Mat grayPrev;
+	long long frames = 0;
+	while (source.read(captured) && cache.read(frame)) {
+		if (preparer.prepare(captured, prepared) == false)
+			break;
+		if (frame.frameIndex != frames || prepared.gray.cols != header.frameWidth || prepared.gray.rows != header.frameHeight) {
+			std::cerr << "The stage cache does not match the video: " << cachePath << std::endl;
+			break;
+		}
+
+		SweepLoopBody body(jobs, frame, prepared.gray, grayPrev);
+		if (this->parallel && jobs.size() > 1)
+			cv::parallel_for_(cv::Range(0, jobs.size()), body);
+		else
+			body(cv::Range(0, jobs.size()));
+
+		for (auto& job : jobs) {
+			if (this->binaryOutput)
+				job->binaryOutput.write(job->result);
+			else
+				writeResult(job->output, job->result);
+		}
+		grayPrev = prepared.gray;
+		frames++;
+	}
+
+	if (frames != header.recordCount) {
+		std::cerr << "The replay stopped after " << frames << " of " << header.recordCount << " frames: " << cachePath << std::endl;
+		return -1;
+	}
+	for (int i = 0; i < int(jobs.size()); i++) {
+		bool written = this->binaryOutput ? jobs[i]->binaryOutput.close() : (jobs[i]->output.close(), jobs[i]->output.good());
+		if (written == false) {
+			std::cerr << "Cannot write the results: " << this->getOutputPath(videoPath, i) << std::endl;
+			return -1;
+		}
+	}
+	return frames;
+}
+
+/*
+* The parameter sets, parameters.csv in the output directory. The set index is part of the output names.
+*/
+bool SweepRunner::writeParameters() {
+	std::string path = this->outputDirectory + "/parameters.csv";
+	std::ofstream out(path);
+	if (!out.is_open()) {
+		std::cerr << "Cannot write the parameter sets: " << path << std::endl;
+		return false;
+	}
+	writeParameterHeader(out);
+	for (int i = 0; i < int(this->parameterSets.size()); i++)
+		writeParameterSet(out, i, this->parameterSets[i]);
+	return true;
+}
+
+/*
+* Parse a line of name=value pairs separated by spaces, like "handEdgeThreshold=150 minContourSize=5".
+*/
+bool parseHandParameters(std::string line, HandParameters& parameters) {
+	std::istringstream pairs(line);
+	std::string pair;
+	while (pairs >> pair) {
+		size_t equals = pair.find('=');
+		std::string name = pair.substr(0, equals);
+		if (equals == std::string::npos || equals + 1 == pair.size()) {
+			std::cerr << "Expected name=value: " << pair << std::endl;
+			return false;
+		}
+		double value = std::atof(pair.c_str() + equals + 1);
+		if (name == "minContourSize")
+			parameters.minContourSize = value;
+		else if (name == "handEdgeThreshold")
+			parameters.handEdgeThreshold = int(value);
+		else if (name == "faceMaskThreshold")
+			parameters.faceMaskThreshold = value;
+		else if (name == "coverageSearchIterations")
+			parameters.coverageSearchIterations = int(value);
+		else if (name == "directionSearchIterations")
+			parameters.directionSearchIterations = int(value);
+		else if (name == "areaSearchIterations")
+			parameters.areaSearchIterations = int(value);
+		else {
+			std::cerr << "Unknown hand parameter: " << name << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
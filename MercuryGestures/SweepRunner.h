@@ -0,0 +1,57 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "HandDetector.h"
+#include "Pipeline.h"
+#include "StageCache.h"
+
+struct SweepSummary {
+	int videos = 0;
+	int failed = 0;
+	int parameterSets = 0;
+	int recorded = 0;       // videos that had no usable stage cache yet
+	long long frames = 0;   // replayed frames of all videos, once per parameter set
+	double seconds = 0;
+	double recordSeconds = 0;
+};
+
+/*
+* Tune the hand detection on a list of videos. The upstream stages (face, skin, movement and edges) of every video are
+* recorded once into a stage cache in cacheDirectory, see StageCache.h. After that only the hand detection and the ROI
+* movement are replayed from the cache, for all parameter sets at once: a frame is decoded and read from the cache
+* once and then given to the hand detectors of all sets in parallel. The results of set n of a video are written to
+* the output directory as <video>-<n>.csv (or .mgr with binaryOutput), parameters.csv lists the sets.
+*
+* The parameter file has one set per line, as name=value pairs separated by spaces. Parameters that are not given
+* keep their default, see HandParameters.
+*/
+class SweepRunner {
+public:
+	std::vector<std::string> videos;
+	std::vector<HandParameters> parameterSets;
+	std::string cacheDirectory = ".";
+	std::string outputDirectory = ".";
+	std::string cascadeName = "./dependencies/haarcascade_frontalface_alt.xml";
+	bool binaryOutput = false;
+	bool bodyRegionOnly = false;    // see Pipeline::bodyRegionOnly, part of the cache key
+	bool fastFaceDetection = false; // see FaceDetector::setFastDetection, part of the cache key
+	bool parallel = true;           // replay the parameter sets of a frame with cv::parallel_for_
+
+	SweepRunner();
+	~SweepRunner();
+
+	bool loadManifest(std::string manifestPath);
+	bool loadParameters(std::string parametersPath);
+	SweepSummary run();
+
+	std::string getCachePath(std::string videoPath, uint64_t key);
+	std::string getOutputPath(std::string videoPath, int parameterSet);
+
+private:
+	void setupPipeline(Pipeline& pipeline);
+	bool record(FrameSource& source, Pipeline& pipeline, std::string cachePath, uint64_t key);
+	long long replay(std::string videoPath, std::string cachePath, uint64_t key);
+	bool writeParameters();
+};
+
+bool parseHandParameters(std::string line, HandParameters& parameters);
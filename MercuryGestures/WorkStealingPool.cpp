@@ -0,0 +1,105 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include "WorkStealingPool.h"
+
+namespace {
+	// the pool and queue the current thread works for, used to keep tasks submitted from a worker local.
+	thread_local WorkStealingPool* currentPool = nullptr;
+	thread_local int currentQueue = -1;
+}
+
+WorkStealingPool::WorkStealingPool(int workers) {
+	this->pending = 0;
+	this->nextQueue = 0;
+	this->steals = 0;
+	workers = std::max(1, workers);
+	for (int i = 0; i < workers; i++)
+		this->queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+	for (int i = 0; i < workers; i++)
+		this->threads.push_back(std::thread(&WorkStealingPool::work, this, i));
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	this->stop();
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+	int index = currentPool == this ? currentQueue : this->nextQueue++ % this->queues.size();
+	{
+		std::lock_guard<std::mutex> lock(this->queues[index]->mutex);
+		this->queues[index]->tasks.push_back(std::move(task));
+	}
+	// pending is changed under the wake lock so a worker going to sleep cannot miss it.
+	std::lock_guard<std::mutex> lock(this->wakeMutex);
+	this->pending++;
+	this->wake.notify_one();
+}
+
+/*
+* Run the queued tasks and join the workers. Tasks submitted while stopping are still run.
+*/
+void WorkStealingPool::stop() {
+	{
+		std::lock_guard<std::mutex> lock(this->wakeMutex);
+		this->stopping = true;
+		this->wake.notify_all();
+	}
+	for (auto& thread : this->threads) {
+		if (thread.joinable())
+			thread.join();
+	}
+	this->threads.clear();
+}
+
+int WorkStealingPool::getWorkerCount() {
+	return this->queues.size();
+}
+
+long long WorkStealingPool::getStealCount() {
+	return this->steals;
+}
+
+bool WorkStealingPool::takeOwn(int index, std::function<void()>& task) {
+	WorkerQueue& queue = *this->queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty())
+		return false;
+	task = std::move(queue.tasks.front());
+	queue.tasks.pop_front();
+	return true;
+}
+
+bool WorkStealingPool::steal(int index, std::function<void()>& task) {
+	int count = this->queues.size();
+	for (int offset = 1; offset < count; offset++) {
+		WorkerQueue& queue = *this->queues[(index + offset) % count];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+		task = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+		this->steals++;
+		return true;
+	}
+	return false;
+}
+
+void WorkStealingPool::work(int index) {
+	currentPool = this;
+	currentQueue = index;
+	std::function<void()> task;
+	for (;;) {
+		if (this->takeOwn(index, task) || this->steal(index, task)) {
+			this->pending--;
+			task();
+			task = nullptr;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(this->wakeMutex);
+		this->wake.wait(lock, [this] { return this->stopping || this->pending > 0; });
+		if (this->stopping && this->pending == 0)
+			return;
+	}
+}
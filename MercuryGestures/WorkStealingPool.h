@@ -0,0 +1,46 @@
+#pragma once
+
+#include "MercuryCore.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+* A fixed size pool of worker threads. Every worker has its own task queue. A worker runs the oldest task of its own
+* queue first and steals from the back of the other queues when its own is empty, so one worker stuck on a slow task
+* does not hold up the tasks queued behind it.
+* Tasks submitted from a worker go to the back of its own queue, tasks from other threads are spread round robin.
+*/
+class WorkStealingPool {
+public:
+	WorkStealingPool(int workers);
+	~WorkStealingPool();
+
+	void submit(std::function<void()> task);
+	void stop();
+	int getWorkerCount();
+	long long getStealCount();
+
+private:
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	std::atomic<int> pending;
+	std::atomic<unsigned int> nextQueue;
+	std::atomic<long long> steals;
+	bool stopping = false;
+
+	bool takeOwn(int index, std::function<void()>& task);
+	bool steal(int index, std::function<void()>& task);
+	void work(int index);
+};
@@ -0,0 +1,539 @@
+#include "MercuryCore.h"
+#include "CoverageMap.h"
+#include "EdgeDetector.h"
+#include "FaceDetector.h"
+#include "HandDetector.h"
+#include "Morphology.h"
+#include "MovementEngine.h"
+#include "Pipeline.h"
+#include "SkinDetector.h"
+#include "StageCache.h"
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <thread>
+#include <opencv2/core/ocl.hpp>
+
+/*
+* Microbenchmarks of the hot kernels on checked in fixtures, and an end to end run of the headless pipeline on a video.
+* The results are written as json so runs can be compared across commits and machines.
+*
+* MercuryGesturesBench [--fixtures <dir>] [--video <file>] [--frames <n>] [--repetitions <n>] [--output <file.json>]
+* MercuryGesturesBench --capture <video> <frame index> <fixture dir>
+*
+* The fixtures are frame0.png and frame1.png (two consecutive frames, already resized to the pipeline height) and
+* skin0.png (the skin mask of frame0). The face rect used for the skin detection is fixed.
+*
+* If there is an OpenCL device the per pixel kernels and the end to end run are measured on it as well, with
+* [opencl] after the name. The device kernels include the download of their results.
+*/
+
+/*
+* Every allocation through operator new, to count those of the pipeline per frame. The buffers of cv::Mat go through
+* cv::fastMalloc instead, they are only counted as misses of the frame pool.
+*/
+static std::atomic<long long> heapAllocations(0);
+
+void* operator new(std::size_t size) {
+	heapAllocations++;
+	void* memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+struct BenchmarkResult {
+	std::string name;
+	int iterations = 0;   // kernel calls per repetition
+	int repetitions = 0;
+	double mean = 0;      // us per kernel call
+	double median = 0;
+	double min = 0;
+	double max = 0;
+};
+
+class Benchmark {
+public:
+	std::vector<BenchmarkResult> results;
+	int repetitions = 50;
+
+	/*
+	* Time the kernel. It is called iterations times per repetition, the statistics are over the repetitions.
+	*/
+	void run(std::string name, int iterations, std::function<void()> kernel) {
+		// warm up the caches and the lazily built tables
+		for (int i = 0; i < iterations; i++)
+			kernel();
+
+		std::vector<double> times;
+		for (int r = 0; r < this->repetitions; r++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < iterations; i++)
+				kernel();
+			auto elapsed = std::chrono::high_resolution_clock::now() - start;
+			times.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / 1000.0 / iterations);
+		}
+		std::sort(times.begin(), times.end());
+
+		BenchmarkResult result;
+		result.name = name;
+		result.iterations = iterations;
+		result.repetitions = this->repetitions;
+		result.mean = getAverage(times);
+		result.median = times[times.size() / 2];
+		result.min = times.front();
+		result.max = times.back();
+		this->results.push_back(result);
+		std::cerr << name << ": " << result.median << " us" << std::endl;
+	}
+
+	void add(BenchmarkResult& result) {
+		this->results.push_back(result);
+	}
+
+	void writeJson(std::ostream& out) {
+		out << "{" << std::endl;
+		out << "  \"opencv\": \"" << CV_VERSION << "\"," << std::endl;
+		out << "  \"hardwareConcurrency\": " << std::thread::hardware_concurrency() << "," << std::endl;
+		out << "  \"openclDevice\": \"" << (cv::ocl::haveOpenCL() ? cv::ocl::Device::getDefault().name() : "") << "\"," << std::endl;
+		out << "  \"benchmarks\": [" << std::endl;
+		for (int i = 0; i < this->results.size(); i++) {
+			BenchmarkResult& result = this->results[i];
+			out << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+				<< ", \"repetitions\": " << result.repetitions << ", \"meanUs\": " << result.mean
+				<< ", \"medianUs\": " << result.median << ", \"minUs\": " << result.min
+				<< ", \"maxUs\": " << result.max << "}" << (i + 1 < this->results.size() ? "," : "") << std::endl;
+		}
+		out << "  ]" << std::endl;
+		out << "}" << std::endl;
+	}
+};
+
+/*
+* Access to the private search kernels of the hand.
+*/
+class HandBenchmark {
+public:
+	static double getCoverage(Hand& hand, cv::Point& position, CoverageMap& coverage, SearchSpace& space, int radius) {
+		return hand.getCoverage(position, coverage, space, radius);
+	}
+	static cv::Point lookAround(Hand& hand, cv::Point start, CoverageMap& coverage, int maxIterations, int stepSize, int radius, SearchMode searchMode) {
+		return hand.lookAround(start, coverage, maxIterations, stepSize, radius, searchMode);
+	}
+};
+
+/*
+* Access to the lookup table classification of the skin, without the average face color around it.
+*/
+class SkinBenchmark {
+public:
+	static void classify(SkinDetector& detector, cv::Mat& frame, cv::Mat& mask) {
+		detector.classify(frame, mask);
+	}
+	static cv::Scalar getLowerBounds(SkinDetector& detector) {
+		return cv::Scalar(detector.lookupBounds[0], detector.lookupBounds[2], detector.lookupBounds[4]);
+	}
+	static cv::Scalar getUpperBounds(SkinDetector& detector) {
+		return cv::Scalar(detector.lookupBounds[1], detector.lookupBounds[3], detector.lookupBounds[5]);
+	}
+};
+
+struct Fixtures {
+	cv::Mat frame;
+	cv::Mat framePrev;
+	cv::Mat gray;
+	cv::Mat grayPrev;
+	cv::Mat skinMask;
+	cv::Rect face = cv::Rect(221, 50, 90, 120);
+	cv::Point hand = cv::Point(180, 300);
+	double cmInPixels = 4;
+};
+
+bool loadFixtures(std::string directory, Fixtures& fixtures) {
+	fixtures.framePrev = cv::imread(directory + "/frame0.png", cv::IMREAD_COLOR);
+	fixtures.frame = cv::imread(directory + "/frame1.png", cv::IMREAD_COLOR);
+	fixtures.skinMask = cv::imread(directory + "/skin0.png", cv::IMREAD_GRAYSCALE);
+	if (fixtures.frame.empty() || fixtures.framePrev.empty() || fixtures.skinMask.empty()) {
+		std::cerr << "Cannot load the fixtures from " << directory << std::endl;
+		return false;
+	}
+	cv::cvtColor(fixtures.framePrev, fixtures.grayPrev, CV_BGR2GRAY);
+	cv::cvtColor(fixtures.frame, fixtures.gray, CV_BGR2GRAY);
+	return true;
+}
+
+void runKernels(Benchmark& benchmark, Fixtures& fixtures) {
+	DebugSink debugSink;
+	debugSink.setActive(false);
+
+	CoverageMap skinCoverage;
+	skinCoverage.build(fixtures.skinMask);
+
+	Hand hand;
+	hand.debug = &debugSink;
+	hand.cmInPixels = fixtures.cmInPixels;
+
+	benchmark.run("CoverageMap::build", 10, [&] {
+		skinCoverage.build(fixtures.skinMask);
+	});
+
+	SearchSpace space;
+	getSearchSpace(space, fixtures.skinMask, fixtures.hand);
+	cv::Point position = fixtures.hand;
+	toSearchSpace(space, position);
+	int radius = 5 * fixtures.cmInPixels;
+	volatile double coverageSink = 0;
+	benchmark.run("Hand::getCoverage", 1000, [&] {
+		coverageSink = HandBenchmark::getCoverage(hand, position, skinCoverage, space, radius);
+	});
+
+	cv::Point start = fixtures.hand + cv::Point(-20, -15);
+	benchmark.run("Hand::lookAround", 100, [&] {
+		HandBenchmark::lookAround(hand, start, skinCoverage, 20, 4, radius, FREE_SEARCH);
+	});
+
+	// the same walk with the single step size only, to compare the steps and queries of the coarse to fine search
+	int coarseQueries = hand.coverageSearch.queries;
+	hand.coverageSearch.maxLevels = 1;
+	benchmark.run("Hand::lookAround[single level]", 100, [&] {
+		HandBenchmark::lookAround(hand, start, skinCoverage, 20, 4, radius, FREE_SEARCH);
+	});
+	std::cerr << "lookAround queries: " << coarseQueries << " coarse to fine, " << hand.coverageSearch.queries << " single level" << std::endl;
+	hand.coverageSearch.maxLevels = 3;
+
+	HandDetector handDetector(25);
+	std::vector<BlobInformation> blobs;
+	double minArea = 6 * 6 * fixtures.cmInPixels * fixtures.cmInPixels;
+	benchmark.run("HandDetector::extractBlobs", 10, [&] {
+		handDetector.extractBlobs(fixtures.skinMask, minArea, blobs);
+	});
+
+	// the van Herk closing against the two OpenCV calls the blob extraction uses, which stays on them until this shows
+	// the closing is faster
+	cv::Mat closed;
+	Morphology morphology;
+	benchmark.run("Morphology::close", 10, [&] {
+		morphology.close(fixtures.skinMask, closed, 6);
+	});
+	benchmark.run("cv::dilate+cv::erode", 10, [&] {
+		dilate(fixtures.skinMask, closed);
+		erode(closed, closed);
+	});
+	benchmark.run("Morphology::dilate", 10, [&] {
+		morphology.dilate(fixtures.skinMask, closed, 6);
+	});
+	benchmark.run("cv::dilate", 10, [&] {
+		dilate(fixtures.skinMask, closed);
+	});
+	benchmark.run("Morphology::erode", 10, [&] {
+		morphology.erode(fixtures.skinMask, closed, 6);
+	});
+	benchmark.run("cv::erode", 10, [&] {
+		erode(fixtures.skinMask, closed);
+	});
+
+	EdgeDetector edgeDetector;
+	benchmark.run("EdgeDetector::detect", 10, [&] {
+		edgeDetector.detect(fixtures.gray);
+	});
+
+	if (blobs.size() > 0) {
+		std::vector<BlobEdgeData> edgeData;
+		benchmark.run("HandDetector::getEdgeData", 10, [&] {
+			handDetector.getEdgeData(blobs, edgeDetector.detectedEdges, edgeData);
+		});
+	}
+
+	SkinDetector skinDetector;
+	skinDetector.detect(fixtures.face, fixtures.framePrev, false);
+	benchmark.run("SkinDetector::detect", 10, [&] {
+		skinDetector.detect(fixtures.face, fixtures.frame, true);
+	});
+
+	// the lookup table classification against the OpenCV calls detect uses, with the bounds of the fixture face
+	cv::Mat classified;
+	benchmark.run("SkinDetector::classify", 10, [&] {
+		SkinBenchmark::classify(skinDetector, fixtures.frame, classified);
+	});
+	int threads = cv::getNumThreads();
+	cv::setNumThreads(1);
+	benchmark.run("SkinDetector::classify[1 thread]", 10, [&] {
+		SkinBenchmark::classify(skinDetector, fixtures.frame, classified);
+	});
+	cv::setNumThreads(threads);
+	cv::Mat colors, inRangeMask;
+	cv::Scalar lower = SkinBenchmark::getLowerBounds(skinDetector);
+	cv::Scalar upper = SkinBenchmark::getUpperBounds(skinDetector);
+	benchmark.run("cv::cvtColor+cv::inRange", 10, [&] {
+		cv::cvtColor(fixtures.frame, colors, cv::COLOR_BGR2YCrCb);
+		cv::inRange(colors, lower, upper, inRangeMask);
+	});
+	cv::Mat difference;
+	cv::absdiff(classified, inRangeMask, difference);
+	std::cerr << "classify differs from cvtColor+inRange in " << cv::countNonZero(difference) << " pixels" << std::endl;
+
+	// the changes of the frame as the incremental mode finds them, and the skin masked movement as the pipeline makes
+	// it: difference, threshold and mask in one pass
+	MovementEngine movementEngine;
+	benchmark.run("MovementEngine::detectChanges", 10, [&] {
+		movementEngine.detectChanges(fixtures.gray, fixtures.grayPrev);
+	});
+	cv::Mat maskedChanges;
+	benchmark.run("MovementEngine::maskChanges", 10, [&] {
+		movementEngine.maskChanges(fixtures.gray, fixtures.grayPrev, fixtures.skinMask, maskedChanges);
+	});
+	std::vector<cv::Mat*> masks(2, &fixtures.skinMask);
+	std::vector<int> counts;
+	benchmark.run("MovementEngine::countChanges", 10, [&] {
+		movementEngine.countChanges(maskedChanges, masks, counts);
+	});
+
+	// the run length coding of the stage cache, on the skin mask
+	std::vector<uint8_t> encoded;
+	benchmark.run("StageCache::encodeMask", 10, [&] {
+		encodeMask(fixtures.skinMask, encoded);
+	});
+	cv::Mat decoded(fixtures.skinMask.rows, fixtures.skinMask.cols, CV_8U);
+	benchmark.run("StageCache::decodeMask", 10, [&] {
+		decodeMask(encoded.data(), encoded.size(), decoded);
+	});
+	std::cerr << "encoded skin mask: " << encoded.size() << " bytes of " << fixtures.skinMask.total() << std::endl;
+}
+
+/*
+* The setup of a face detector with and without the parsed cascade in the cache, and the cascade on the full frame,
+* downscaled and at the size of the locked face. Skipped if the cascade cannot be loaded.
+*/
+void runFaceDetection(Benchmark& benchmark, Fixtures& fixtures) {
+	FaceDetector faceDetector;
+	CascadeCache& cache = CascadeCache::instance();
+	benchmark.run("CascadeCache::load[parse]", 1, [&] {
+		cache.clear();
+		cache.load(faceDetector.face_cascade_name);
+	});
+	if (faceDetector.setup() == false)
+		return;
+	benchmark.run("FaceDetector::setup[cached]", 1, [&] {
+		faceDetector.setup();
+	});
+
+	faceDetector.setVideoProperties(fixtures.gray.cols, fixtures.gray.rows);
+	std::vector<cv::Rect> faces;
+	benchmark.run("FaceDetector::detectFaces", 1, [&] {
+		faceDetector.detectFaces(fixtures.gray, faces);
+	});
+	faceDetector.setFastDetection(true);
+	benchmark.run("FaceDetector::detectFaces[downscaled]", 1, [&] {
+		faceDetector.detectFaces(fixtures.gray, faces);
+	});
+	SearchSpace space;
+	getSearchSpace(space, fixtures.gray, fixtures.face, 50);
+	benchmark.run("FaceDetector::detectFaces[locked scale]", 1, [&] {
+		faceDetector.detectFaces(space.mat, faces, fixtures.face.height);
+	});
+}
+
+/*
+* The per pixel kernels on the OpenCL device, the frames are uploaded once.
+*/
+void runDeviceKernels(Benchmark& benchmark, Fixtures& fixtures) {
+	cv::ocl::setUseOpenCL(true);
+	cv::UMat frame, framePrev, gray, grayPrev;
+	fixtures.frame.copyTo(frame);
+	fixtures.framePrev.copyTo(framePrev);
+	fixtures.gray.copyTo(gray);
+	fixtures.grayPrev.copyTo(grayPrev);
+
+	EdgeDetector edgeDetector;
+	benchmark.run("EdgeDetector::detect[opencl]", 10, [&] {
+		edgeDetector.detect(gray);
+	});
+
+	SkinDetector skinDetector;
+	skinDetector.detect(fixtures.face, framePrev, false);
+	benchmark.run("SkinDetector::detect[opencl]", 10, [&] {
+		skinDetector.detect(fixtures.face, frame, true);
+	});
+
+	MovementEngine movementEngine;
+	benchmark.run("MovementEngine::detectChanges[opencl]", 10, [&] {
+		movementEngine.detectChanges(gray, grayPrev);
+	});
+}
+
+/*
+* Statistics of per frame times in us, as a result of one iteration per frame.
+*/
+BenchmarkResult getFrameStatistics(std::string name, std::vector<double>& durations) {
+	std::sort(durations.begin(), durations.end());
+	BenchmarkResult result;
+	result.name = name;
+	result.iterations = 1;
+	result.repetitions = durations.size();
+	result.mean = getAverage(durations);
+	result.median = durations[durations.size() / 2];
+	result.min = durations.front();
+	result.max = durations.back();
+	return result;
+}
+
+/*
+* Replay a video through the headless pipeline and report the frames per second.
+*/
+bool runEndToEnd(Benchmark& benchmark, std::string videoPath, int maxFrames, bool useOpenCL) {
+	FrameSource source;
+	if (source.open(videoPath) == false) {
+		std::cerr << "Cannot open the video file: " << videoPath << std::endl;
+		return false;
+	}
+	Pipeline pipeline(source.getFps(), true);
+	if (pipeline.setup() == false)
+		return false;
+	pipeline.setOpenCL(useOpenCL);
+	std::string suffix = useOpenCL ? "[opencl]" : "";
+
+	CapturedFrame captured;
+	PipelineResult result;
+	std::vector<double> durations;
+	std::vector<double> frameTimes;
+	std::vector<double> frameAllocations; // operator new calls of process, from the second frame on
+	auto start = std::chrono::high_resolution_clock::now();
+	while (maxFrames <= 0 || durations.size() < maxFrames) {
+		auto frameStart = std::chrono::high_resolution_clock::now();
+		if (source.read(captured) == false)
+			break;
+		long long allocationsBefore = heapAllocations;
+		if (pipeline.process(captured, result) == false)
+			break;
+		if (durations.size() > 0)
+			frameAllocations.push_back(double(heapAllocations - allocationsBefore));
+		auto frameElapsed = std::chrono::high_resolution_clock::now() - frameStart;
+		durations.push_back(result.duration * 1000.0);
+		frameTimes.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(frameElapsed).count() / 1000.0);
+	}
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	if (durations.empty())
+		return false;
+
+	double seconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1e6;
+
+	// per frame statistics. The duration of the result starts after the decoding, the read and the process together
+	// include it.
+	BenchmarkResult frames = getFrameStatistics("Pipeline::process" + suffix, durations);
+	benchmark.add(frames);
+	BenchmarkResult decodedFrames = getFrameStatistics("FrameSource::read+Pipeline::process" + suffix, frameTimes);
+	benchmark.add(decodedFrames);
+
+	// the fps is stored as the value of the "endToEndFps" entry.
+	BenchmarkResult fps;
+	fps.name = "endToEndFps" + suffix;
+	fps.iterations = 1;
+	fps.repetitions = durations.size();
+	fps.mean = fps.median = fps.min = fps.max = durations.size() / seconds;
+	benchmark.add(fps);
+	std::cerr << "end to end" << suffix << ": " << fps.mean << " fps" << std::endl;
+
+	// the amount of frame buffers allocated over the whole run, this should not grow with the amount of frames.
+	BenchmarkResult allocations;
+	allocations.name = "framePoolAllocations" + suffix;
+	allocations.iterations = 1;
+	allocations.repetitions = durations.size();
+	allocations.mean = allocations.median = allocations.min = allocations.max = pipeline.framePool.getAllocationCount();
+	benchmark.add(allocations);
+
+	// the heap allocations of every frame after the first, the value of the entry is the count instead of a time.
+	if (frameAllocations.size() > 0) {
+		BenchmarkResult heap = getFrameStatistics("heapAllocationsPerFrame" + suffix, frameAllocations);
+		benchmark.add(heap);
+		std::cerr << "heap allocations per frame" << suffix << ": " << heap.mean << " (max " << heap.max << ")" << std::endl;
+	}
+	return true;
+}
+
+/*
+* Write fixtures from a video: the frames at frameIndex and frameIndex + 1 after resizing and the skin mask of the first.
+*/
+int captureFixtures(std::string videoPath, int frameIndex, std::string directory) {
+	cv::VideoCapture cap(videoPath);
+	if (!cap.isOpened()) {
+		std::cerr << "Cannot open the video file: " << videoPath << std::endl;
+		return -1;
+	}
+	Pipeline pipeline(getFps(cap), true);
+	if (pipeline.setup() == false)
+		return -1;
+
+	cv::Mat rawFrame;
+	PipelineResult result;
+	for (int i = 0; i <= frameIndex + 1; i++) {
+		cap >> rawFrame;
+		if (pipeline.process(rawFrame, result) == false) {
+			std::cerr << "The video ends before frame " << frameIndex + 1 << std::endl;
+			return -1;
+		}
+		if (i == frameIndex) {
+			cv::imwrite(directory + "/frame0.png", pipeline.frame);
+			cv::imwrite(directory + "/skin0.png", pipeline.skinDetector.skinMask);
+		}
+		else if (i == frameIndex + 1) {
+			cv::imwrite(directory + "/frame1.png", pipeline.frame);
+		}
+	}
+	std::cerr << "face at " << result.face.x << "," << result.face.y << " " << result.face.width << "x" << result.face.height << std::endl;
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> args(argv + 1, argv + argc);
+	if (args.size() > 3 && args[0] == "--capture")
+		return captureFixtures(args[1], std::atoi(args[2].c_str()), args[3]);
+
+	std::string fixtureDirectory = "./bench/fixtures";
+	std::string videoPath;
+	std::string outputPath;
+	int maxFrames = 500;
+	Benchmark benchmark;
+	for (int i = 0; i + 1 < args.size(); i += 2) {
+		if (args[i] == "--fixtures")
+			fixtureDirectory = args[i + 1];
+		else if (args[i] == "--video")
+			videoPath = args[i + 1];
+		else if (args[i] == "--frames")
+			maxFrames = std::atoi(args[i + 1].c_str());
+		else if (args[i] == "--repetitions")
+			benchmark.repetitions = std::max(1, std::atoi(args[i + 1].c_str()));
+		else if (args[i] == "--output")
+			outputPath = args[i + 1];
+	}
+
+	Fixtures fixtures;
+	if (loadFixtures(fixtureDirectory, fixtures) == false)
+		return -1;
+	runKernels(benchmark, fixtures);
+	runFaceDetection(benchmark, fixtures);
+	bool haveOpenCL = cv::ocl::haveOpenCL();
+	if (haveOpenCL)
+		runDeviceKernels(benchmark, fixtures);
+
+	if (videoPath.size() > 0) {
+		if (runEndToEnd(benchmark, videoPath, maxFrames, false) == false)
+			return -1;
+		if (haveOpenCL && runEndToEnd(benchmark, videoPath, maxFrames, true) == false)
+			return -1;
+	}
+
+	if (outputPath.size() > 0) {
+		std::ofstream out(outputPath);
+		benchmark.writeJson(out);
+	}
+	else {
+		benchmark.writeJson(std::cout);
+	}
+	return 0;
+}
@@ -1,181 +1,135 @@
 #include "MercuryCore.h"
-#include "FaceDetector.h"
 #include "ActivityGraph.h"
-#include "EdgeDetector.h"
-#include "MovementDetector.h"
-#include "SkinDetector.h"
-#include "HandDetector.h"
+#include "Pipeline.h"
+#include "PipelineExecutor.h"
+#include "BatchProcessor.h"
+#include "StreamManager.h"
+#include "ResultPublisher.h"
+#include "PublishSinks.h"
+#include "ResultFile.h"
+#include "SweepRunner.h"
+#include "Profiler.h"
+#include <iomanip>
+#include <opencv2/core/ocl.hpp>
 
 /*
-* Run the algorithm on this video feed
+* The options given in front of the mode, see main.
 */
-int run(cv::VideoCapture& cap, int fps) {
+struct RunOptions {
+	ResultPublisher* publisher = nullptr;
+	double latencyBudget = 0;   // ms per frame, 0 runs at full quality
+	bool incremental = false;   // see Pipeline::incremental
+	bool bodyRegionOnly = false; // see Pipeline::bodyRegionOnly
+	bool useOpenCL = false;      // see Pipeline::setOpenCL
+	int maxSubjects = 1;         // see Pipeline::setMaxSubjects
+	bool fastFaceDetection = false; // see FaceDetector::setFastDetection
+	bool asynchronousFaceDetection = false; // see FaceDetector::setAsynchronous
+};
+
+/*
+* Run the algorithm on this video feed and show the results. This is the viewer on top of the pipeline.
+* The results are given to the publisher if there is one.
+*/
+int run(FrameSource& source, RunOptions& options) {
 	// init the classes
-	
-	SkinDetector  skinDetector;
-	EdgeDetector  edgeDetector;
-	HandDetector  handDetector(fps);
-	MovementDetector movementDetector(fps);
-	MovementDetector ROImovementDetector(fps);
+	int fps = source.getFps();
+	Pipeline pipeline(fps, false);
 	ActivityGraph activityGraph(fps);
-	FaceDetector  faceDetector;
-	if (faceDetector.setup() == false)
+	if (pipeline.setup() == false)
 		return -1;
+	pipeline.setLatencyBudget(options.latencyBudget);
+	pipeline.incremental = options.incremental;
+	pipeline.bodyRegionOnly = options.bodyRegionOnly;
+	pipeline.setOpenCL(options.useOpenCL);
+	pipeline.setMaxSubjects(options.maxSubjects);
+	pipeline.faceDetector.setFastDetection(options.fastFaceDetection);
+	pipeline.faceDetector.setAsynchronous(options.asynchronousFaceDetection);
 
 	// setup the base collection of cvMats
-	cv::Mat rawFrame;
-	cv::Mat frame;
-	cv::Mat gray;
-	cv::Mat grayPrev;
-
-	int frameHeightMax = 400;
-	
-	BodyRects body;
-
-	int frameIndex = 0;
-	bool initialized = false;
-	
+	CapturedFrame captured;
+	cv::Mat canvas;
+	cv::Mat faceMat;
+	PipelineResult result;
 
 	// DEBUG
 	int waitTime = 2;
 	int skip = 0;
 	int calcSkip = 0;
 
-	activityGraph.addChannel("Skin masked Movement", CV_RGB(0, 255, 0), 0.0);
-	activityGraph.addChannel("ROI masked Movement", CV_RGB(255, 0, 0), 0.0);
+	int skinChannel = activityGraph.addChannel("Skin masked Movement", CV_RGB(0, 255, 0), 0.0);
+	int ROIchannel = activityGraph.addChannel("ROI masked Movement", CV_RGB(255, 0, 0), 0.0);
 
+	// like Pipeline::run, the frames the quality level asks to drop are skipped without decoding them
+	source.setTargetHeight(pipeline.frameHeightMax);
+	source.start();
 	for (;;) {
-		// get a new video frame
-		cap >> rawFrame;
-
-		// debug time elapsed
-		auto start = std::chrono::high_resolution_clock::now();
-
-		// check for end of video file.
-		if (rawFrame.empty()) { break; }
-		int frameWidth  = rawFrame.cols;
-		int frameHeight = rawFrame.rows;
-
-		// resize image
-		double resizeFactor = frameHeightMax / double(frameHeight);
-		cv::Size size(std::round(frameWidth * resizeFactor), frameHeightMax);
-		cv::resize(rawFrame, frame, size); 
-		frameWidth = frame.cols;
-		frameHeight = frame.rows;
-
-		// on the very first frame we initialize the classes
-		if (frameIndex == 0) {
-			faceDetector.setVideoProperties(frameWidth, frameHeight);
-			handDetector.setVideoProperties(frameWidth, frameHeight);
-			activityGraph.setVideoProperties(frameWidth, frameHeight);
-		}
+		// get a new video frame, false at the end of the video file.
+		if (source.read(captured, pipeline.framesToDrop) == false) { break; }
 
 		// DEBUG
 		if (skip > 0) {
 			skip--;
-			frameIndex++;
-			std::cout << "skipping:" << frameIndex << std::endl;
+			pipeline.frameIndex++;
+			std::cout << "skipping:" << pipeline.frameIndex << std::endl;
 			continue;
 		}
 
-		// convert frame to grayscale
-		cv::cvtColor(frame, gray, CV_BGR2GRAY);
-
-		cv::imshow("raw", frame);
-
-		// start detection of edges, face and skin
-		bool faceDetected = faceDetector.detect(gray);
-		double pixelSizeInCm = faceDetector.pixelSizeInCm;
-		if (faceDetected) {
-			auto face = &(faceDetector.face.rect);
-			skinDetector.detect(*face, frame, initialized, (3.0 / pixelSizeInCm) * 4);
-			edgeDetector.detect(gray);
-			
-			if (initialized) {
-				cv::Mat temporalSkinMask = skinDetector.getMergedMap();
-				cv::Mat roiMask = cv::Mat::zeros(temporalSkinMask.rows, temporalSkinMask.cols, temporalSkinMask.type()); // all 0
-
-				// get an initial motion estimate based on the temporal skin mask alone. This is used 
-				// in the hand detection
-				movementDetector.detect(gray, grayPrev);
-				movementDetector.mask(temporalSkinMask);
-				movementDetector.calculate(faceDetector.normalizationFactor);
-
-				handDetector.detect(
-					gray, grayPrev,
-					*face,
-					skinDetector.skinMask,
-					movementDetector.movementMap,
-					edgeDetector.detectedEdges,
-					pixelSizeInCm
-				);
-
-				cv::Mat faceMat;
-				frame.copyTo(faceMat);
-
-				handDetector.draw(frame);
-				handDetector.drawTraces(frame);
-				
-				faceDetector.draw(faceMat);
-
-				cv::imshow("face", faceMat);
-
-				// create the ROI map with just the hands and the face. This would reduce the difference
-				// between long and short sleeves.
-				handDetector.addResultToMask(roiMask);
-				faceDetector.addResultToMask(roiMask);
-				cv::bitwise_and(temporalSkinMask, roiMask, temporalSkinMask);
-
-				// detect movent only within the ROI areas.
-				ROImovementDetector.detect(gray, grayPrev);
-				ROImovementDetector.mask(temporalSkinMask);
-				ROImovementDetector.calculate(faceDetector.normalizationFactor);
-
-				// draw the graph (optional);
-				activityGraph.setValue("Skin masked Movement", movementDetector.value);
-				activityGraph.setValue("ROI masked Movement", ROImovementDetector.value);
-				activityGraph.draw(frame);
-				
-				movementDetector.show("maskedSkinMovement");
-				skinDetector.show();
-				edgeDetector.show();
-				handDetector.show();
-
-				// ----------  THIS IS THE VALUE TO PUBLISH TO SSI:  ------------- //
-				//																   //
-				double publishValue = ROImovementDetector.value;				   //
-				//																   //
-				// ----------  THIS IS THE VALUE TO PUBLISH TO SSI   ------------- //
+		pipeline.process(captured, result);
+		if (options.publisher != nullptr)
+			options.publisher->publish(result);
+		int frameWidth = pipeline.frameWidth;
+
+		// the graph is made for the size of the frames, on the first frame and whenever the quality level changes it
+		if (activityGraph.frameWidth != pipeline.frameWidth || activityGraph.frameHeight != pipeline.frameHeight) {
+			activityGraph.setVideoProperties(pipeline.frameWidth, pipeline.frameHeight);
+			activityGraph.clearGraph();
+		}
+
+		cv::imshow("raw", pipeline.frame);
+		pipeline.frame.copyTo(canvas);
+
+		if (result.valid) {
+			canvas.copyTo(faceMat);
+
+			if (pipeline.multiSubject) {
+				pipeline.subjectTracker.draw(canvas);
+			}
+			else {
+				pipeline.handDetector.draw(canvas);
+				pipeline.handDetector.drawTraces(canvas);
 			}
-			initialized = true;
+
+			pipeline.faceDetector.draw(faceMat);
+
+			cv::imshow("face", faceMat);
+			cv::imshow("unfilteredMovement", pipeline.movementEngine.diff);
+
+			// draw the graph (optional);
+			activityGraph.setValue(skinChannel, result.movementValue);
+			activityGraph.setValue(ROIchannel, result.ROImovementValue);
+			activityGraph.draw(canvas);
+
+			pipeline.movementDetector.show("maskedSkinMovement");
+			pipeline.skinDetector.show();
+			pipeline.edgeDetector.show();
+			pipeline.handDetector.show();
 		}
-		else {
-			faceDetector.reset();
-			handDetector.reset();
-			activityGraph.setValue("Skin masked Movement", 0.0);
-			activityGraph.setValue("ROI masked Movement", 0.0);
-			initialized = false;
+		else if (result.faceDetected == false) {
+			activityGraph.setValue(skinChannel, 0.0);
+			activityGraph.setValue(ROIchannel, 0.0);
 		}
 
-		// copy to buffer so we can do a difference check.
-		gray.copyTo(grayPrev);
-
 		// DEBUG
 		if (calcSkip > 0) {
 			calcSkip--;
-			frameIndex++;
-			std::cout << "hiding:" << frameIndex << std::endl;
+			std::cout << "hiding:" << pipeline.frameIndex << std::endl;
 			continue;
 		}
 
-		// debug time elapsed
-		auto elapsed = std::chrono::high_resolution_clock::now() - start;
-		double duration = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1000.0;
-
 		// prepare for next loop
-		cv::putText(frame, joinString("f:", frameIndex), cv::Point(frameWidth - 110, 30), 0, 1, CV_RGB(255, 0, 0), 2);
-		cv::putText(frame, joinString(joinString("t:", duration)," ms"), cv::Point(frameWidth - 110, 50), 0, 0.5, CV_RGB(255, 0, 0), 1);
-		cv::imshow("DebugGUI", frame);
+		cv::putText(canvas, joinString("f:", result.frameIndex), cv::Point(frameWidth - 110, 30), 0, 1, CV_RGB(255, 0, 0), 2);
+		cv::putText(canvas, joinString(joinString("t:", result.duration)," ms"), cv::Point(frameWidth - 110, 50), 0, 0.5, CV_RGB(255, 0, 0), 1);
+		cv::imshow("DebugGUI", canvas);
 
 		int keystroke = cv::waitKey(waitTime);
 		
@@ -213,17 +167,49 @@ int run(cv::VideoCapture& cap, int fps) {
 		else if (keystroke >= 0) {
 			std::cout << "key:" << keystroke << std::endl;
 		}
-
-		frameIndex += 1;
 	}
 
-	// the camera will be deinitialized automatically in VideoCapture destructor
+	// the camera will be deinitialized automatically in FrameSource destructor
 	return 1;
 }
 
 
+/*
+* Run the pipeline without any GUI. The results are written to stdout as csv, one line per frame.
+* The source can be a video file or a camera index.
+*/
+int runHeadless(std::string source, RunOptions& options) {
+	FrameSource frameSource;
+	if (frameSource.open(source) == false) {
+		std::cerr << "Cannot open the video source: " << source << std::endl;
+		return -1;
+	}
+
+	Pipeline pipeline(frameSource.getFps(), true);
+	if (pipeline.setup() == false)
+		return -1;
+	pipeline.setLatencyBudget(options.latencyBudget);
+	pipeline.incremental = options.incremental;
+	pipeline.bodyRegionOnly = options.bodyRegionOnly;
+	pipeline.setOpenCL(options.useOpenCL);
+	pipeline.setMaxSubjects(options.maxSubjects);
+	pipeline.faceDetector.setFastDetection(options.fastFaceDetection);
+	pipeline.faceDetector.setAsynchronous(options.asynchronousFaceDetection);
+
+	writeResultHeader(std::cout);
+	PipelineExecutor executor(pipeline);
+	ResultPublisher* publisher = options.publisher;
+	executor.run(frameSource, [publisher](PipelineResult& result) {
+		writeResult(std::cout, result);
+		if (publisher != nullptr)
+			publisher->publish(result);
+	});
+	std::cout.flush();
+	return 0;
+}
 
-void manage(int movieIndex) {
+
+void manage(int movieIndex, RunOptions& options) {
 	std::vector<std::string> videoList;
 	videoList.push_back("de001_spk02f.mp4");
 	videoList.push_back("de003_spk01f.mp4");
@@ -263,49 +249,274 @@ void manage(int movieIndex) {
 	*/
 	
 	int amountOfMovies = videoList.size();
-	cv::VideoCapture cap;
-	
-	cap.open(joinString("./media/", videoList[movieIndex]));
-	//cap.open(0);
-	// initialize video
-	if (!cap.isOpened()) {
-		std::cout << "Cannot open the video file" << std::endl;
-		return;
-	}
+	FrameSource source;
+	for (;;) {
+		// initialize video, "0" opens the camera instead
+		if (source.open(joinString("./media/", videoList[movieIndex])) == false) {
+			std::cout << "Cannot open the video file" << std::endl;
+			return;
+		}
 
-	// get the fps from the video for the graph time calculation
-	int fps = cap.get(CV_CAP_PROP_FPS);
-	if (fps <= 0 || fps > 60) {
-		fps = 25;
-		std::cout << "WARNING: COULD NOT GET FPS; Defaulting to 25fps." << std::endl;
-	}
+		// run the algorithm
+		int value = run(source, options);
+		source.release();
 
-	// run the algorithm 
-	int value = run(cap, fps);
-	int newIndex = movieIndex;
+		if (value == 1)		  // next movie
+			movieIndex += 1;
+		else if (value == -1)  // previous movie
+			movieIndex -= 1;
+		else if (value != 0) {
+			return;  // quit
+		}
+		else {
+			// if 0, repeat movie
+		}
 
-	if (value == 1)		  // next movie
-		newIndex += 1;
-	else if (value == -1)  // previous movie
-		newIndex -= 1;
-	else if (value != 0) {
-		return;  // quit
+		// make sure the cycle of movies is from 0 to amountOfMovies
+		movieIndex = movieIndex % amountOfMovies;
+		movieIndex = movieIndex < 0 ? movieIndex + amountOfMovies : movieIndex;
 	}
-	else {
-		// if 0, repeat movie
+}
+
+/*
+* Process all videos of a manifest with a pool of pipelines and write the results per video.
+*/
+int runBatch(std::string manifest, std::string outputDirectory, int workers, bool binaryOutput, RunOptions& options) {
+	BatchProcessor batch(workers);
+	batch.incremental = options.incremental;
+	batch.bodyRegionOnly = options.bodyRegionOnly;
+	batch.useOpenCL = options.useOpenCL;
+	batch.maxSubjects = options.maxSubjects;
+	batch.fastFaceDetection = options.fastFaceDetection;
+	batch.asynchronousFaceDetection = options.asynchronousFaceDetection;
+	batch.outputDirectory = outputDirectory;
+	batch.binaryOutput = binaryOutput;
+	if (batch.loadManifest(manifest) == false || batch.loadCascade() == false)
+		return -1;
+
+	BatchSummary summary = batch.run();
+	std::cerr << "processed " << summary.videos - summary.failed << "/" << summary.videos << " videos, "
+		<< summary.frames << " frames in " << summary.seconds << "s (" << summary.fps << " fps)" << std::endl;
+	return summary.failed == 0 ? 0 : 1;
+}
+
+/*
+* Replay the hand detection of all videos in the manifest with every parameter set of the parameter file. The upstream
+* stages are recorded into the cache directory on the first sweep over a video, see SweepRunner.
+*/
+int runSweep(std::string manifest, std::string parametersPath, std::string outputDirectory, std::string cacheDirectory,
+	bool binaryOutput, RunOptions& options) {
+	SweepRunner sweep;
+	sweep.bodyRegionOnly = options.bodyRegionOnly;
+	sweep.fastFaceDetection = options.fastFaceDetection;
+	sweep.outputDirectory = outputDirectory;
+	sweep.cacheDirectory = cacheDirectory;
+	sweep.binaryOutput = binaryOutput;
+	if (sweep.loadManifest(manifest) == false || sweep.loadParameters(parametersPath) == false)
+		return -1;
+
+	SweepSummary summary = sweep.run();
+	std::cerr << "replayed " << summary.videos - summary.failed << "/" << summary.videos << " videos with "
+		<< summary.parameterSets << " parameter sets, " << summary.frames << " frames in " << summary.seconds << "s ("
+		<< summary.recorded << " recorded in " << summary.recordSeconds << "s)" << std::endl;
+	return summary.failed == 0 ? 0 : 1;
+}
+
+/*
+* Serve all sources of the list (files, camera indices or stream urls) at once on a shared pool of workers. The results
+* of all streams are written to stdout as csv with the stream id in front, until every stream has ended.
+*/
+int runStreams(std::string sourceList, int workers, RunOptions& options) {
+	std::vector<std::string> sources;
+	if (readList(sourceList, sources) == false)
+		return -1;
+
+	StreamManager manager(workers);
+	manager.latencyBudget = options.latencyBudget;
+	manager.incremental = options.incremental;
+	manager.bodyRegionOnly = options.bodyRegionOnly;
+	manager.useOpenCL = options.useOpenCL;
+	manager.maxSubjects = options.maxSubjects;
+	manager.fastFaceDetection = options.fastFaceDetection;
+	manager.asynchronousFaceDetection = options.asynchronousFaceDetection;
+	if (manager.loadCascade() == false)
+		return -1;
+
+	std::mutex outputMutex;
+	std::cout << "stream,";
+	writeResultHeader(std::cout);
+	ResultPublisher* publisher = options.publisher;
+	manager.publish = [&outputMutex, publisher](int stream, PipelineResult& result) {
+		// the lock also makes this the single producer of the publisher.
+		std::lock_guard<std::mutex> lock(outputMutex);
+		std::cout << stream << ",";
+		writeResult(std::cout, result);
+		if (publisher != nullptr)
+			publisher->publish(result, stream);
+	};
+
+	for (auto& source : sources)
+		manager.addStream(source);
+	if (manager.getStreamCount() == 0)
+		return -1;
+
+	manager.start();
+	manager.wait();
+	std::cout.flush();
+	return manager.getStreamCount() == int(sources.size()) ? 0 : 1;
+}
+
+/*
+* Write a binary result file as csv to stdout, all columns in the order of its column table.
+*/
+int dumpResultFile(std::string path) {
+	ResultFileReader reader;
+	if (reader.open(path) == false) {
+		std::cerr << "Cannot read the result file: " << path << std::endl;
+		return -1;
 	}
-	
 
-	// make sure the cycle of movies is from 0 to amountOfMovies
-	newIndex = newIndex % amountOfMovies;
-	newIndex = newIndex < 0 ? newIndex + amountOfMovies : newIndex;
-	
-	cap.release();
+	const ResultFileHeader& header = reader.getHeader();
+	std::cerr << reader.getRecordCount() << " frames, " << header.fps << " fps, " << header.frameWidth << "x"
+		<< header.frameHeight << ", " << header.cmInPixels << " px/cm" << std::endl;
+
+	for (int i = 0; i < reader.getColumnCount(); i++)
+		std::cout << (i > 0 ? "," : "") << reader.getColumn(i).name;
+	std::cout << "\n" << std::setprecision(15);
+	for (int64_t record = 0; record < reader.getRecordCount(); record++) {
+		for (int i = 0; i < reader.getColumnCount(); i++)
+			std::cout << (i > 0 ? "," : "") << reader.getValue(record, reader.getColumn(i));
+		std::cout << "\n";
+	}
+	std::cout.flush();
+	return 0;
+}
 
-	manage(newIndex);
+int dispatch(std::vector<std::string>& args, RunOptions& options) {
+	// MercuryGestures --headless <video file or camera index>
+	if (args.size() > 1 && args[0] == "--headless") {
+		return runHeadless(args[1], options);
+	}
+	// MercuryGestures --batch <manifest> <output directory> [workers] [--binary]
+	if (args.size() > 2 && args[0] == "--batch") {
+		bool binaryOutput = args.back() == "--binary";
+		if (binaryOutput)
+			args.pop_back();
+		if (args.size() < 3) {
+			std::cerr << "Usage: MercuryGestures --batch <manifest> <output directory> [workers] [--binary]" << std::endl;
+			return -1;
+		}
+		int workers = args.size() > 3 ? std::atoi(args[3].c_str()) : std::thread::hardware_concurrency();
+		return runBatch(args[1], args[2], workers, binaryOutput, options);
+	}
+	// MercuryGestures --sweep <manifest> <parameter file> <output directory> [cache directory] [--binary]
+	if (args.size() > 3 && args[0] == "--sweep") {
+		bool binaryOutput = args.back() == "--binary";
+		if (binaryOutput)
+			args.pop_back();
+		if (args.size() < 4) {
+			std::cerr << "Usage: MercuryGestures --sweep <manifest> <parameter file> <output directory> [cache directory] [--binary]" << std::endl;
+			return -1;
+		}
+		std::string cacheDirectory = args.size() > 4 ? args[4] : args[3];
+		return runSweep(args[1], args[2], args[3], cacheDirectory, binaryOutput, options);
+	}
+	// MercuryGestures --dump <result file.mgr>
+	if (args.size() > 1 && args[0] == "--dump") {
+		return dumpResultFile(args[1]);
+	}
+	// MercuryGestures --serve <source list> [workers]
+	if (args.size() > 1 && args[0] == "--serve") {
+		int workers = args.size() > 2 ? std::atoi(args[2].c_str()) : std::thread::hardware_concurrency();
+		return runStreams(args[1], workers, options);
+	}
+	manage(5, options);
+	return 0;
 }
 
 int main(int argc, char *argv[]) {
-	manage(5);
-	return 0;
+	// the profiling and publishing options can be given in front of the others:
+	// MercuryGestures --profile <file.csv|file.json> [--profile-interval <seconds>] ...
+	// MercuryGestures --publish <stdout|udp://host:port> ...   (can be given more than once)
+	// MercuryGestures --latency-budget <ms> ...                 (lower the quality to keep up with live feeds)
+	// MercuryGestures --incremental ...                         (only process the changed parts of the frames)
+	// MercuryGestures --body-region ...                         (only process the body region once the face is locked)
+	// MercuryGestures --opencl ...                              (run the per pixel stages on the OpenCL device)
+	// MercuryGestures --subjects <n> ...                        (track up to n people, one face and pair of hands each)
+	// MercuryGestures --fast-face ...                           (run the face cascade downscaled, at the locked size)
+	// MercuryGestures --async-face ...                          (run the face cascade on a thread, track in between)
+	std::vector<std::string> args(argv + 1, argv + argc);
+	std::string profilePath;
+	double profileInterval = 0;
+	ResultPublisher publisher;
+	RunOptions options;
+	bool publishing = false;
+	while (args.size() > 0) {
+		if (args[0] == "--incremental") {
+			options.incremental = true;
+			args.erase(args.begin());
+			continue;
+		}
+		if (args[0] == "--fast-face") {
+			options.fastFaceDetection = true;
+			args.erase(args.begin());
+			continue;
+		}
+		if (args[0] == "--async-face") {
+			options.asynchronousFaceDetection = true;
+			args.erase(args.begin());
+			continue;
+		}
+		if (args[0] == "--body-region") {
+			options.bodyRegionOnly = true;
+			args.erase(args.begin());
+			continue;
+		}
+		if (args[0] == "--opencl") {
+			options.useOpenCL = cv::ocl::haveOpenCL();
+			if (options.useOpenCL)
+				std::cerr << "OpenCL device: " << cv::ocl::Device::getDefault().name() << std::endl;
+			else
+				std::cerr << "WARNING: no OpenCL device available, running on the cpu." << std::endl;
+			args.erase(args.begin());
+			continue;
+		}
+		if (args.size() < 2 || (args[0] != "--profile" && args[0] != "--profile-interval" && args[0] != "--publish" && args[0] != "--latency-budget" && args[0] != "--subjects"))
+			break;
+
+		if (args[0] == "--profile")
+			profilePath = args[1];
+		else if (args[0] == "--profile-interval")
+			profileInterval = std::atof(args[1].c_str());
+		else if (args[0] == "--latency-budget")
+			options.latencyBudget = std::atof(args[1].c_str());
+		else if (args[0] == "--subjects")
+			options.maxSubjects = std::max(1, std::atoi(args[1].c_str()));
+		else {
+			auto sink = createSink(args[1]);
+			if (sink == nullptr)
+				return -1;
+			publisher.addSink(std::move(sink));
+			publishing = true;
+		}
+		args.erase(args.begin(), args.begin() + 2);
+	}
+#ifndef MERCURY_PROFILING
+	if (profilePath.size() > 0)
+		std::cerr << "WARNING: built without MERCURY_PROFILING, the profile will be empty." << std::endl;
+#endif
+	Profiler::instance().setEnabled(profilePath.size() > 0);
+	Profiler::instance().setPeriodicDump(profilePath, profileInterval);
+
+	if (publishing)
+		publisher.start();
+	options.publisher = publishing ? &publisher : nullptr;
+	int value = dispatch(args, options);
+	publisher.stop();
+	if (publisher.getDroppedCount() > 0)
+		std::cerr << "WARNING: " << publisher.getDroppedCount() << " published records were dropped." << std::endl;
+
+	if (profilePath.size() > 0)
+		Profiler::instance().dump(profilePath);
+	return value;
 }
\ No newline at end of file
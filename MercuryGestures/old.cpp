@@ -12,73 +12,6 @@ void generateROImask(cv::Mat& mask, BodyRects& maskBody) {
 }
 
 
-/**
-* This fills a body rect object
-*/
-void getBodyRect(cv::Rect &detectedFace, BodyRects &body) {
-	// the detected face is more or less a square, we will correct the proportions
-	body.face = cv::Rect(
-		(0.5 * detectedFace.width * (1 - faceWidthToHeightRatio)) + detectedFace.x, // shift rect to correct for decrease in width
-		detectedFace.y,
-		detectedFace.width * faceWidthToHeightRatio, // correct the width to match human face proportions
-		detectedFace.height
-		);
-
-	// we use the inverted value to avoid the multiple divisions in the block below.
-	double pixelSizeInCmInv = body.face.height / averageFaceHeight;
-
-	// based on http://i1201.photobucket.com/albums/bb342/Nantchev/Human_proportions_by_BenTs_sTock_zps3aa64481.jpg
-	double armWidth = 15 * pixelSizeInCmInv; // wider than normal arms. If we want to mark an importance area this can be used
-	double armUpperHeight = 35 * pixelSizeInCmInv;
-	double armLowerHeight = 35 * pixelSizeInCmInv;
-	double torsoWidth = 25 * pixelSizeInCmInv;
-	double torsoHeight = 55 * pixelSizeInCmInv;
-	double lapHeight = 50 * pixelSizeInCmInv; // to the end of the frame
-	double neckHeight = 3 * pixelSizeInCmInv; // smaller than a neck would be because people may look down a bit
-
-	body.upperTorso = cv::Rect(
-		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth,
-		body.face.y + body.face.height + neckHeight,
-		torsoWidth,
-		torsoHeight * 0.6
-		);
-	body.lowerTorso = cv::Rect(
-		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth,
-		body.face.y + body.face.height + neckHeight + torsoHeight * 0.6,
-		torsoWidth,
-		torsoHeight * 0.4
-		);
-	body.lap = cv::Rect(
-		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth - armWidth,
-		body.face.y + body.face.height + neckHeight + torsoHeight,
-		torsoWidth + 2 * armWidth,
-		lapHeight
-		);
-	body.armLeftUpper = cv::Rect(
-		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth - armWidth,
-		body.face.y + body.face.height,
-		armWidth,
-		armUpperHeight
-		);
-	body.armLeftLower = cv::Rect(
-		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth - armWidth,
-		body.face.y + body.face.height + armUpperHeight,
-		armWidth,
-		armLowerHeight
-		);
-	body.armRightUpper = cv::Rect(
-		(body.face.x + 0.5 * body.face.width) + 0.5 * torsoWidth,
-		body.face.y + body.face.height,
-		armWidth,
-		armUpperHeight
-		);
-	body.armRightLower = cv::Rect(
-		(body.face.x + 0.5 * body.face.width) + 0.5 * torsoWidth,
-		body.face.y + body.face.height + armUpperHeight,
-		armWidth,
-		armLowerHeight
-		);
-}
 /**
 * using the detected face, we draw the expected positions of the user's body. This can be expanded to generate a mask for the
 * regions of interest.
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "MercuryCore.h"
+#include "Morphology.h"
+#include <fstream>
 
 int getCenterX(cv::Rect& face) {
 	return face.x + 0.5* face.width;
@@ -13,7 +15,7 @@ int getCenterY(cv::Rect& face) {
 /**
 * get the average value of a vector
 */
-double getAverage(std::vector<double> data) {
+double getAverage(const std::vector<double>& data) {
 	double sum = 0;
 	for (int i = 0; i < data.size(); i++) {
 		sum += data[i];
@@ -53,7 +55,7 @@ std::string joinString(int a, std::string b) {
  * this method is a preconfigured dilate call
  */
 void dilate(cv::Mat& inputFrame, cv::Mat& outputFrame, int kernelSize ) {
-	cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(kernelSize, kernelSize));
+	cv::Mat element = getCachedStructuringElement(cv::MORPH_RECT, kernelSize);
 	cv::dilate(inputFrame, outputFrame, element);
 }
 
@@ -61,7 +63,7 @@ void dilate(cv::Mat& inputFrame, cv::Mat& outputFrame, int kernelSize ) {
  * this method is a preconfigured erode call
  */
 void erode(cv::Mat& inputFrame, cv::Mat& outputFrame, int kernelSize ) {
-	cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(kernelSize, kernelSize));
+	cv::Mat element = getCachedStructuringElement(cv::MORPH_RECT, kernelSize);
 	cv::erode(inputFrame, outputFrame, element);
 }
 
@@ -122,6 +124,21 @@ cv::Rect inflateRect(cv::Rect& rectangle, int inflation, cv::Mat& boundary) {
 	return cv::Rect(x, y, width, height);
 }
 
+/*
+* Only the bands around the area are written, the area itself is left alone.
+*/
+void clearOutside(cv::Mat& mat, cv::Rect& area) {
+	cv::Rect inner = area & cv::Rect(0, 0, mat.cols, mat.rows);
+	if (inner.area() == 0) {
+		mat.setTo(0);
+		return;
+	}
+	mat.rowRange(0, inner.y).setTo(0);
+	mat.rowRange(inner.y + inner.height, mat.rows).setTo(0);
+	mat(cv::Rect(0, inner.y, inner.x, inner.height)).setTo(0);
+	mat(cv::Rect(inner.x + inner.width, inner.y, mat.cols - inner.x - inner.width, inner.height)).setTo(0);
+}
+
 //TODO: explain
 void getSearchSpace(SearchSpace& empty, cv::Mat& inputSpace, cv::Point& focalPoint, int searchSpaceRadius) {
 	empty.x = std::max(0, std::min(inputSpace.cols, focalPoint.x - searchSpaceRadius));
@@ -175,4 +192,126 @@ void rect(cv::Mat& mat, cv::Point point, int radius, cv::Scalar color, int thick
 	cv::Rect rect(point.x - radius, point.y - radius, 2 * radius, 2 * radius);
 	cv::rectangle(mat, rect, color, thickness);
 #endif
+}
+
+/*
+ * This fills a body rect object: the expected position of the body parts based on the detected face.
+ */
+void getBodyRect(cv::Rect &detectedFace, BodyRects &body) {
+	// the detected face is more or less a square, we will correct the proportions
+	body.face = cv::Rect(
+		(0.5 * detectedFace.width * (1 - faceWidthToHeightRatio)) + detectedFace.x, // shift rect to correct for decrease in width
+		detectedFace.y,
+		detectedFace.width * faceWidthToHeightRatio, // correct the width to match human face proportions
+		detectedFace.height
+		);
+
+	// we use the inverted value to avoid the multiple divisions in the block below.
+	double pixelSizeInCmInv = body.face.height / averageFaceHeight;
+
+	// based on http://i1201.photobucket.com/albums/bb342/Nantchev/Human_proportions_by_BenTs_sTock_zps3aa64481.jpg
+	double armWidth = 15 * pixelSizeInCmInv; // wider than normal arms. If we want to mark an importance area this can be used
+	double armUpperHeight = 35 * pixelSizeInCmInv;
+	double armLowerHeight = 35 * pixelSizeInCmInv;
+	double torsoWidth = 25 * pixelSizeInCmInv;
+	double torsoHeight = 55 * pixelSizeInCmInv;
+	double lapHeight = 50 * pixelSizeInCmInv; // to the end of the frame
+	double neckHeight = 3 * pixelSizeInCmInv; // smaller than a neck would be because people may look down a bit
+
+	body.upperTorso = cv::Rect(
+		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth,
+		body.face.y + body.face.height + neckHeight,
+		torsoWidth,
+		torsoHeight * 0.6
+		);
+	body.lowerTorso = cv::Rect(
+		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth,
+		body.face.y + body.face.height + neckHeight + torsoHeight * 0.6,
+		torsoWidth,
+		torsoHeight * 0.4
+		);
+	body.lap = cv::Rect(
+		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth - armWidth,
+		body.face.y + body.face.height + neckHeight + torsoHeight,
+		torsoWidth + 2 * armWidth,
+		lapHeight
+		);
+	body.armLeftUpper = cv::Rect(
+		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth - armWidth,
+		body.face.y + body.face.height,
+		armWidth,
+		armUpperHeight
+		);
+	body.armLeftLower = cv::Rect(
+		(body.face.x + 0.5 * body.face.width) - 0.5 * torsoWidth - armWidth,
+		body.face.y + body.face.height + armUpperHeight,
+		armWidth,
+		armLowerHeight
+		);
+	body.armRightUpper = cv::Rect(
+		(body.face.x + 0.5 * body.face.width) + 0.5 * torsoWidth,
+		body.face.y + body.face.height,
+		armWidth,
+		armUpperHeight
+		);
+	body.armRightLower = cv::Rect(
+		(body.face.x + 0.5 * body.face.width) + 0.5 * torsoWidth,
+		body.face.y + body.face.height + armUpperHeight,
+		armWidth,
+		armLowerHeight
+		);
+}
+
+/*
+* get the fps from the video for the graph time calculation
+*/
+int getFps(cv::VideoCapture& cap) {
+	int fps = cap.get(CV_CAP_PROP_FPS);
+	if (fps <= 0 || fps > 60) {
+		fps = 25;
+		std::cerr << "WARNING: COULD NOT GET FPS; Defaulting to 25fps." << std::endl;
+	}
+	return fps;
+}
+
+
+/*
+ * The wall clock time in microseconds since the epoch.
+ */
+long long getTimestamp() {
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+/*
+ * Open a video file, stream url or camera. A source made of only digits is a camera index.
+ */
+bool openSource(cv::VideoCapture& cap, std::string source) {
+	if (source.size() > 0 && std::all_of(source.begin(), source.end(), ::isdigit))
+		cap.open(std::stoi(source));
+	else
+		cap.open(source);
+	return cap.isOpened();
+}
+
+/*
+ * Read a list file with one entry per line. Empty lines and lines starting with # are skipped.
+ */
+bool readList(std::string path, std::vector<std::string>& entries) {
+	std::ifstream list(path);
+	if (!list.is_open()) {
+		std::cerr << "Cannot open the list: " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(list, line)) {
+		// trim whitespace and windows line endings
+		size_t first = line.find_first_not_of(" \t\r");
+		size_t last = line.find_last_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+		entries.push_back(line.substr(first, last - first + 1));
+	}
+	return true;
 }
\ No newline at end of file